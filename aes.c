@@ -0,0 +1,280 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * AES (FIPS-197) in CTR mode (NIST SP 800-38A), used to encrypt
+ * the payload. Only the encryption direction of the block cipher
+ * is needed. The keystream is generated AES_CTR_BUFF bytes at a
+ * time, with AES-NI if the CPU supports it, or with a portable
+ * (table based, not constant-time) implementation otherwise.
+ */
+
+#include <string.h>
+
+#include "aes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AESNI
+#endif
+
+/* Forward S-box. */
+static const uint8_t sbox[256] = {
+	0x63,0x7c,0x77,0x7b,0xf2,0x6b,0x6f,0xc5,0x30,0x01,0x67,0x2b,0xfe,0xd7,0xab,0x76,
+	0xca,0x82,0xc9,0x7d,0xfa,0x59,0x47,0xf0,0xad,0xd4,0xa2,0xaf,0x9c,0xa4,0x72,0xc0,
+	0xb7,0xfd,0x93,0x26,0x36,0x3f,0xf7,0xcc,0x34,0xa5,0xe5,0xf1,0x71,0xd8,0x31,0x15,
+	0x04,0xc7,0x23,0xc3,0x18,0x96,0x05,0x9a,0x07,0x12,0x80,0xe2,0xeb,0x27,0xb2,0x75,
+	0x09,0x83,0x2c,0x1a,0x1b,0x6e,0x5a,0xa0,0x52,0x3b,0xd6,0xb3,0x29,0xe3,0x2f,0x84,
+	0x53,0xd1,0x00,0xed,0x20,0xfc,0xb1,0x5b,0x6a,0xcb,0xbe,0x39,0x4a,0x4c,0x58,0xcf,
+	0xd0,0xef,0xaa,0xfb,0x43,0x4d,0x33,0x85,0x45,0xf9,0x02,0x7f,0x50,0x3c,0x9f,0xa8,
+	0x51,0xa3,0x40,0x8f,0x92,0x9d,0x38,0xf5,0xbc,0xb6,0xda,0x21,0x10,0xff,0xf3,0xd2,
+	0xcd,0x0c,0x13,0xec,0x5f,0x97,0x44,0x17,0xc4,0xa7,0x7e,0x3d,0x64,0x5d,0x19,0x73,
+	0x60,0x81,0x4f,0xdc,0x22,0x2a,0x90,0x88,0x46,0xee,0xb8,0x14,0xde,0x5e,0x0b,0xdb,
+	0xe0,0x32,0x3a,0x0a,0x49,0x06,0x24,0x5c,0xc2,0xd3,0xac,0x62,0x91,0x95,0xe4,0x79,
+	0xe7,0xc8,0x37,0x6d,0x8d,0xd5,0x4e,0xa9,0x6c,0x56,0xf4,0xea,0x65,0x7a,0xae,0x08,
+	0xba,0x78,0x25,0x2e,0x1c,0xa6,0xb4,0xc6,0xe8,0xdd,0x74,0x1f,0x4b,0xbd,0x8b,0x8a,
+	0x70,0x3e,0xb5,0x66,0x48,0x03,0xf6,0x0e,0x61,0x35,0x57,0xb9,0x86,0xc1,0x1d,0x9e,
+	0xe1,0xf8,0x98,0x11,0x69,0xd9,0x8e,0x94,0x9b,0x1e,0x87,0xe9,0xce,0x55,0x28,0xdf,
+	0x8c,0xa1,0x89,0x0d,0xbf,0xe6,0x42,0x68,0x41,0x99,0x2d,0x0f,0xb0,0x54,0xbb,0x16
+};
+
+/* Whether AES-NI is used: -1 = not checked yet. */
+static int use_aesni = -1;
+
+/**
+ * @brief Multiplies @p x by 2 in GF(2^8).
+ *
+ * @param x Value.
+ *
+ * @return Returns the product.
+ */
+static inline uint8_t xtime(uint8_t x)
+{
+	return ((x << 1) ^ ((x & 0x80) ? 0x1b : 0));
+}
+
+/**
+ * @brief Increments the 128-bit big-endian counter block @p ctr.
+ *
+ * @param ctr Counter block.
+ */
+static inline void ctr_inc(uint8_t *ctr)
+{
+	int i;
+	for (i = AES_BLOCK - 1; i >= 0; i--)
+		if (++ctr[i])
+			break;
+}
+
+/**
+ * @brief Expands the cipher key @p key into the round keys
+ * of @p c.
+ *
+ * @param c   AES-CTR state.
+ * @param key Cipher key.
+ * @param nk  Key length, in 32-bit words (4, 6 or 8).
+ */
+static void key_expand(struct aes_ctr *c, const uint8_t *key, int nk)
+{
+	uint8_t t[4], tmp, rcon;
+	int i, j;
+
+	c->nr = nk + 6;
+	memcpy(c->rk, key, nk * 4);
+
+	rcon = 1;
+	for (i = nk; i < 4 * (c->nr + 1); i++)
+	{
+		memcpy(t, c->rk + (i - 1) * 4, 4);
+		if (i % nk == 0) {
+			tmp  = t[0];
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[tmp];
+			rcon = xtime(rcon);
+		}
+		else if (nk > 6 && i % nk == 4) {
+			for (j = 0; j < 4; j++)
+				t[j] = sbox[t[j]];
+		}
+		for (j = 0; j < 4; j++)
+			c->rk[i * 4 + j] = c->rk[(i - nk) * 4 + j] ^ t[j];
+	}
+}
+
+/**
+ * @brief Encrypts the block @p in into @p out (portable version).
+ *
+ * @param c   AES-CTR state (round keys).
+ * @param in  Input block.
+ * @param out Output block.
+ */
+static void encrypt_block(const struct aes_ctr *c, const uint8_t *in,
+	uint8_t *out)
+{
+	uint8_t s[AES_BLOCK], t[AES_BLOCK];
+	uint8_t all;
+	int r, i;
+
+	for (i = 0; i < AES_BLOCK; i++)
+		s[i] = in[i] ^ c->rk[i];
+
+	for (r = 1; r <= c->nr; r++)
+	{
+		/* SubBytes + ShiftRows (column-major state). */
+		for (i = 0; i < AES_BLOCK; i++)
+			t[i] = sbox[s[(i + 4 * (i & 3)) & 15]];
+
+		/* MixColumns, except in the last round. */
+		if (r < c->nr) {
+			for (i = 0; i < AES_BLOCK; i += 4) {
+				all      = t[i] ^ t[i + 1] ^ t[i + 2] ^ t[i + 3];
+				s[i]     = t[i]     ^ all ^ xtime(t[i]     ^ t[i + 1]);
+				s[i + 1] = t[i + 1] ^ all ^ xtime(t[i + 1] ^ t[i + 2]);
+				s[i + 2] = t[i + 2] ^ all ^ xtime(t[i + 2] ^ t[i + 3]);
+				s[i + 3] = t[i + 3] ^ all ^ xtime(t[i + 3] ^ t[i]);
+			}
+		}
+		else
+			memcpy(s, t, AES_BLOCK);
+
+		for (i = 0; i < AES_BLOCK; i++)
+			s[i] ^= c->rk[r * AES_BLOCK + i];
+	}
+
+	memcpy(out, s, AES_BLOCK);
+}
+
+#ifdef HAVE_AESNI
+/**
+ * @brief Generates the next AES_CTR_BUFF keystream bytes with
+ * AES-NI, four blocks at a time.
+ *
+ * @param c AES-CTR state.
+ */
+__attribute__((target("aes,sse2")))
+static void refill_aesni(struct aes_ctr *c)
+{
+	__m128i rk[15], b[4];
+	int i, j, r;
+
+	for (r = 0; r <= c->nr; r++)
+		rk[r] = _mm_loadu_si128((const __m128i *)(c->rk + r * AES_BLOCK));
+
+	for (i = 0; i < AES_CTR_BUFF; i += 4 * AES_BLOCK)
+	{
+		for (j = 0; j < 4; j++) {
+			b[j] = _mm_xor_si128(
+				_mm_loadu_si128((const __m128i *)c->ctr), rk[0]);
+			ctr_inc(c->ctr);
+		}
+		for (r = 1; r < c->nr; r++)
+			for (j = 0; j < 4; j++)
+				b[j] = _mm_aesenc_si128(b[j], rk[r]);
+		for (j = 0; j < 4; j++)
+			_mm_storeu_si128((__m128i *)(c->ks + i + j * AES_BLOCK),
+				_mm_aesenclast_si128(b[j], rk[c->nr]));
+	}
+}
+#endif
+
+/**
+ * @brief Generates the next AES_CTR_BUFF keystream bytes.
+ *
+ * @param c AES-CTR state.
+ */
+void aes_ctr_refill(struct aes_ctr *c)
+{
+	int i;
+
+#ifdef HAVE_AESNI
+	if (use_aesni) {
+		refill_aesni(c);
+		c->pos = 0;
+		return;
+	}
+#endif
+
+	for (i = 0; i < AES_CTR_BUFF; i += AES_BLOCK) {
+		encrypt_block(c, c->ctr, c->ks + i);
+		ctr_inc(c->ctr);
+	}
+	c->pos = 0;
+}
+
+/**
+ * @brief Initializes the AES-CTR state @p c.
+ *
+ * @param c       AES-CTR state.
+ * @param key     Cipher key.
+ * @param key_len Key length: 16, 24 or 32 bytes (AES-128, 192
+ *                or 256).
+ * @param iv      Initial counter block (AES_BLOCK bytes).
+ *
+ * @return Returns 1 if success, 0 if invalid key length.
+ */
+int aes_ctr_init(struct aes_ctr *c, const uint8_t *key, size_t key_len,
+	const uint8_t *iv)
+{
+	if (key_len != 16 && key_len != 24 && key_len != 32)
+		return (0);
+
+	if (use_aesni < 0) {
+#ifdef HAVE_AESNI
+		__builtin_cpu_init();
+		use_aesni = __builtin_cpu_supports("aes") != 0;
+#else
+		use_aesni = 0;
+#endif
+	}
+
+	key_expand(c, key, key_len / 4);
+	memcpy(c->ctr, iv, AES_BLOCK);
+	c->pos = AES_CTR_BUFF;
+	return (1);
+}
+
+/**
+ * @brief Clears the key material of @p c.
+ *
+ * @param c AES-CTR state.
+ */
+void aes_ctr_wipe(struct aes_ctr *c)
+{
+	volatile uint8_t *p = (volatile uint8_t *)c;
+	size_t i;
+	for (i = 0; i < sizeof(*c); i++)
+		p[i] = 0;
+}
+
+/**
+ * @brief Returns the name of the AES implementation in use.
+ *
+ * @return Returns "aes-ni" or "portable".
+ */
+const char *aes_impl(void)
+{
+	return (use_aesni > 0 ? "aes-ni" : "portable");
+}
@@ -0,0 +1,65 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef AES_H
+#define AES_H
+
+	#include <stddef.h>
+	#include <stdint.h>
+
+	#define AES_BLOCK    16
+	#define AES_CTR_BUFF 256 /* Keystream bytes generated at once. */
+
+	/* AES-CTR state. */
+	struct aes_ctr
+	{
+		uint8_t  rk[15 * AES_BLOCK]; /* Round keys.             */
+		int      nr;                 /* Rounds: 10, 12 or 14.   */
+		uint8_t  ctr[AES_BLOCK];     /* Next counter block.     */
+		uint8_t  ks[AES_CTR_BUFF];   /* Keystream.              */
+		unsigned pos;                /* Next keystream byte.    */
+	};
+
+	extern int  aes_ctr_init(struct aes_ctr *c, const uint8_t *key,
+		size_t key_len, const uint8_t *iv);
+	extern void aes_ctr_refill(struct aes_ctr *c);
+	extern void aes_ctr_wipe(struct aes_ctr *c);
+	extern const char *aes_impl(void);
+
+	/**
+	 * @brief Returns the next keystream byte of @p c, to be
+	 * XORed with the next payload byte.
+	 *
+	 * @param c AES-CTR state.
+	 *
+	 * @return Returns the keystream byte.
+	 */
+	static inline uint8_t aes_ctr_next(struct aes_ctr *c)
+	{
+		if (c->pos == AES_CTR_BUFF)
+			aes_ctr_refill(c);
+		return (c->ks[c->pos++]);
+	}
+
+#endif /* AES_H */
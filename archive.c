@@ -0,0 +1,995 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Archive mode: scans, reads or audits the x86 ELF members of
+ * a tar (or cpio 'newc') stream, without unpacking it to disk.
+ *
+ * The archive is read sequentially (so it can come from a pipe,
+ * e.g.: after being decompressed by xz, zstd or rpm2cpio), and
+ * every x86 ELF member is loaded into memory and queued to a
+ * worker pool. The queue is bounded, so that the memory usage
+ * does not depend on the archive size.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+#include "audit.h"
+#include "decode.h"
+#include "elf.h"
+#include "report.h"
+#include "stream.h"
+#include "util.h"
+#include "main.h"
+
+/* Formats. */
+#define ARCHIVE_TAR  1 /* ustar, GNU and pax.     */
+#define ARCHIVE_CPIO 2 /* cpio 'newc' (rpm2cpio). */
+
+/* Longest member name accepted (GNU/pax long names). */
+#define ARCHIVE_NAME_MAX 4096
+
+/* Largest extended header (GNU long name or pax records). */
+#define ARCHIVE_EXT_MAX (1 << 20)
+
+/* tar. */
+#define TAR_BLOCK 512
+#define TAR_REG   '0'
+#define TAR_AREG  '\0' /* Old (pre-POSIX) regular file. */
+#define TAR_CONT  '7'
+#define TAR_GNU_LONGNAME 'L'
+#define TAR_PAX_LOCAL    'x'
+
+/* cpio 'newc': 110 bytes of ASCII hex fields. */
+#define CPIO_HDR_SIZE 110
+#define CPIO_TRAILER  "TRAILER!!!"
+
+/* Sequential archive input. */
+struct archive_in
+{
+	FILE    *f;
+	uint64_t pos;
+};
+
+/* ELF member, loaded into memory. */
+struct archive_member
+{
+	char    *name;
+	uint8_t *buff;
+	size_t   size;
+};
+
+/* Work shared between the reader and the worker threads. */
+struct archive_job
+{
+	const struct archive_opts *opts;
+
+	/* Bounded member queue. */
+	struct archive_member *queue;
+	size_t qcap;
+	size_t qhead;
+	size_t qcount;
+	int    done;
+	pthread_mutex_t lock;
+	pthread_cond_t  not_empty;
+	pthread_cond_t  not_full;
+
+	/* Results. */
+	size_t members;
+	size_t elf_files;
+	size_t failed;   /* Or modified, if auditing. */
+};
+
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Reads exactly @p len bytes from the archive.
+ *
+ * @param in   Archive input.
+ * @param buff Destination buffer.
+ * @param len  Amount of bytes.
+ *
+ * @return Returns 1 if success, 0 if EOF or error.
+ */
+static int in_read(struct archive_in *in, void *buff, size_t len)
+{
+	if (fread(buff, 1, len, in->f) != len)
+		return (0);
+	in->pos += len;
+	return (1);
+}
+
+/**
+ * @brief Skips @p len bytes of the archive. Since the archive
+ * may come from a pipe, the bytes are read and discarded.
+ *
+ * @param in  Archive input.
+ * @param len Amount of bytes.
+ *
+ * @return Returns 1 if success, 0 if EOF or error.
+ */
+static int in_skip(struct archive_in *in, uint64_t len)
+{
+	uint8_t buff[16 << 10];
+	size_t chunk;
+
+	while (len)
+	{
+		chunk = len < sizeof(buff) ? len : sizeof(buff);
+		if (!in_read(in, buff, chunk))
+			return (0);
+		len -= chunk;
+	}
+	return (1);
+}
+
+/**
+ * @brief Parses a numeric field of @p len characters in base
+ * @p base (8 or 16), stopping at the first NUL or space.
+ *
+ * @param field Field.
+ * @param len   Field length.
+ * @param base  Numeric base.
+ * @param out   Parsed value.
+ *
+ * @return Returns 1 if success, 0 if invalid.
+ */
+static int parse_num(const uint8_t *field, size_t len, int base,
+	uint64_t *out)
+{
+	uint64_t v;
+	size_t i;
+	int d;
+
+	/* Leading spaces (old tar). */
+	for (i = 0; i < len && field[i] == ' '; i++);
+
+	for (v = 0; i < len && field[i] && field[i] != ' '; i++)
+	{
+		if (field[i] >= '0' && field[i] <= '9')
+			d = field[i] - '0';
+		else if (base == 16 && field[i] >= 'a' && field[i] <= 'f')
+			d = field[i] - 'a' + 10;
+		else if (base == 16 && field[i] >= 'A' && field[i] <= 'F')
+			d = field[i] - 'A' + 10;
+		else
+			return (0);
+
+		if (d >= base || v > (UINT64_MAX - d) / base)
+			return (0);
+		v = v * base + d;
+	}
+
+	*out = v;
+	return (1);
+}
+
+/**
+ * @brief Parses the size field of a tar header: octal, or
+ * big-endian base-256 (GNU) for files of 8 GiB or larger.
+ *
+ * @param field Size field (12 bytes).
+ * @param out   Parsed size.
+ *
+ * @return Returns 1 if success, 0 if invalid.
+ */
+static int tar_size(const uint8_t *field, uint64_t *out)
+{
+	uint64_t v;
+	int i;
+
+	if (!(field[0] & 0x80))
+		return (parse_num(field, 12, 8, out));
+
+	/* Negative sizes make no sense. */
+	if (field[0] & 0x40)
+		return (0);
+
+	for (i = 1, v = field[0] & 0x3F; i < 12; i++)
+	{
+		if (v >> 56)
+			return (0);
+		v = (v << 8) | field[i];
+	}
+
+	*out = v;
+	return (1);
+}
+
+/**
+ * @brief Validates the checksum of the tar header @p hdr.
+ * Both the unsigned (POSIX) and signed (old implementations)
+ * sums are accepted.
+ *
+ * @param hdr Header block.
+ *
+ * @return Returns 1 if valid, 0 otherwise.
+ */
+static int tar_checksum(const uint8_t *hdr)
+{
+	uint64_t chk;
+	long usum, ssum;
+	int i;
+
+	if (!parse_num(hdr + 148, 8, 8, &chk))
+		return (0);
+
+	for (i = 0, usum = 0, ssum = 0; i < TAR_BLOCK; i++)
+	{
+		if (i >= 148 && i < 156) {
+			usum += ' ';
+			ssum += ' ';
+			continue;
+		}
+		usum += hdr[i];
+		ssum += (signed char)hdr[i];
+	}
+
+	return ((uint64_t)usum == chk || (uint64_t)ssum == chk);
+}
+
+/**
+ * @brief Reads @p size bytes of extended header data (GNU long
+ * name or pax records) into a NUL-terminated buffer.
+ *
+ * @param in   Archive input.
+ * @param size Data size.
+ *
+ * @return Returns the buffer, or NULL if error.
+ */
+static char *tar_read_ext(struct archive_in *in, uint64_t size)
+{
+	char *buff;
+
+	/* pax records may hold more than a name, but not much more. */
+	if (size > ARCHIVE_EXT_MAX)
+		errto(out0, "tar: extended header too large!\n");
+
+	if (!(buff = malloc(size + 1)))
+		errx("Unable to allocate memory!\n");
+
+	if (!in_read(in, buff, size) ||
+		!in_skip(in, (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK))
+	{
+		free(buff);
+		errto(out0, "tar: truncated archive!\n");
+	}
+
+	buff[size] = '\0';
+	return (buff);
+out0:
+	return (NULL);
+}
+
+/**
+ * @brief Parses the pax extended header records in @p recs
+ * ("<len> <key>=<value>\n"), keeping the ones that matter to
+ * us: 'path' and 'size'.
+ *
+ * @param recs  Records, NUL-terminated.
+ * @param size  Records size.
+ * @param name  Long name, if 'path' is found (must be freed).
+ * @param fsize Member size, if 'size' is found (unchanged
+ *              otherwise).
+ *
+ * @return Returns 1 if success, 0 if invalid.
+ */
+static int pax_parse(char *recs, uint64_t size, char **name,
+	uint64_t *fsize)
+{
+	uint64_t len, off, v;
+	char *rec, *key, *val, *end;
+
+	for (off = 0; off < size; off += len)
+	{
+		rec = recs + off;
+		len = strtoull(rec, &end, 10);
+		if (*end != ' ' || len < 5 || len > size - off ||
+			rec[len - 1] != '\n')
+		{
+			return (0);
+		}
+
+		rec[len - 1] = '\0';
+		key = end + 1;
+		if (!(val = strchr(key, '=')))
+			return (0);
+		*val++ = '\0';
+
+		if (!strcmp(key, "path")) {
+			free(*name);
+			if (!(*name = strdup(val)))
+				errx("Unable to allocate memory!\n");
+		}
+		else if (!strcmp(key, "size")) {
+			if (!parse_num((const uint8_t *)val, strlen(val), 10, &v))
+				return (0);
+			*fsize = v;
+		}
+	}
+	return (1);
+}
+
+/**
+ * @brief Joins the ustar prefix and name fields of the tar
+ * header @p hdr into a new string.
+ *
+ * @param hdr Header block.
+ *
+ * @return Returns the member name (must be freed).
+ */
+static char *tar_name(const uint8_t *hdr)
+{
+	size_t plen, nlen;
+	char *name;
+
+	nlen = strnlen((const char *)hdr, 100);
+	plen = 0;
+
+	/* The prefix field only exists in POSIX ustar. */
+	if (!memcmp(hdr + 257, "ustar\0", 6))
+		plen = strnlen((const char *)hdr + 345, 155);
+
+	if (!(name = malloc(plen + nlen + 2)))
+		errx("Unable to allocate memory!\n");
+
+	if (plen) {
+		memcpy(name, hdr + 345, plen);
+		name[plen++] = '/';
+	}
+	memcpy(name + plen, hdr, nlen);
+	name[plen + nlen] = '\0';
+	return (name);
+}
+
+/**
+ * @brief Loads a member of @p size bytes from the archive if it
+ * is an x86 ELF file, or skips it otherwise.
+ *
+ * @param in   Archive input.
+ * @param size Member size.
+ * @param buff Loaded member, or NULL if skipped.
+ *
+ * @return Returns 1 if success, 0 if EOF or error.
+ */
+static int member_load(struct archive_in *in, uint64_t size,
+	uint8_t **buff)
+{
+	uint8_t hdr[ELF_PROBE_SIZE];
+
+	*buff = NULL;
+
+	/* Too small to be an ELF file worth loading. */
+	if (size < 64 || size > SIZE_MAX)
+		return (in_skip(in, size));
+
+	if (!in_read(in, hdr, sizeof hdr))
+		return (0);
+
+	if (!elf_is_x86(hdr))
+		return (in_skip(in, size - sizeof hdr));
+
+	if (!(*buff = malloc(size)))
+		errx("Unable to allocate memory!\n");
+
+	memcpy(*buff, hdr, sizeof hdr);
+	if (!in_read(in, *buff + sizeof hdr, size - sizeof hdr)) {
+		free(*buff);
+		*buff = NULL;
+		return (0);
+	}
+	return (1);
+}
+
+/**
+ * @brief Payload stream callback for the read mode.
+ *
+ * @param data Payload stream.
+ * @param c    Byte read from the ELF member.
+ *
+ * @return Returns 1 if more bytes are expected, 0 otherwise.
+ */
+static int member_put_byte(void *data, int c)
+{
+	return (stream_put_byte(data, c));
+}
+
+/**
+ * @brief Builds the output path of the member @p name inside
+ * the output directory: the whole member path is kept, with
+ * '/' replaced by '_', so that members with the same base name
+ * do not clash.
+ *
+ * @param out_dir Output directory.
+ * @param name    Member name.
+ *
+ * @return Returns the output path (must be freed).
+ */
+static char *member_out_path(const char *out_dir, const char *name)
+{
+	char *path, *p;
+	size_t size;
+
+	while (*name == '/' || (name[0] == '.' && name[1] == '/'))
+		name += (*name == '/') ? 1 : 2;
+
+	size = strlen(out_dir) + strlen(name) + 2;
+	if (!(path = malloc(size)))
+		errx("Unable to allocate memory!\n");
+
+	p = path + snprintf(path, size, "%s/", out_dir);
+	for (; *name; name++)
+		*p++ = (*name == '/') ? '_' : *name;
+	*p = '\0';
+	return (path);
+}
+
+/**
+ * @brief Writes the decode error that stopped the member
+ * @p name, as a JSON line, to @p f.
+ *
+ * @param ctx  Decoding context, stopped by the error.
+ * @param name Member name.
+ * @param f    Output stream.
+ */
+static void member_decode_error(const struct decode_ctx *ctx,
+	const char *name, FILE *f)
+{
+	fputs("{\"file\":", f);
+	report_json_str(f, name);
+	fprintf(f, ",\"error\":\"decode error at .text offset %ju (%s)\"}\n",
+		(uintmax_t)ctx->error_off, xed_error_enum_t2str(ctx->error));
+}
+
+/**
+ * @brief Reads the payload of an already parsed ELF member
+ * into its own file inside the output directory.
+ *
+ * @param opts Archive options.
+ * @param ctx  Decoding context, with the member loaded.
+ * @param name Member name.
+ * @param f    Output stream (result line).
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int member_read(const struct archive_opts *opts,
+	struct decode_ctx *ctx, const char *name, FILE *f)
+{
+	struct stream s;
+	char *path;
+	FILE *out;
+	int ret;
+
+	ret  = 0;
+	path = member_out_path(opts->out_dir, name);
+
+	if (!(out = fopen(path, "wb")))
+		goto out0;
+
+	if (!stream_init(&s, 0, NULL, out))
+		goto out1;
+
+	if (opts->key_len && !stream_set_key(&s, opts->key, opts->key_len))
+		goto out2;
+
+	/* The limit counts payload bytes, after the stream header. */
+	s.limit       = opts->amnt_should_read / 8;
+	ctx->put_byte = member_put_byte;
+	ctx->data     = &s;
+	if (!decode_instructions(ctx)) {
+		member_decode_error(ctx, name, f);
+		ret = -1;
+		goto out2;
+	}
+
+	fputs("{\"file\":", f);
+	report_json_str(f, name);
+	fputs(",\"output\":", f);
+	report_json_str(f, path);
+	fprintf(f, ",\"bytes\":%ju,\"decode_errors\":%zu}\n",
+		(uintmax_t)s.raw_bytes, ctx->decode_errors);
+	ret = 1;
+
+out2:
+	stream_finish(&s);
+out1:
+	if (fclose(out) && ret > 0)
+		ret = 0;
+out0:
+	if (!ret) {
+		fputs("{\"file\":", f);
+		report_json_str(f, name);
+		fputs(",\"error\":\"unable to write the payload\"}\n", f);
+	}
+	free(path);
+	return (ret > 0);
+}
+
+/**
+ * @brief Process (scan, read or audit) a single ELF member
+ * and writes its result, as a JSON line, to @p f.
+ *
+ * @param opts Archive options.
+ * @param m    Member.
+ * @param f    Output stream.
+ *
+ * @return Returns 1 if the member failed (or, if auditing,
+ * was found modified), 0 otherwise.
+ */
+static int member_process(const struct archive_opts *opts,
+	struct archive_member *m, FILE *f)
+{
+	struct decode_ctx ctx;
+	int ret;
+
+	/* A bad member must not abort the whole archive. */
+	decode_init(&ctx, opts->flags | FLG_NOABORT);
+	ctx.info.file_buff = m->buff;
+	ctx.info.file_size = m->size;
+	ctx.info.elf_fd    = -1;
+
+	if (!parse_elf_text(&ctx.info)) {
+		fputs("{\"file\":", f);
+		report_json_str(f, m->name);
+		fputs(",\"error\":\"unable to load .text\"}\n", f);
+		return (1);
+	}
+	set_machine_mode(&ctx.info);
+
+	if (opts->audit)
+		return (audit_elf(m->name, &ctx.info, opts->audit == 2, f)
+			== AUDIT_MODIFIED);
+
+	if (opts->flags & FLG_READ)
+		ret = !member_read(opts, &ctx, m->name, f);
+	else if (!decode_instructions(&ctx)) {
+		member_decode_error(&ctx, m->name, f);
+		ret = 1;
+	}
+	else {
+		fputs("{\"file\":", f);
+		report_json_str(f, m->name);
+		fprintf(f, ",\"instructions\":%zu,\"eligible\":%zu,\"bytes\":%zu"
+			",\"decode_errors\":%zu}\n", ctx.total_inst_count,
+			ctx.patch_inst_count, ctx.capacity_bits / 8, ctx.decode_errors);
+		ret = 0;
+	}
+
+	decode_release(&ctx);
+	return (ret);
+}
+
+/**
+ * @brief Process a member and writes its result line atomically,
+ * then frees the member.
+ *
+ * @param job Archive job.
+ * @param m   Member.
+ */
+static void member_run(struct archive_job *job, struct archive_member *m)
+{
+	size_t len;
+	char *buff;
+	FILE *f;
+
+	if (!(f = open_memstream(&buff, &len)))
+		errx("Unable to allocate memory!\n");
+
+	if (member_process(job->opts, m, f))
+		__atomic_fetch_add(&job->failed, 1, __ATOMIC_RELAXED);
+	fclose(f);
+
+	pthread_mutex_lock(&out_lock);
+	fwrite(buff, 1, len, stdout);
+	fflush(stdout);
+	pthread_mutex_unlock(&out_lock);
+
+	free(buff);
+	free(m->buff);
+	free(m->name);
+}
+
+/**
+ * @brief Worker thread: process queued members until the
+ * archive is over and the queue is empty.
+ *
+ * @param arg Archive job.
+ *
+ * @return Always NULL.
+ */
+static void *archive_worker(void *arg)
+{
+	struct archive_job *job = arg;
+	struct archive_member m;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&job->lock);
+		while (!job->qcount && !job->done)
+			pthread_cond_wait(&job->not_empty, &job->lock);
+
+		if (!job->qcount) {
+			pthread_mutex_unlock(&job->lock);
+			break;
+		}
+
+		m = job->queue[job->qhead];
+		job->qhead = (job->qhead + 1) % job->qcap;
+		job->qcount--;
+		pthread_cond_signal(&job->not_full);
+		pthread_mutex_unlock(&job->lock);
+
+		member_run(job, &m);
+	}
+	return (NULL);
+}
+
+/**
+ * @brief Hands a loaded ELF member over to the worker pool,
+ * waiting for a free queue slot if needed. If there are no
+ * workers, the member is processed right away.
+ *
+ * @param job  Archive job.
+ * @param name Member name (ownership is taken).
+ * @param buff Member contents (ownership is taken).
+ * @param size Member size.
+ */
+static void archive_push(struct archive_job *job, char *name,
+	uint8_t *buff, size_t size)
+{
+	struct archive_member m;
+
+	m.name = name;
+	m.buff = buff;
+	m.size = size;
+	job->elf_files++;
+
+	if (!job->qcap) {
+		member_run(job, &m);
+		return;
+	}
+
+	pthread_mutex_lock(&job->lock);
+	while (job->qcount == job->qcap)
+		pthread_cond_wait(&job->not_full, &job->lock);
+
+	job->queue[(job->qhead + job->qcount) % job->qcap] = m;
+	job->qcount++;
+	pthread_cond_signal(&job->not_empty);
+	pthread_mutex_unlock(&job->lock);
+}
+
+/**
+ * @brief Loads a regular member and, if it is an x86 ELF file,
+ * queues it.
+ *
+ * @param job  Archive job.
+ * @param in   Archive input.
+ * @param name Member name (ownership is taken).
+ * @param size Member size.
+ *
+ * @return Returns 1 if success, 0 if the archive is truncated.
+ */
+static int archive_member(struct archive_job *job, struct archive_in *in,
+	char *name, uint64_t size)
+{
+	uint8_t *buff;
+
+	job->members++;
+
+	if (!member_load(in, size, &buff)) {
+		free(name);
+		return (0);
+	}
+
+	if (!buff) {
+		free(name);
+		return (1);
+	}
+
+	archive_push(job, name, buff, size);
+	return (1);
+}
+
+/**
+ * @brief Walks a tar archive (ustar, GNU or pax).
+ *
+ * @param job Archive job.
+ * @param in  Archive input.
+ * @param hdr First header block, with its first @p got bytes
+ *            already read.
+ * @param got Amount of bytes already read.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int tar_walk(struct archive_job *job, struct archive_in *in,
+	uint8_t *hdr, size_t got)
+{
+	char *long_name, *ext, *name;
+	uint64_t size, pax_size;
+	size_t i;
+
+	long_name = NULL;
+	pax_size  = UINT64_MAX; /* Not given. */
+
+	if (!in_read(in, hdr + got, TAR_BLOCK - got))
+		errto(out0, "tar: truncated archive!\n");
+
+	for (;;)
+	{
+		/* End of archive: a zero block. */
+		for (i = 0; i < TAR_BLOCK && !hdr[i]; i++);
+		if (i == TAR_BLOCK)
+			break;
+
+		if (!tar_checksum(hdr))
+			errto(out0, "tar: invalid header at offset %ju!\n",
+				(uintmax_t)(in->pos - TAR_BLOCK));
+
+		if (!tar_size(hdr + 124, &size))
+			errto(out0, "tar: invalid size at offset %ju!\n",
+				(uintmax_t)(in->pos - TAR_BLOCK));
+
+		switch (hdr[156])
+		{
+		/* Name of the next member. */
+		case TAR_GNU_LONGNAME:
+			if (!(ext = tar_read_ext(in, size)))
+				goto out0;
+			free(long_name);
+			long_name = ext;
+			if (strlen(long_name) > ARCHIVE_NAME_MAX)
+				errto(out0, "tar: member name too long!\n");
+			break;
+
+		/* Attributes of the next member. */
+		case TAR_PAX_LOCAL:
+			if (!(ext = tar_read_ext(in, size)))
+				goto out0;
+			if (!pax_parse(ext, size, &long_name, &pax_size)) {
+				free(ext);
+				errto(out0, "tar: invalid pax header!\n");
+			}
+			free(ext);
+			break;
+
+		case TAR_REG:
+		case TAR_AREG:
+		case TAR_CONT:
+			if (pax_size != UINT64_MAX)
+				size = pax_size;
+
+			name      = long_name ? long_name : tar_name(hdr);
+			long_name = NULL;
+			pax_size  = UINT64_MAX;
+
+			if (!archive_member(job, in, name, size) ||
+				!in_skip(in, (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK))
+			{
+				errto(out0, "tar: truncated archive!\n");
+			}
+			break;
+
+		/* Directories, links, devices, global pax headers... */
+		default:
+			if (pax_size != UINT64_MAX)
+				size = pax_size;
+			free(long_name);
+			long_name = NULL;
+			pax_size  = UINT64_MAX;
+			if (!in_skip(in, (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK))
+				errto(out0, "tar: truncated archive!\n");
+			break;
+		}
+
+		if (!in_read(in, hdr, TAR_BLOCK))
+			break; /* Missing end-of-archive blocks are tolerated. */
+	}
+
+	free(long_name);
+	return (1);
+out0:
+	free(long_name);
+	return (0);
+}
+
+/**
+ * @brief Walks a cpio 'newc' archive (with or without
+ * checksums), as produced by rpm2cpio.
+ *
+ * @param job Archive job.
+ * @param in  Archive input.
+ * @param hdr First header, with its first @p got bytes
+ *            already read.
+ * @param got Amount of bytes already read.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int cpio_walk(struct archive_job *job, struct archive_in *in,
+	uint8_t *hdr, size_t got)
+{
+	uint64_t mode, size, nsize;
+	char *name;
+
+	if (!in_read(in, hdr + got, CPIO_HDR_SIZE - got))
+		errto(out0, "cpio: truncated archive!\n");
+
+	for (;;)
+	{
+		if (memcmp(hdr, "07070", 5) || (hdr[5] != '1' && hdr[5] != '2'))
+			errto(out0, "cpio: invalid header at offset %ju!\n",
+				(uintmax_t)(in->pos - CPIO_HDR_SIZE));
+
+		if (!parse_num(hdr + 14, 8, 16, &mode) ||
+			!parse_num(hdr + 54, 8, 16, &size) ||
+			!parse_num(hdr + 94, 8, 16, &nsize) ||
+			!nsize || nsize > ARCHIVE_NAME_MAX)
+		{
+			errto(out0, "cpio: invalid header at offset %ju!\n",
+				(uintmax_t)(in->pos - CPIO_HDR_SIZE));
+		}
+
+		/* Name, padded so that header + name is 4-byte aligned. */
+		if (!(name = malloc(nsize)))
+			errx("Unable to allocate memory!\n");
+
+		if (!in_read(in, name, nsize) ||
+			!in_skip(in, (4 - (CPIO_HDR_SIZE + nsize) % 4) % 4))
+		{
+			free(name);
+			errto(out0, "cpio: truncated archive!\n");
+		}
+		name[nsize - 1] = '\0';
+
+		if (!strcmp(name, CPIO_TRAILER)) {
+			free(name);
+			break;
+		}
+
+		/* Data, padded to 4 bytes. */
+		if ((mode & S_IFMT) == S_IFREG) {
+			if (!archive_member(job, in, name, size))
+				errto(out0, "cpio: truncated archive!\n");
+		}
+		else {
+			free(name);
+			if (!in_skip(in, size))
+				errto(out0, "cpio: truncated archive!\n");
+		}
+
+		if (!in_skip(in, (4 - size % 4) % 4) ||
+			!in_read(in, hdr, CPIO_HDR_SIZE))
+		{
+			errto(out0, "cpio: truncated archive!\n");
+		}
+	}
+
+	return (1);
+out0:
+	return (0);
+}
+
+/**
+ * @brief Archive mode: process (scan, read or audit) every x86
+ * ELF member of the tar or cpio archive read from @p in, and
+ * streams one JSON line per member to stdout. The format is
+ * detected from the first header.
+ *
+ * @param in_file Archive stream (may be a pipe).
+ * @param opts    What to do with each member.
+ *
+ * @return Returns the amount of members that failed (or, if
+ * auditing, were found modified), or -1 if the archive is
+ * invalid.
+ */
+int archive_process(FILE *in_file, const struct archive_opts *opts)
+{
+	uint8_t hdr[TAR_BLOCK];
+	struct archive_job job;
+	struct archive_in in;
+	pthread_t *tids;
+	int i, started, fmt, ok;
+	int nthreads;
+
+	in.f   = in_file;
+	in.pos = 0;
+
+	if ((opts->flags & FLG_READ) && !opts->audit &&
+		mkdir(opts->out_dir, 0755) < 0 && errno != EEXIST)
+	{
+		ERR("Unable to create output directory (%s)!\n", opts->out_dir);
+		return (-1);
+	}
+
+	/* Both formats have at least 6 bytes of magic. */
+	if (!in_read(&in, hdr, 6)) {
+		ERR("Empty archive!\n");
+		return (-1);
+	}
+
+	fmt = ARCHIVE_TAR;
+	if (!memcmp(hdr, "070701", 6) || !memcmp(hdr, "070702", 6))
+		fmt = ARCHIVE_CPIO;
+
+	memset(&job, 0, sizeof(job));
+	job.opts = opts;
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.not_empty, NULL);
+	pthread_cond_init(&job.not_full, NULL);
+
+	nthreads = opts->nthreads;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if (!(tids = calloc(nthreads, sizeof(*tids))))
+		errx("Unable to allocate memory!\n");
+
+	/*
+	 * Two queued members per worker: enough to keep them
+	 * busy while the next member is being read.
+	 */
+	job.qcap = nthreads * 2;
+	if (!(job.queue = calloc(job.qcap, sizeof(*job.queue))))
+		errx("Unable to allocate memory!\n");
+
+	for (started = 0; started < nthreads; started++)
+		if (pthread_create(&tids[started], NULL, archive_worker, &job))
+			break;
+
+	/* If no thread could be started, do the work ourselves. */
+	if (!started)
+		job.qcap = 0;
+
+	if (fmt == ARCHIVE_CPIO)
+		ok = cpio_walk(&job, &in, hdr, 6);
+	else
+		ok = tar_walk(&job, &in, hdr, 6);
+
+	pthread_mutex_lock(&job.lock);
+	job.done = 1;
+	pthread_cond_broadcast(&job.not_empty);
+	pthread_mutex_unlock(&job.lock);
+
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	free(tids);
+	free(job.queue);
+	pthread_cond_destroy(&job.not_full);
+	pthread_cond_destroy(&job.not_empty);
+	pthread_mutex_destroy(&job.lock);
+
+	fprintf(stderr, "Archive (%s): %zu members, %zu x86 ELF files\n",
+		fmt == ARCHIVE_CPIO ? "cpio" : "tar", job.members, job.elf_files);
+
+	if (!ok)
+		return (-1);
+	return ((int)job.failed);
+}
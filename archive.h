@@ -0,0 +1,46 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+	#include <stdio.h>
+	#include <stdint.h>
+	#include <stddef.h>
+
+	/* What should be done with each ELF member. */
+	struct archive_opts
+	{
+		unsigned flags;            /* FLG_SCAN or FLG_READ.      */
+		int      audit;            /* 0, 1 (fast) or 2 (full).   */
+		uint64_t amnt_should_read; /* Read: in bits, 0 = all.    */
+		const char    *out_dir;    /* Read: one file per member. */
+		const uint8_t *key;        /* Read: key, or NULL.        */
+		size_t   key_len;
+		int      nthreads;
+	};
+
+	extern int archive_process(FILE *in, const struct archive_opts *opts);
+
+#endif /* ARCHIVE_H */
@@ -0,0 +1,512 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700 /* nftw(). */
+#include <fcntl.h>
+#include <ftw.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <xed/xed-interface.h>
+
+#include "audit.h"
+#include "decode.h"
+#include "elf.h"
+#include "report.h"
+#include "util.h"
+#include "main.h"
+
+/* Files to be audited. */
+static char  **files;
+static size_t  nfiles;
+static size_t  cap_files;
+
+/* Worker pool. */
+struct audit_job
+{
+	size_t next;
+	size_t modified;
+	int full;
+};
+
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *const verdict_str[] = {
+	"undecided", "clean", "modified"
+};
+
+/* Per-function iclass counters: [D=0, D=1]. */
+struct fn_iclass
+{
+	size_t   fn;
+	unsigned iclass;
+	uint64_t n[2];
+};
+
+/*
+ * Per-function iclass state. Functions are swept one at a time,
+ * so a single table holds the counters of the current function,
+ * which are then kept in 'list': as the canonical direction is
+ * only known at the end of the sweep, so are the functions with
+ * non-canonical encodings.
+ */
+struct fn_iclass_state
+{
+	uint64_t (*cur)[2];
+	unsigned *seen;
+	size_t    nseen;
+	struct fn_iclass *list;
+	size_t    nlist;
+	size_t    cap;
+};
+
+/**
+ * @brief nftw() callback: adds every regular file to the
+ * file list.
+ */
+static int audit_collect(const char *path, const struct stat *st,
+	int type, struct FTW *ftw)
+{
+	((void)ftw);
+
+	if (type != FTW_F || !S_ISREG(st->st_mode) || st->st_size < 64)
+		return (0);
+
+	if (nfiles == cap_files) {
+		cap_files = cap_files ? cap_files * 2 : 256;
+		if (!(files = realloc(files, sizeof(*files) * cap_files)))
+			errx("Unable to allocate memory!\n");
+	}
+	if (!(files[nfiles++] = strdup(path)))
+		errx("Unable to allocate memory!\n");
+	return (0);
+}
+
+/**
+ * @brief Quickly checks (without loading it) if @p path is an
+ * x86 or x86-64 ELF file, so that other files can be silently
+ * skipped.
+ *
+ * @param path File path.
+ *
+ * @return Returns 1 if x86 ELF, 0 otherwise.
+ */
+static int audit_is_x86_elf(const char *path)
+{
+	uint8_t hdr[ELF_PROBE_SIZE];
+	int fd, ok;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (0);
+
+	ok = read(fd, hdr, sizeof hdr) == sizeof hdr && elf_is_x86(hdr);
+
+	close(fd);
+	return (ok);
+}
+
+/**
+ * @brief Compare two iclasses, for qsort().
+ */
+static int iclass_cmp(const void *a, const void *b)
+{
+	unsigned i1 = *(const unsigned *)a;
+	unsigned i2 = *(const unsigned *)b;
+	return ((i1 > i2) - (i1 < i2));
+}
+
+/**
+ * @brief Returns the canonical (dominant) D-bit of an iclass,
+ * given its [D=0, D=1] counters @p n.
+ */
+static inline unsigned iclass_canonical(const uint64_t n[2])
+{
+	if (n[0] != n[1])
+		return (n[1] > n[0]);
+	return (AUDIT_CANONICAL_D);
+}
+
+/**
+ * @brief Ends the sweep of the function @p fn: if @p keep, its
+ * iclass counters are appended (in iclass order) to the list,
+ * and the counters are cleared for the next function.
+ *
+ * @param st   Per-function iclass state.
+ * @param fn   Function index.
+ * @param keep If 1, keep the counters of @p fn.
+ */
+static void fn_iclass_flush(struct fn_iclass_state *st, size_t fn, int keep)
+{
+	struct fn_iclass *e;
+	unsigned ic;
+	size_t i;
+
+	if (keep)
+		qsort(st->seen, st->nseen, sizeof(*st->seen), iclass_cmp);
+
+	for (i = 0; i < st->nseen; i++)
+	{
+		ic = st->seen[i];
+		if (keep)
+		{
+			if (st->nlist == st->cap) {
+				st->cap = st->cap ? st->cap * 2 : 64;
+				if (!(st->list = realloc(st->list,
+					sizeof(*st->list) * st->cap)))
+				{
+					errx("Unable to allocate memory!\n");
+				}
+			}
+			e = &st->list[st->nlist++];
+			e->fn     = fn;
+			e->iclass = ic;
+			e->n[0]   = st->cur[ic][0];
+			e->n[1]   = st->cur[ic][1];
+		}
+		st->cur[ic][0] = st->cur[ic][1] = 0;
+	}
+	st->nseen = 0;
+}
+
+/**
+ * @brief Audits an already loaded ELF file and writes its result,
+ * as a JSON line, to @p f.
+ *
+ * The .text section is linearly swept and, for each eligible
+ * instruction, the D-bit is compared against the canonical one
+ * of its iclass, i.e.: the dominant one so far (see AUDIT_WARMUP).
+ * Each observation updates the SPRT log-likelihood ratio and,
+ * unless @p full, the sweep stops as soon as the ratio crosses
+ * one of the thresholds. The reported counters use the dominant
+ * direction at the end of the sweep.
+ *
+ * @param name File name, as shown in the output.
+ * @param info ELF file info structure (already parsed).
+ * @param full If 1, sweep the whole .text regardless of the
+ *             verdict.
+ * @param f    Output stream.
+ *
+ * @return Returns the verdict (AUDIT_*).
+ */
+int audit_elf(const char *name, struct elf_file_info *info, int full,
+	FILE *f)
+{
+	struct fn_iclass_state fic = {0};
+	struct elf_sym *syms;
+	uint64_t (*ic)[2];
+	uint64_t *fn_elig, *n;
+	uint64_t eligible, noncanon, errors, fn_nc;
+	uint64_t off, size, addr, fn_next;
+	double llr, llr_nc, llr_c, upper, lower;
+	const uint8_t *text;
+	size_t nsyms, fn_cur, fn_prev, i, j, k;
+	xed_decoded_inst_t inst;
+	int verdict, nc, tested, first;
+	unsigned len, iclass, d;
+
+	syms  = NULL;
+	nsyms = 0;
+	if (!load_func_symbols(info, &syms, &nsyms))
+		nsyms = 0;
+
+	ic      = calloc(XED_ICLASS_LAST, sizeof(*ic));
+	fn_elig = calloc(nsyms + 1, sizeof(*fn_elig));
+	fic.cur  = calloc(XED_ICLASS_LAST, sizeof(*fic.cur));
+	fic.seen = calloc(XED_ICLASS_LAST, sizeof(*fic.seen));
+	if (!ic || !fn_elig || !fic.cur || !fic.seen)
+		errx("Unable to allocate memory!\n");
+
+	/* SPRT. */
+	llr_nc  = log(AUDIT_P1 / AUDIT_P0);
+	llr_c   = log((1 - AUDIT_P1) / (1 - AUDIT_P0));
+	upper   = log((1 - AUDIT_ERR) / AUDIT_ERR);
+	lower   = log(AUDIT_ERR / (1 - AUDIT_ERR));
+	llr     = 0;
+	verdict = AUDIT_UNDECIDED;
+
+	text     = info->file_buff + info->elf_file_off;
+	size     = info->elf_text_size;
+	eligible = noncanon = errors = 0;
+	fn_cur   = nsyms;
+	fn_next  = 0;
+
+	for (off = 0; off < size; off += len)
+	{
+		xed_decoded_inst_zero(&inst);
+		xed_decoded_inst_set_mode(&inst, info->machine_mode,
+			info->machine_address);
+
+		/* Invalid instructions: skip a single byte. */
+		if (xed_decode(&inst, text + off, size - off) != XED_ERROR_NONE) {
+			errors++;
+			len = 1;
+			continue;
+		}
+
+		len = xed_decoded_inst_get_length(&inst);
+		if (!inst_is_eligible(&inst))
+			continue;
+
+		d = (text[off + xed3_operand_get_pos_nominal_opcode(&inst)] >> 1)
+			& 1;
+
+		iclass = xed_decoded_inst_get_iclass(&inst);
+		n      = ic[iclass];
+		nc     = d != iclass_canonical(n);
+		tested = n[0] + n[1] >= AUDIT_WARMUP;
+		eligible++;
+		n[d]++;
+
+		if (nsyms) {
+			addr = info->elf_text_base_addr + off;
+			if (addr >= fn_next) {
+				fn_prev = fn_cur;
+				fn_cur  = sym_lookup(syms, nsyms, addr, &fn_next);
+				if (fn_cur != fn_prev)
+					fn_iclass_flush(&fic, fn_prev, fn_prev < nsyms);
+			}
+			fn_elig[fn_cur]++;
+			if (!fic.cur[iclass][0] && !fic.cur[iclass][1])
+				fic.seen[fic.nseen++] = iclass;
+			fic.cur[iclass][d]++;
+		}
+
+		if (!tested)
+			continue;
+
+		llr += nc ? llr_nc : llr_c;
+		if (full || verdict != AUDIT_UNDECIDED)
+			continue;
+
+		if (llr >= upper)
+			verdict = AUDIT_MODIFIED;
+		else if (llr <= lower)
+			verdict = AUDIT_CLEAN;
+
+		if (verdict != AUDIT_UNDECIDED) {
+			off += len;
+			break;
+		}
+	}
+
+	if (nsyms)
+		fn_iclass_flush(&fic, fn_cur, fn_cur < nsyms);
+
+	if (full) {
+		if (llr >= upper)
+			verdict = AUDIT_MODIFIED;
+		else if (llr <= lower)
+			verdict = AUDIT_CLEAN;
+	}
+
+	for (i = 0; i < XED_ICLASS_LAST; i++)
+		noncanon += ic[i][!iclass_canonical(ic[i])];
+
+	/* Output. */
+	fputs("{\"file\":", f);
+	report_json_str(f, name);
+	fprintf(f, ",\"verdict\":\"%s\",\"llr\":%.3f,\"eligible\":%ju,"
+		"\"noncanonical\":%ju,\"ratio\":%.6f,\"complete\":%s,"
+		"\"text_bytes\":%ju,\"swept_bytes\":%ju,\"decode_errors\":%ju",
+		verdict_str[verdict], llr, (uintmax_t)eligible, (uintmax_t)noncanon,
+		eligible ? (double)noncanon / eligible : 0.0,
+		(off >= size) ? "true" : "false",
+		(uintmax_t)size, (uintmax_t)(off < size ? off : size),
+		(uintmax_t)errors);
+
+	/* Per iclass: [canonical, non-canonical]. */
+	fputs(",\"iclass\":{", f);
+	for (i = 0, first = 1; i < XED_ICLASS_LAST; i++)
+	{
+		if (!ic[i][0] && !ic[i][1])
+			continue;
+		d = iclass_canonical(ic[i]);
+		fprintf(f, "%s\"%s\":[%ju,%ju]", first ? "" : ",",
+			xed_iclass_enum_t2str((xed_iclass_enum_t)i),
+			(uintmax_t)ic[i][d], (uintmax_t)ic[i][!d]);
+		first = 0;
+	}
+
+	/* Functions with non-canonical encodings, and their iclasses. */
+	fputs("},\"functions\":[", f);
+	for (j = 0, first = 1; j < fic.nlist; )
+	{
+		i = fic.list[j].fn;
+		for (k = j, fn_nc = 0; k < fic.nlist && fic.list[k].fn == i; k++)
+			fn_nc += fic.list[k].n[!iclass_canonical(ic[fic.list[k].iclass])];
+
+		if (!fn_nc) {
+			j = k;
+			continue;
+		}
+
+		fputs(first ? "{\"name\":" : ",{\"name\":", f);
+		report_json_str(f, syms[i].name);
+		fprintf(f, ",\"address\":%ju,\"eligible\":%ju,\"noncanonical\":%ju"
+			",\"iclass\":{", (uintmax_t)syms[i].addr,
+			(uintmax_t)fn_elig[i], (uintmax_t)fn_nc);
+
+		for (k = j; j < fic.nlist && fic.list[j].fn == i; j++)
+		{
+			d = iclass_canonical(ic[fic.list[j].iclass]);
+			fprintf(f, "%s\"%s\":[%ju,%ju]", (j > k) ? "," : "",
+				xed_iclass_enum_t2str((xed_iclass_enum_t)fic.list[j].iclass),
+				(uintmax_t)fic.list[j].n[d], (uintmax_t)fic.list[j].n[!d]);
+		}
+		fputs("}}", f);
+		first = 0;
+	}
+	fputs("]}\n", f);
+
+	free(fic.cur);
+	free(fic.seen);
+	free(fic.list);
+	free(ic);
+	free(fn_elig);
+	free(syms);
+	return (verdict);
+}
+
+/**
+ * @brief Audits a single file and writes its result, as a
+ * JSON line, to @p f.
+ *
+ * @param path File path.
+ * @param full If 1, sweep the whole .text regardless of the
+ *             verdict.
+ * @param f    Output stream.
+ *
+ * @return Returns the verdict (AUDIT_*), or -1 if error.
+ */
+static int audit_file(const char *path, int full, FILE *f)
+{
+	struct elf_file_info info = {0};
+	int verdict;
+
+	if (!init_elf(&info, path, NULL)) {
+		fputs("{\"file\":", f);
+		report_json_str(f, path);
+		fputs(",\"error\":\"unable to load .text\"}\n", f);
+		return (-1);
+	}
+
+	verdict = audit_elf(path, &info, full, f);
+	munmap_elf(&info);
+	return (verdict);
+}
+
+/**
+ * @brief Audit worker: audits files until there is no file
+ * left. Each result is written atomically, as a single line.
+ *
+ * @param arg Audit job.
+ */
+static void *audit_worker(void *arg)
+{
+	struct audit_job *job = arg;
+	size_t idx, len;
+	char *buff;
+	FILE *f;
+	int ret;
+
+	while ((idx = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED))
+		< nfiles)
+	{
+		if (!audit_is_x86_elf(files[idx]))
+			continue;
+
+		if (!(f = open_memstream(&buff, &len)))
+			errx("Unable to allocate memory!\n");
+
+		ret = audit_file(files[idx], job->full, f);
+		fclose(f);
+
+		if (ret == AUDIT_MODIFIED)
+			__atomic_fetch_add(&job->modified, 1, __ATOMIC_RELAXED);
+
+		pthread_mutex_lock(&out_lock);
+		fwrite(buff, 1, len, stdout);
+		fflush(stdout);
+		pthread_mutex_unlock(&out_lock);
+		free(buff);
+	}
+	return (NULL);
+}
+
+/**
+ * @brief Audit mode: looks for x86 ELF files re-encoded by stelf
+ * (or similar tools) in @p paths (files or directory trees), and
+ * streams one JSON line per ELF file to stdout.
+ *
+ * @param paths    File or directory list.
+ * @param npaths   Amount of paths.
+ * @param nthreads Amount of threads.
+ * @param full     If 1, always sweep the whole .text section.
+ *
+ * @return Returns the amount of files considered modified.
+ */
+int audit_paths(char **paths, int npaths, int nthreads, int full)
+{
+	struct audit_job job;
+	pthread_t *tids;
+	int i, started;
+
+	for (i = 0; i < npaths; i++)
+		if (nftw(paths[i], audit_collect, 64, FTW_PHYS) < 0)
+			ERR("Unable to walk %s!\n", paths[i]);
+
+	job.next     = 0;
+	job.modified = 0;
+	job.full = full;
+
+	if (nthreads > (int)nfiles)
+		nthreads = nfiles;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if (!(tids = calloc(nthreads, sizeof(*tids))))
+		errx("Unable to allocate memory!\n");
+
+	for (started = 0; started < nthreads; started++)
+		if (pthread_create(&tids[started], NULL, audit_worker, &job))
+			break;
+
+	/* If no thread could be started, do the work ourselves. */
+	if (!started)
+		audit_worker(&job);
+
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+
+	for (i = 0; i < (int)nfiles; i++)
+		free(files[i]);
+	free(files);
+
+	return (job.modified);
+}
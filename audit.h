@@ -0,0 +1,65 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef AUDIT_H
+#define AUDIT_H
+
+	#include <stdio.h>
+	#include "main.h"
+
+	/*
+	 * Sequential probability ratio test (SPRT) parameters:
+	 * a clean binary is expected to have at most AUDIT_P0 of
+	 * its eligible instructions with a non-canonical D-bit,
+	 * while a modified one at least AUDIT_P1. Both error rates
+	 * (alpha: false positive, beta: false negative) are
+	 * AUDIT_ERR.
+	 */
+	#define AUDIT_P0  0.01
+	#define AUDIT_P1  0.10
+	#define AUDIT_ERR 1e-9
+
+	/*
+	 * Canonical D-bit: it depends on the toolchain. GNU as and
+	 * LLVM encode reg/reg forms with D=0 (e.g.: 89 /r for MOV),
+	 * while MSVC and some hand-written assembly use D=1 (8B /r).
+	 * So the canonical direction of each iclass is the dominant
+	 * one in the file: the first AUDIT_WARMUP instructions of an
+	 * iclass only establish it and are not tested, and ties go
+	 * to AUDIT_CANONICAL_D.
+	 */
+	#define AUDIT_WARMUP      8
+	#define AUDIT_CANONICAL_D 0
+
+	/* Verdicts. */
+	#define AUDIT_UNDECIDED 0
+	#define AUDIT_CLEAN     1
+	#define AUDIT_MODIFIED  2
+
+	extern int audit_elf(const char *name, struct elf_file_info *info,
+		int full, FILE *f);
+	extern int audit_paths(char **paths, int npaths, int nthreads,
+		int full);
+
+#endif /* AUDIT_H */
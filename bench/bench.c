@@ -0,0 +1,476 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Benchmark harness:
+ * Runs the scan, write and read paths over a fixed set of ELF
+ * files, with warmup and repeated runs, and compares the
+ * throughput against a baseline file.
+ *
+ * Only the decoding loop (decode, eligibility check and patch)
+ * is timed: opening, copying and syncing the files are not.
+ */
+
+#include <getopt.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <xed/xed-interface.h>
+
+#include "decode.h"
+#include "io.h"
+#include "stats.h"
+#include "util.h"
+#include "main.h"
+
+#define MAX_RESULTS  256
+#define MAX_KEY      256
+
+/* Benchmark result. */
+struct result
+{
+	char   key[MAX_KEY]; /* file/mode. */
+	double median;       /* seconds.   */
+	double p95;          /* seconds.   */
+	double ips;          /* decoded instructions per second. */
+	double baseline;     /* ips, 0 if none. */
+	int    stats;        /* With --stats instrumentation (-S). */
+};
+
+/* Baseline entry. */
+struct baseline
+{
+	char   key[MAX_KEY];
+	double ips;
+};
+
+static int    nruns  = 10;
+static int    warmup = 2;
+static double threshold = -1; /* in %, < 0 = from baseline file. */
+static char  *baseline_file;
+static char  *output_file;
+static int    with_stats; /* -S: also time each mode with --stats. */
+
+static struct baseline bl[MAX_RESULTS];
+static int             nbl;
+static struct result   res[MAX_RESULTS];
+static int             nres;
+
+/* Payload PRNG state (write mode). */
+static uint64_t rng;
+
+/**
+ * @brief Payload source for the write mode: an endless stream
+ * of pseudo-random bytes (xorshift64*).
+ */
+static int bench_get_byte(void *data)
+{
+	((void)data);
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return ((rng * 2685821657736338717ULL) >> 56);
+}
+
+/**
+ * @brief Payload sink for the read mode: discards everything.
+ */
+static int bench_put_byte(void *data, int c)
+{
+	*(volatile int *)data = c;
+	return (1);
+}
+
+/**
+ * @brief Compare two doubles, for qsort.
+ */
+static int dbl_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return ((x > y) - (x < y));
+}
+
+/**
+ * @brief Reads the baseline file. The file is a flat JSON
+ * object, with one "file/mode": instructions-per-second entry
+ * per line, e.g.:
+ *
+ * {
+ *   "threshold_pct": 10,
+ *   "results": {
+ *     "bash/scan": 123456789
+ *   }
+ * }
+ *
+ * @param file Baseline file path.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int read_baseline(const char *file)
+{
+	char line[512];
+	char key[MAX_KEY];
+	double val;
+	FILE *f;
+
+	if (!(f = fopen(file, "r")))
+		return (0);
+
+	while (fgets(line, sizeof line, f))
+	{
+		if (sscanf(line, " \"%255[^\"]\" : %lf", key, &val) != 2)
+			continue;
+
+		if (!strcmp(key, "threshold_pct")) {
+			if (threshold < 0)
+				threshold = val;
+			continue;
+		}
+
+		if (nbl == MAX_RESULTS)
+			break;
+		snprintf(bl[nbl].key, MAX_KEY, "%s", key);
+		bl[nbl++].ips = val;
+	}
+
+	fclose(f);
+	return (1);
+}
+
+/**
+ * @brief Writes the current results as a new baseline file.
+ *
+ * @param file Output file path.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int write_baseline(const char *file)
+{
+	FILE *f;
+	int i, first;
+
+	if (!(f = fopen(file, "w")))
+		return (0);
+
+	fprintf(f, "{\n  \"threshold_pct\": %g,\n  \"results\": {",
+		threshold);
+	for (i = 0, first = 1; i < nres; i++)
+	{
+		if (res[i].stats)
+			continue;
+		fprintf(f, "%s\n    \"%s\": %.0f", first ? "" : ",", res[i].key,
+			res[i].ips);
+		first = 0;
+	}
+	fprintf(f, "\n  }\n}\n");
+
+	return (!fclose(f));
+}
+
+/**
+ * @brief Finds the baseline throughput for @p key.
+ *
+ * @return Returns the baseline, or 0 if not found.
+ */
+static double find_baseline(const char *key)
+{
+	int i;
+	for (i = 0; i < nbl; i++)
+		if (!strcmp(bl[i].key, key))
+			return (bl[i].ips);
+	return (0);
+}
+
+/**
+ * @brief Runs the decoding loop over an already initialized
+ * ELF file @p info, in the mode @p flags, @p warmup + @p nruns
+ * times, and saves the result.
+ *
+ * @param info  Initialized ELF file.
+ * @param flags Decoding mode.
+ * @param file  Input file name.
+ * @param mode  Mode name.
+ */
+static void bench_run(const struct elf_file_info *info, unsigned flags,
+	const char *file, const char *mode)
+{
+	static volatile int sink;
+	struct decode_ctx ctx;
+	struct result *r;
+	double *times;
+	double start;
+	int i;
+
+	if (nres == MAX_RESULTS)
+		errx("Too many results!\n");
+
+	if (!(times = malloc(sizeof(double) * nruns)))
+		errx("Unable to allocate memory!\n");
+
+	for (i = 0; i < warmup + nruns; i++)
+	{
+		decode_init(&ctx, flags);
+		ctx.info     = *info;
+		ctx.get_byte = bench_get_byte;
+		ctx.put_byte = bench_put_byte;
+		ctx.data     = (void *)&sink;
+		rng          = 0x9E3779B97F4A7C15ULL + i; /* new payload per run. */
+
+		start = time_now();
+		decode_instructions(&ctx);
+		if (i >= warmup)
+			times[i - warmup] = time_now() - start;
+	}
+
+	qsort(times, nruns, sizeof(double), dbl_cmp);
+
+	r = &res[nres++];
+	snprintf(r->key, MAX_KEY, "%s/%s", file, mode);
+	r->median = (nruns & 1) ? times[nruns / 2] :
+		(times[nruns / 2 - 1] + times[nruns / 2]) / 2;
+	r->p95 = times[(nruns * 95 + 99) / 100 - 1];
+	r->ips = r->median > 0 ? ctx.total_inst_count / r->median : 0;
+	r->stats = (stats != NULL);
+	r->baseline = r->stats ? 0 : find_baseline(r->key);
+
+	free(times);
+}
+
+/**
+ * @brief Benchmarks a single mode and, with -S, the same mode
+ * with the --stats instrumentation enabled.
+ *
+ * @param info  Initialized ELF file.
+ * @param flags Decoding mode.
+ * @param file  Input file name.
+ * @param mode  Mode name.
+ */
+static void bench_mode(const struct elf_file_info *info, unsigned flags,
+	const char *file, const char *mode)
+{
+	static struct stats st;
+	char name[64];
+
+	bench_run(info, flags, file, mode);
+	if (!with_stats)
+		return;
+
+	snprintf(name, sizeof name, "%s+stats", mode);
+	stats = &st;
+	bench_run(info, flags, file, name);
+	stats = NULL;
+}
+
+/**
+ * @brief Benchmarks the scan, write and read paths of the file
+ * @p path.
+ *
+ * @param path ELF file path.
+ * @param tmp  Temporary file used for the write and read paths.
+ */
+static void bench_file(const char *path, const char *tmp)
+{
+	struct elf_file_info info;
+	char  *dup, *file;
+
+	if (!(dup = strdup(path)))
+		errx("Unable to allocate memory!\n");
+	file = basename(dup);
+
+	/* Scan. */
+	memset(&info, 0, sizeof(info));
+	if (!init_elf(&info, path, NULL))
+		errx("Unable to initialize ELF file: %s\n", path);
+	bench_mode(&info, FLG_SCAN, file, "scan");
+	munmap_elf(&info);
+
+	/* Write. */
+	memset(&info, 0, sizeof(info));
+	if (!init_elf(&info, path, tmp))
+		errx("Unable to initialize ELF file: %s\n", path);
+	bench_mode(&info, FLG_WRITE, file, "write");
+	munmap_elf(&info);
+
+	/* Read (from the written file). */
+	memset(&info, 0, sizeof(info));
+	if (!init_elf(&info, tmp, NULL))
+		errx("Unable to initialize ELF file: %s\n", tmp);
+	bench_mode(&info, FLG_READ, file, "read");
+	munmap_elf(&info);
+
+	unlink(tmp);
+	free(dup);
+}
+
+/**
+ * @brief Show program usage.
+ *
+ * @param prgname Program name.
+ */
+static void usage(const char *prgname)
+{
+	fprintf(stderr, "Usage: %s [options] <elf_file>...\n", prgname);
+	fprintf(stderr,
+		"Options:\n"
+		"  -n <runs>      Timed runs per file and mode (default: 10)\n"
+		"  -W <runs>      Warmup runs (default: 2)\n"
+		"  -b <file>      Baseline to compare against\n"
+		"  -t <pct>       Max allowed throughput regression, in %%\n"
+		"                 (default: from the baseline, or 10)\n"
+		"  -o <file>      Save the results as a new baseline\n"
+		"  -S             Also time each mode with the --stats\n"
+		"                 instrumentation and print its overhead\n"
+		"  -i <backend>   I/O backend: mmap (default), populate, pread\n"
+		"                 or uring\n"
+		"  -h             This help\n");
+	exit(EXIT_FAILURE);
+}
+
+/* Main. */
+int main(int argc, char **argv)
+{
+	struct rusage ru;
+	char   tmp[256];
+	double delta;
+	int    regressed;
+	int    missing;
+	int    c, i;
+
+	while ((c = getopt(argc, argv, "hn:W:b:t:o:i:S")) != -1)
+	{
+		switch (c) {
+		case 'n':
+			nruns = atoi(optarg);
+			break;
+		case 'W':
+			warmup = atoi(optarg);
+			break;
+		case 'b':
+			baseline_file = optarg;
+			break;
+		case 't':
+			threshold = atof(optarg);
+			break;
+		case 'o':
+			output_file = optarg;
+			break;
+		case 'S':
+			with_stats = 1;
+			break;
+		case 'i':
+			if ((io_backend = io_parse_backend(optarg)) < 0)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	if (optind >= argc || nruns <= 0 || warmup < 0)
+		usage(argv[0]);
+
+	/* Without a usable baseline, the gate only passes when recording. */
+	if (baseline_file && !read_baseline(baseline_file))
+	{
+		if (!output_file)
+			errx("Unable to read baseline %s\n", baseline_file);
+		fprintf(stderr, "Warning: unable to read baseline %s\n",
+			baseline_file);
+	}
+	if (threshold < 0)
+		threshold = 10;
+
+	xed_tables_init();
+
+	snprintf(tmp, sizeof tmp, "%s/stelf-bench.%d",
+		getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int)getpid());
+
+	for (i = optind; i < argc; i++)
+		bench_file(argv[i], tmp);
+
+	/* Results. */
+	printf("%-32s %10s %10s %12s %12s %8s\n",
+		"file/mode", "median(ms)", "p95(ms)", "Minst/s", "base(Minst/s)",
+		"delta");
+
+	regressed = 0;
+	missing   = 0;
+	for (i = 0; i < nres; i++)
+	{
+		printf("%-32s %10.3f %10.3f %12.2f", res[i].key,
+			res[i].median * 1e3, res[i].p95 * 1e3, res[i].ips / 1e6);
+
+		/* Overhead against the plain run, just before. */
+		if (res[i].stats) {
+			printf(" %12s %+7.1f%%  stats overhead\n", "-",
+				(res[i].median / res[i - 1].median - 1) * 100);
+			continue;
+		}
+
+		if (!res[i].baseline) {
+			printf(" %12s %8s  NO BASELINE\n", "-", "-");
+			missing++;
+			continue;
+		}
+
+		delta = (res[i].ips / res[i].baseline - 1) * 100;
+		printf(" %12.2f %+7.1f%%%s\n", res[i].baseline / 1e6, delta,
+			(delta < -threshold) ? "  REGRESSION" : "");
+		regressed |= (delta < -threshold);
+	}
+
+	getrusage(RUSAGE_SELF, &ru);
+	printf("Peak RSS: %ld kB\n", ru.ru_maxrss);
+	fflush(stdout);
+	io_print_summary();
+
+	if (output_file && !write_baseline(output_file))
+		errx("Unable to write baseline %s\n", output_file);
+
+	if (regressed) {
+		fprintf(stderr, "Throughput regressed more than %g%%!\n",
+			threshold);
+		return (EXIT_FAILURE);
+	}
+
+	/*
+	 * A file/mode without a baseline entry cannot be checked, so
+	 * fail unless a new baseline is being recorded. An empty
+	 * baseline (nothing recorded yet on this machine) only warns.
+	 */
+	if (baseline_file && missing && !output_file) {
+		fprintf(stderr, "%s %d result(s) without a baseline entry in %s!\n"
+			"Record one with: make bench BENCH_ARGS=\"-o %s\"\n",
+			nbl ? "Error:" : "Warning:", missing, baseline_file,
+			baseline_file);
+		if (nbl)
+			return (EXIT_FAILURE);
+	}
+	return (EXIT_SUCCESS);
+}
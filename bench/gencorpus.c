@@ -0,0 +1,695 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Synthetic ELF corpus generator:
+ * Generates deterministic (seed-driven) x86-64 or i386 ELF files
+ * with a .text section of any size, made of functions encoded
+ * with XED, plus a symbol table with one entry per function.
+ *
+ * The generated files are meant to be scanned/written/read by
+ * stelf and by the benchmark harness, not executed.
+ */
+
+#include <ctype.h>
+#include <elf.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xed/xed-interface.h>
+
+#include "../main.h"
+
+#define TEXT_OFF    0x1000
+#define TEXT_ALIGN  16
+#define OUT_BUFF    (1 << 20)
+#define MAX_DATA    64
+
+/* Non-eligible instruction classes. */
+#define MIX_IMM  0 /* mov reg, imm.           */
+#define MIX_MEM  1 /* loads, stores, alu mem. */
+#define MIX_LEA  2 /* lea reg, [reg+disp].    */
+#define MIX_MUL  3 /* imul reg, reg.          */
+#define MIX_NOP  4 /* nop.                    */
+#define MIX_JCC  5 /* jz/jnz rel8.            */
+#define MIX_MAX  6
+
+static const char *const mix_names[MIX_MAX] = {
+	"imm", "mem", "lea", "mul", "nop", "jcc"
+};
+
+/* Eligible instructions: reg/reg forms of these. */
+static const xed_iclass_enum_t eligible_iclass[] = {
+	XED_ICLASS_MOV, XED_ICLASS_ADD, XED_ICLASS_SUB,
+	XED_ICLASS_SBB, XED_ICLASS_CMP, XED_ICLASS_AND,
+	XED_ICLASS_OR,  XED_ICLASS_XOR, XED_ICLASS_ADC
+};
+
+/* Options. */
+static int      is64        = 1;
+static uint64_t text_size   = 1 << 20;
+static uint64_t seed        = 1;
+static double   elig_ratio  = 0.15;
+static double   rex_ratio   = 0.5;
+static double   data_ratio  = 0;
+static unsigned func_size   = 256;
+static unsigned mix[MIX_MAX] = {3, 4, 2, 1, 1, 1};
+static unsigned mix_total   = 12;
+static char    *out_file;
+
+/* Generator state. */
+static uint64_t    rng;
+static xed_state_t dstate;
+static FILE       *out;
+static uint8_t    *obuf;
+static size_t      olen;
+static uint64_t    text_len;
+
+/* Functions (symbols). */
+struct func
+{
+	uint64_t off;
+	uint64_t size;
+};
+static struct func *funcs;
+static size_t       nfuncs;
+static size_t       cap_funcs;
+
+/**
+ * @brief Returns the next pseudo-random number (xorshift64*).
+ */
+static uint64_t rnd(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return (rng * 2685821657736338717ULL);
+}
+
+/**
+ * @brief Returns a pseudo-random number in [0, n).
+ */
+static unsigned rnd_n(unsigned n)
+{
+	return ((rnd() >> 32) % n);
+}
+
+/**
+ * @brief Returns 1 with probability @p p.
+ */
+static int rnd_p(double p)
+{
+	return ((rnd() >> 11) * (1.0 / 9007199254740992.0) < p);
+}
+
+/**
+ * @brief Appends @p len bytes to the .text section.
+ */
+static void emit(const uint8_t *buff, size_t len)
+{
+	if (olen + len > OUT_BUFF) {
+		if (fwrite(obuf, 1, olen, out) != olen)
+			errx("Unable to write output file!\n");
+		olen = 0;
+	}
+	memcpy(obuf + olen, buff, len);
+	olen     += len;
+	text_len += len;
+}
+
+/**
+ * @brief Encodes and emits the instruction @p inst.
+ */
+static void emit_inst(xed_encoder_instruction_t *inst)
+{
+	xed_encoder_request_t req;
+	uint8_t  buff[XED_MAX_INSTRUCTION_BYTES];
+	unsigned len;
+
+	xed_encoder_request_zero_set_mode(&req, &dstate);
+	if (!xed_convert_to_encoder_request(&req, inst))
+		errx("Unable to convert encoder request!\n");
+	if (xed_encode(&req, buff, sizeof buff, &len) != XED_ERROR_NONE)
+		errx("Unable to encode instruction!\n");
+
+	emit(buff, len);
+}
+
+/**
+ * @brief Picks a random general purpose register (except the
+ * stack pointer).
+ *
+ * @param rex   If 1, use 64-bit and/or r8-r15 registers (x86-64).
+ * @param width Returned operand width, in bits.
+ *
+ * @return Returns the register.
+ */
+static xed_reg_enum_t rnd_reg(int rex, unsigned *width)
+{
+	unsigned idx;
+
+	*width = 32;
+	if (!is64 || !rex) {
+		do idx = rnd_n(8); while (idx == 4);
+		return ((xed_reg_enum_t)(XED_REG_EAX + idx));
+	}
+
+	do idx = rnd_n(16); while (idx == 4);
+	if (idx < 8 || rnd_n(2)) {
+		*width = 64;
+		return ((xed_reg_enum_t)(XED_REG_RAX + idx));
+	}
+	return ((xed_reg_enum_t)(XED_REG_EAX + idx));
+}
+
+/**
+ * @brief Same as rnd_reg, but with the given @p width.
+ */
+static xed_reg_enum_t rnd_reg_w(int rex, unsigned width)
+{
+	unsigned idx;
+	do idx = rnd_n(is64 && rex ? 16 : 8); while (idx == 4);
+	return ((xed_reg_enum_t)
+		((width == 64 ? XED_REG_RAX : XED_REG_EAX) + idx));
+}
+
+/**
+ * @brief Returns the base (stack/frame) register for the current mode.
+ */
+static xed_reg_enum_t base_reg(void)
+{
+	return (is64 ? XED_REG_RBP : XED_REG_EBP);
+}
+
+/**
+ * @brief Emits one eligible instruction: a reg/reg ALU op.
+ */
+static void emit_eligible(void)
+{
+	xed_encoder_instruction_t x;
+	xed_reg_enum_t r1, r2;
+	unsigned w;
+	int rex;
+
+	rex = rnd_p(rex_ratio);
+	r1  = rnd_reg(rex, &w);
+	r2  = rnd_reg_w(rex, w);
+
+	xed_inst2(&x, dstate, eligible_iclass[rnd_n(9)], w, xed_reg(r1),
+		xed_reg(r2));
+	emit_inst(&x);
+}
+
+/**
+ * @brief Emits one non-eligible instruction, chosen according to
+ * the instruction mix.
+ */
+static void emit_other(void)
+{
+	xed_encoder_instruction_t x;
+	xed_reg_enum_t r1, r2;
+	unsigned w, pick, cls;
+	int rex;
+
+	pick = rnd_n(mix_total);
+	for (cls = 0; pick >= mix[cls]; cls++)
+		pick -= mix[cls];
+
+	rex = rnd_p(rex_ratio);
+	r1  = rnd_reg(rex, &w);
+
+	switch (cls) {
+	case MIX_IMM:
+		xed_inst2(&x, dstate, XED_ICLASS_MOV, w, xed_reg(r1),
+			xed_imm0(rnd_n(1 << 16), 32));
+		break;
+	case MIX_MEM:
+		switch (rnd_n(3)) {
+		case 0:
+			xed_inst2(&x, dstate, XED_ICLASS_MOV, w, xed_reg(r1),
+				xed_mem_bd(base_reg(), xed_disp(-8 * (1 + rnd_n(16)), 8), w));
+			break;
+		case 1:
+			xed_inst2(&x, dstate, XED_ICLASS_MOV, w,
+				xed_mem_bd(base_reg(), xed_disp(-8 * (1 + rnd_n(16)), 8), w),
+				xed_reg(r1));
+			break;
+		default:
+			xed_inst2(&x, dstate, eligible_iclass[1 + rnd_n(8)], w,
+				xed_reg(r1),
+				xed_mem_bd(base_reg(), xed_disp(-8 * (1 + rnd_n(16)), 8), w));
+			break;
+		}
+		break;
+	case MIX_LEA:
+		r2 = rnd_reg_w(rex, is64 ? 64 : 32);
+		xed_inst2(&x, dstate, XED_ICLASS_LEA, w, xed_reg(r1),
+			xed_mem_bd(r2, xed_disp(rnd_n(256), 32), w));
+		break;
+	case MIX_MUL:
+		r2 = rnd_reg_w(rex, w);
+		xed_inst2(&x, dstate, XED_ICLASS_IMUL, w, xed_reg(r1), xed_reg(r2));
+		break;
+	case MIX_NOP:
+		xed_inst0(&x, dstate, XED_ICLASS_NOP, 0);
+		break;
+	default:
+		xed_inst1(&x, dstate, rnd_n(2) ? XED_ICLASS_JZ : XED_ICLASS_JNZ, 0,
+			xed_relbr(0, 8));
+		break;
+	}
+
+	emit_inst(&x);
+}
+
+/**
+ * @brief Emits a whole function: prologue, body, epilogue, optional
+ * inline data and padding up to the next 16-byte boundary.
+ *
+ * @param size Approximated function size, in bytes.
+ */
+static void emit_function(uint64_t size)
+{
+	xed_encoder_instruction_t x;
+	xed_reg_enum_t bp, sp;
+	uint8_t data[MAX_DATA];
+	uint64_t start;
+	unsigned w, i, n;
+
+	if (nfuncs == cap_funcs) {
+		cap_funcs = cap_funcs ? cap_funcs * 2 : 1024;
+		if (!(funcs = realloc(funcs, sizeof(*funcs) * cap_funcs)))
+			errx("Unable to allocate memory!\n");
+	}
+
+	start = text_len;
+	w     = is64 ? 64 : 32;
+	bp    = base_reg();
+	sp    = is64 ? XED_REG_RSP : XED_REG_ESP;
+
+	/* Prologue. */
+	xed_inst1(&x, dstate, XED_ICLASS_PUSH, w, xed_reg(bp));
+	emit_inst(&x);
+	xed_inst2(&x, dstate, XED_ICLASS_MOV, w, xed_reg(bp), xed_reg(sp));
+	emit_inst(&x);
+
+	/* Body. */
+	while (text_len - start < size && text_len < text_size)
+	{
+		if (rnd_p(elig_ratio))
+			emit_eligible();
+		else
+			emit_other();
+	}
+
+	/* Epilogue. */
+	xed_inst1(&x, dstate, XED_ICLASS_POP, w, xed_reg(bp));
+	emit_inst(&x);
+	xed_inst0(&x, dstate, XED_ICLASS_RET_NEAR, w);
+	emit_inst(&x);
+
+	funcs[nfuncs].off  = start;
+	funcs[nfuncs].size = text_len - start;
+	nfuncs++;
+
+	/* Inline data (jump tables, literal pools...). */
+	if (rnd_p(data_ratio)) {
+		n = 8 + rnd_n(MAX_DATA - 8);
+		for (i = 0; i < n; i++)
+			data[i] = rnd();
+		emit(data, n);
+	}
+
+	/* Padding. */
+	memset(data, 0xCC, sizeof data);
+	if (text_len % TEXT_ALIGN)
+		emit(data, TEXT_ALIGN - (text_len % TEXT_ALIGN));
+}
+
+/**
+ * @brief Writes @p len bytes at the current output position.
+ */
+static void out_write(const void *buff, size_t len)
+{
+	if (fwrite(buff, 1, len, out) != len)
+		errx("Unable to write output file!\n");
+}
+
+/**
+ * @brief Pads the output file with zeros up to @p align.
+ */
+static void out_align(unsigned align)
+{
+	long pos = ftell(out);
+	while (pos++ % align)
+		fputc(0, out);
+}
+
+/**
+ * @brief Writes the symbol table (one global STT_FUNC per
+ * function, named f<n>), the string tables, the section
+ * headers and, finally, the ELF and program headers.
+ *
+ * @param base .text virtual address.
+ */
+static void write_tables(uint64_t base)
+{
+	static const char shstrtab[] =
+		"\0.text\0.symtab\0.strtab\0.shstrtab";
+	uint64_t symtab_off, strtab_off, shstrtab_off, shdr_off, end;
+	uint64_t str_len, sym_size;
+	char     name[32];
+	size_t   i;
+	int      len;
+
+	/* Symbol table. */
+	out_align(8);
+	symtab_off = ftell(out);
+	sym_size   = is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+	str_len    = 1;
+
+	for (i = 0; i <= nfuncs; i++)
+	{
+		Elf64_Sym s64 = {0};
+		Elf32_Sym s32 = {0};
+
+		if (i) {
+			s64.st_name  = s32.st_name  = str_len;
+			s64.st_info  = s32.st_info  = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+			s64.st_shndx = s32.st_shndx = 1;
+			s64.st_value = base + funcs[i - 1].off;
+			s64.st_size  = funcs[i - 1].size;
+			s32.st_value = s64.st_value;
+			s32.st_size  = s64.st_size;
+			str_len += snprintf(name, sizeof name, "f%zu", i - 1) + 1;
+		}
+
+		if (is64)
+			out_write(&s64, sizeof s64);
+		else
+			out_write(&s32, sizeof s32);
+	}
+
+	/* String table. */
+	strtab_off = ftell(out);
+	fputc(0, out);
+	for (i = 0; i < nfuncs; i++) {
+		len = snprintf(name, sizeof name, "f%zu", i);
+		out_write(name, len + 1);
+	}
+
+	shstrtab_off = ftell(out);
+	out_write(shstrtab, sizeof shstrtab);
+
+	/* Section headers. */
+	out_align(8);
+	shdr_off = ftell(out);
+
+	{
+		/* name, type, off, size, link, info, align, entsize. */
+		const uint64_t sh[5][8] = {
+			{0,  SHT_NULL,     0, 0, 0, 0, 0, 0},
+			{1,  SHT_PROGBITS, TEXT_OFF, text_len, 0, 0, TEXT_ALIGN, 0},
+			{7,  SHT_SYMTAB,   symtab_off, (nfuncs + 1) * sym_size, 3, 1, 8,
+				sym_size},
+			{15, SHT_STRTAB,   strtab_off, str_len, 0, 0, 1, 0},
+			{23, SHT_STRTAB,   shstrtab_off, sizeof shstrtab, 0, 0, 1, 0},
+		};
+
+		for (i = 0; i < 5; i++)
+		{
+			Elf64_Shdr s64 = {0};
+			Elf32_Shdr s32 = {0};
+
+			s64.sh_name      = s32.sh_name      = sh[i][0];
+			s64.sh_type      = s32.sh_type      = sh[i][1];
+			s64.sh_offset    = s32.sh_offset    = sh[i][2];
+			s64.sh_size      = s32.sh_size      = sh[i][3];
+			s64.sh_link      = s32.sh_link      = sh[i][4];
+			s64.sh_info      = s32.sh_info      = sh[i][5];
+			s64.sh_addralign = s32.sh_addralign = sh[i][6];
+			s64.sh_entsize   = s32.sh_entsize   = sh[i][7];
+			if (i == 1) {
+				s64.sh_flags = s32.sh_flags = SHF_ALLOC|SHF_EXECINSTR;
+				s64.sh_addr  = s32.sh_addr  = base;
+			}
+
+			if (is64)
+				out_write(&s64, sizeof s64);
+			else
+				out_write(&s32, sizeof s32);
+		}
+	}
+	end = ftell(out);
+
+	if (!is64 && end > UINT32_MAX)
+		errx("File too big for ELF32!\n");
+
+	/* ELF and program headers. */
+	rewind(out);
+	if (is64)
+	{
+		Elf64_Ehdr eh = {0};
+		Elf64_Phdr ph = {0};
+
+		memcpy(eh.e_ident, ELFMAG, SELFMAG);
+		eh.e_ident[EI_CLASS]   = ELFCLASS64;
+		eh.e_ident[EI_DATA]    = ELFDATA2LSB;
+		eh.e_ident[EI_VERSION] = EV_CURRENT;
+		eh.e_type      = ET_EXEC;
+		eh.e_machine   = EM_X86_64;
+		eh.e_version   = EV_CURRENT;
+		eh.e_entry     = base;
+		eh.e_phoff     = sizeof eh;
+		eh.e_shoff     = shdr_off;
+		eh.e_ehsize    = sizeof eh;
+		eh.e_phentsize = sizeof ph;
+		eh.e_phnum     = 1;
+		eh.e_shentsize = sizeof(Elf64_Shdr);
+		eh.e_shnum     = 5;
+		eh.e_shstrndx  = 4;
+
+		ph.p_type   = PT_LOAD;
+		ph.p_flags  = PF_R|PF_X;
+		ph.p_offset = TEXT_OFF;
+		ph.p_vaddr  = ph.p_paddr = base;
+		ph.p_filesz = ph.p_memsz = text_len;
+		ph.p_align  = 0x1000;
+
+		out_write(&eh, sizeof eh);
+		out_write(&ph, sizeof ph);
+	}
+	else
+	{
+		Elf32_Ehdr eh = {0};
+		Elf32_Phdr ph = {0};
+
+		memcpy(eh.e_ident, ELFMAG, SELFMAG);
+		eh.e_ident[EI_CLASS]   = ELFCLASS32;
+		eh.e_ident[EI_DATA]    = ELFDATA2LSB;
+		eh.e_ident[EI_VERSION] = EV_CURRENT;
+		eh.e_type      = ET_EXEC;
+		eh.e_machine   = EM_386;
+		eh.e_version   = EV_CURRENT;
+		eh.e_entry     = base;
+		eh.e_phoff     = sizeof eh;
+		eh.e_shoff     = shdr_off;
+		eh.e_ehsize    = sizeof eh;
+		eh.e_phentsize = sizeof ph;
+		eh.e_phnum     = 1;
+		eh.e_shentsize = sizeof(Elf32_Shdr);
+		eh.e_shnum     = 5;
+		eh.e_shstrndx  = 4;
+
+		ph.p_type   = PT_LOAD;
+		ph.p_flags  = PF_R|PF_X;
+		ph.p_offset = TEXT_OFF;
+		ph.p_vaddr  = ph.p_paddr = base;
+		ph.p_filesz = ph.p_memsz = text_len;
+		ph.p_align  = 0x1000;
+
+		out_write(&eh, sizeof eh);
+		out_write(&ph, sizeof ph);
+	}
+}
+
+/**
+ * @brief Parses a size with an optional K, M or G suffix.
+ *
+ * @return Returns the size in bytes, or 0 if invalid.
+ */
+static uint64_t parse_size(const char *str)
+{
+	uint64_t val;
+	char *end;
+
+	val = strtoull(str, &end, 10);
+	switch (toupper((unsigned char)*end)) {
+	case 'G': val <<= 10; /* fall through */
+	case 'M': val <<= 10; /* fall through */
+	case 'K': val <<= 10; end++; break;
+	}
+	return (*end ? 0 : val);
+}
+
+/**
+ * @brief Parses the instruction mix, e.g.: "imm=3,mem=4,jcc=0".
+ * Classes not listed keep their default weight.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int parse_mix(char *str)
+{
+	char *tok, *eq;
+	int i;
+
+	for (tok = strtok(str, ","); tok; tok = strtok(NULL, ","))
+	{
+		if (!(eq = strchr(tok, '=')))
+			return (0);
+		*eq = '\0';
+
+		for (i = 0; i < MIX_MAX; i++)
+			if (!strcmp(tok, mix_names[i]))
+				break;
+		if (i == MIX_MAX)
+			return (0);
+		mix[i] = atoi(eq + 1);
+	}
+
+	for (i = 0, mix_total = 0; i < MIX_MAX; i++)
+		mix_total += mix[i];
+	return (mix_total > 0);
+}
+
+/**
+ * @brief Show program usage.
+ *
+ * @param prgname Program name.
+ */
+static void usage(const char *prgname)
+{
+	fprintf(stderr, "Usage: %s [options] -o <out_elf>\n", prgname);
+	fprintf(stderr,
+		"Options:\n"
+		"  -m <64|32>   Architecture: x86-64 or i386 (default: 64)\n"
+		"  -s <size>    .text size, with K/M/G suffix (default: 1M)\n"
+		"  -S <seed>    Random seed (default: 1)\n"
+		"  -e <ratio>   Ratio of eligible instructions (default: 0.15)\n"
+		"  -x <ratio>   Ratio of instructions with REX (default: 0.5)\n"
+		"  -d <ratio>   Ratio of functions followed by inline data\n"
+		"               (default: 0)\n"
+		"  -F <bytes>   Average function size (default: 256)\n"
+		"  -M <mix>     Weights of the non-eligible instructions\n"
+		"               (default: imm=3,mem=4,lea=2,mul=1,nop=1,jcc=1)\n"
+		"  -h           This help\n");
+	exit(EXIT_FAILURE);
+}
+
+/* Main. */
+int main(int argc, char **argv)
+{
+	uint64_t base;
+	int c;
+
+	while ((c = getopt(argc, argv, "hm:s:S:e:x:d:F:M:o:")) != -1)
+	{
+		switch (c) {
+		case 'm':
+			is64 = (atoi(optarg) != 32);
+			break;
+		case 's':
+			if (!(text_size = parse_size(optarg)))
+				usage(argv[0]);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'e':
+			elig_ratio = atof(optarg);
+			break;
+		case 'x':
+			rex_ratio = atof(optarg);
+			break;
+		case 'd':
+			data_ratio = atof(optarg);
+			break;
+		case 'F':
+			func_size = atoi(optarg);
+			break;
+		case 'M':
+			if (!parse_mix(optarg))
+				usage(argv[0]);
+			break;
+		case 'o':
+			out_file = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	if (!out_file || func_size < 16)
+		usage(argv[0]);
+
+	xed_tables_init();
+	if (is64) {
+		xed_state_init2(&dstate, XED_MACHINE_MODE_LONG_64,
+			XED_ADDRESS_WIDTH_64b);
+		base = 0x401000;
+	} else {
+		xed_state_init2(&dstate, XED_MACHINE_MODE_LEGACY_32,
+			XED_ADDRESS_WIDTH_32b);
+		base = 0x8049000;
+	}
+
+	if (!(out = fopen(out_file, "wb")))
+		errx("Unable to open output file %s!\n", out_file);
+	if (!(obuf = malloc(OUT_BUFF)))
+		errx("Unable to allocate memory!\n");
+
+	/* Text. */
+	rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+	if (fseek(out, TEXT_OFF, SEEK_SET) < 0)
+		errx("Unable to seek output file!\n");
+
+	while (text_len < text_size)
+		emit_function(func_size / 2 + rnd_n(func_size));
+
+	out_write(obuf, olen);
+	write_tables(base);
+
+	if (fclose(out))
+		errx("Unable to write output file!\n");
+
+	printf("%s: %" PRIu64 " bytes of .text, %zu functions\n",
+		out_file, text_len, nfuncs);
+
+	free(funcs);
+	free(obuf);
+	return (0);
+}
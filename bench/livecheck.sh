@@ -0,0 +1,64 @@
+#!/bin/sh
+# MIT License
+#
+# Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+# Live read check: watermarks a copy of 'sleep', runs it as a child
+# process and checks that reading it back with -p gives the same
+# payload as -r over the file on disk.
+#
+# Usage: bench/livecheck.sh [stelf] [extra stelf options, e.g. --resync]
+
+STELF=${1:-./stelf}
+[ $# -gt 0 ] && shift
+SLEEP=$(command -v sleep)
+
+# Yama only allows reading descendants, unless root or scope 0.
+scope=$(cat /proc/sys/kernel/yama/ptrace_scope 2>/dev/null || echo 0)
+if [ "$scope" != 0 ] && [ "$(id -u)" != 0 ]; then
+	echo "livecheck: skipped (needs root or kernel.yama.ptrace_scope=0)"
+	exit 0
+fi
+
+tmp=$(mktemp -d) || exit 1
+pid=
+trap '[ -n "$pid" ] && kill $pid 2>/dev/null; rm -rf "$tmp"' EXIT
+
+head -c 64 /dev/urandom > "$tmp/payload"
+"$STELF" -w -l "$@" "$SLEEP" -o "$tmp/marked" < "$tmp/payload" > /dev/null ||
+	{ echo "livecheck: write failed"; exit 1; }
+chmod +x "$tmp/marked"
+
+"$tmp/marked" 30 &
+pid=$!
+sleep 0.5
+
+"$STELF" -r 0 "$@" "$tmp/marked" > "$tmp/disk" ||
+	{ echo "livecheck: -r failed"; exit 1; }
+"$STELF" -p $pid "$@" > "$tmp/live" ||
+	{ echo "livecheck: -p failed"; exit 1; }
+
+if ! cmp -s "$tmp/disk" "$tmp/live" || ! cmp -s "$tmp/payload" "$tmp/live"
+then
+	echo "livecheck: FAILED, -p and -r outputs differ"
+	exit 1
+fi
+echo "livecheck: OK"
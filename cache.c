@@ -0,0 +1,351 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Scan results cache:
+ * The scan summary and the per-iclass eligible counters of each
+ * file are saved into a directory, one small text file per key.
+ * The key is the GNU build-id of the file (or a hash of its .text,
+ * if it has none), plus the .text size and the enabled channels,
+ * so the same build is only decoded once, on any host that shares
+ * the directory. Files are written into a temporary file and then
+ * renamed, so concurrent stelf processes never see a partial file.
+ *
+ * With --resync, the undecodable ranges found by the scan (skip
+ * map) are saved too, and write/read runs of the same build load
+ * them to jump over those ranges without decoding them again.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "stats.h"
+
+#define CACHE_VERSION 2
+
+/* Hits and misses so far. */
+static unsigned cache_hits;
+static unsigned cache_misses;
+
+/**
+ * @brief Hashes the buffer @p p (FNV-1a, one 64-bit word at a
+ * time, with a final mix).
+ *
+ * @param p   Buffer.
+ * @param len Buffer length.
+ *
+ * @return Returns the hash value.
+ */
+static uint64_t text_hash(const uint8_t *p, size_t len)
+{
+	uint64_t h = UINT64_C(0xcbf29ce484222325);
+	uint64_t w;
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&w, p + i, 8);
+		h = (h ^ w) * UINT64_C(0x100000001b3);
+	}
+	for (; i < len; i++)
+		h = (h ^ p[i]) * UINT64_C(0x100000001b3);
+
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	return (h);
+}
+
+/**
+ * @brief Builds the cache key of the (already loaded) ELF file
+ * of @p ctx, for the current channels.
+ *
+ * @param ctx Decoding context.
+ * @param key Returned cache key.
+ */
+void cache_make_key(const struct decode_ctx *ctx, struct cache_key *key)
+{
+	const struct elf_file_info *info = &ctx->info;
+	const uint8_t *id;
+	size_t len, i, pos;
+
+	pos = 0;
+	if (elf_build_id(info, &id, &len))
+	{
+		if (len > 64)
+			len = 64;
+		pos += sprintf(key->name, "b");
+		for (i = 0; i < len; i++)
+			pos += sprintf(key->name + pos, "%02x", id[i]);
+	}
+	else {
+		pos += sprintf(key->name, "h%016" PRIx64,
+			text_hash(info->file_buff + info->elf_file_off,
+				info->elf_text_size));
+	}
+
+	sprintf(key->name + pos, "-%d-%" PRIx64 "-%02x", info->elf_machine_type,
+		info->elf_text_size, decode_channels);
+}
+
+/**
+ * @brief Builds the path of the cache file of @p key.
+ *
+ * @param dir  Cache directory.
+ * @param key  Cache key.
+ * @param path Returned path.
+ * @param size Path buffer size.
+ *
+ * @return Returns 1 if success, 0 if the path is too long.
+ */
+static int cache_path(const char *dir, const struct cache_key *key,
+	char *path, size_t size)
+{
+	int n = snprintf(path, size, "%s/%s.scan", dir, key->name);
+	return (n > 0 && (size_t)n < size);
+}
+
+/**
+ * @brief Adds the skip map line @p line ("skip <off> <len>", in
+ * hex) to the skip map of @p ctx, checking that the ranges are
+ * sorted, do not overlap and lie inside .text.
+ *
+ * @param ctx  Decoding context.
+ * @param line Cache file line.
+ *
+ * @return Returns 1 if success, 0 if invalid.
+ */
+static int cache_add_skip(struct decode_ctx *ctx, const char *line)
+{
+	const struct decode_skip *last;
+	uint64_t off, len;
+
+	if (sscanf(line, "skip %" SCNx64 " %" SCNx64, &off, &len) != 2)
+		return (0);
+
+	last = ctx->nskips ? &ctx->skips[ctx->nskips - 1] : NULL;
+	if (!len || off > ctx->info.elf_text_size ||
+		len > ctx->info.elf_text_size - off ||
+		(last && off < last->off + last->len))
+	{
+		return (0);
+	}
+
+	return (decode_add_skip(ctx, ctx->nskips, off, len));
+}
+
+/**
+ * @brief Looks for the scan results of @p key in the cache
+ * directory @p dir. If found, loads its skip map into @p ctx and,
+ * when scanning, fills the results of @p ctx (and the global
+ * statistics, if enabled), as if the file had been scanned.
+ *
+ * @param dir Cache directory.
+ * @param key Cache key.
+ * @param ctx Decoding context, without a skip map.
+ *
+ * @return Returns 1 if hit, 0 if miss (or invalid cache file).
+ */
+int cache_lookup(const char *dir, const struct cache_key *key,
+	struct decode_ctx *ctx)
+{
+	char path[4096], line[256], name[192];
+	size_t total, patch, capacity;
+	uint64_t text_bytes, count;
+	uint64_t *ic_counts;
+	xed_iclass_enum_t iclass;
+	int version, ok, i;
+	size_t j;
+	FILE *f;
+
+	if (!cache_path(dir, key, path, sizeof path) || !(f = fopen(path, "r")))
+		goto miss;
+
+	ok = 0;
+	ic_counts = NULL;
+	total = patch = capacity = 0;
+	text_bytes = 0;
+
+	if (!fgets(line, sizeof line, f) ||
+		sscanf(line, "stelf-scan %d", &version) != 1 ||
+		version != CACHE_VERSION)
+	{
+		goto out;
+	}
+
+	if (!fgets(line, sizeof line, f) || sscanf(line, "key %191s", name) != 1 ||
+		strcmp(name, key->name))
+	{
+		goto out;
+	}
+
+	if (fscanf(f, "total_inst %zu\npatch_inst %zu\ncapacity_bits %zu\n"
+		"text_bytes %" SCNu64 "\n", &total, &patch, &capacity,
+		&text_bytes) != 4)
+	{
+		goto out;
+	}
+
+	/* Only needed to fill the statistics. */
+	if (stats && !(ic_counts = calloc(XED_ICLASS_LAST, sizeof(*ic_counts))))
+		goto out;
+
+	/* Per-iclass counters, until the end marker. */
+	while (fgets(line, sizeof line, f))
+	{
+		if (!strcmp(line, "end\n")) {
+			ok = 1;
+			break;
+		}
+		if (!strncmp(line, "skip ", 5)) {
+			if (!cache_add_skip(ctx, line))
+				break;
+			continue;
+		}
+		if (sscanf(line, "iclass %191s %" SCNu64, name, &count) != 2)
+			break;
+		iclass = str2xed_iclass_enum_t(name);
+		if (ic_counts && iclass > XED_ICLASS_INVALID && iclass < XED_ICLASS_LAST)
+			ic_counts[iclass] += count;
+	}
+
+out:
+	fclose(f);
+	if (!ok) {
+		free(ic_counts);
+		decode_release(ctx);
+		goto miss;
+	}
+
+	/* Write/read: only the skip map. */
+	if (!(ctx->flags & FLG_SCAN))
+		goto hit;
+
+	ctx->total_inst_count = total;
+	ctx->patch_inst_count = patch;
+	ctx->capacity_bits    = capacity;
+	ctx->decode_errors    = ctx->nskips;
+	for (j = 0; j < ctx->nskips; j++)
+		ctx->skipped_bytes += ctx->skips[j].len;
+
+	if (stats) {
+		for (i = 0; i < XED_ICLASS_LAST; i++)
+			stats->eligible[i] += ic_counts[i];
+		stats->decoded_inst  += total;
+		stats->text_bytes    += text_bytes;
+		stats->decode_errors += ctx->nskips;
+	}
+
+hit:
+	free(ic_counts);
+	cache_hits++;
+	return (1);
+miss:
+	cache_misses++;
+	return (0);
+}
+
+/**
+ * @brief Saves the scan results of @p ctx (with per-iclass
+ * counters and skip map) into the cache directory @p dir,
+ * atomically.
+ *
+ * @param dir Cache directory, created if not exists.
+ * @param key Cache key.
+ * @param ctx Decoding context, already scanned.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int cache_store(const char *dir, const struct cache_key *key,
+	const struct decode_ctx *ctx)
+{
+	char path[4096], tmp[4096];
+	size_t j;
+	FILE *f;
+	int fd, i;
+
+	if (!cache_path(dir, key, path, sizeof path) ||
+		snprintf(tmp, sizeof tmp, "%s/.%s.XXXXXX", dir, key->name)
+			>= (int)sizeof tmp)
+	{
+		return (0);
+	}
+
+	if (mkdir(dir, 0777) < 0 && errno != EEXIST)
+		errto(out0, "Unable to create cache directory %s!\n", dir);
+
+	if ((fd = mkstemp(tmp)) < 0)
+		errto(out0, "Unable to create cache file in %s!\n", dir);
+	fchmod(fd, 0644);
+
+	if (!(f = fdopen(fd, "w"))) {
+		close(fd);
+		goto out1;
+	}
+
+	fprintf(f, "stelf-scan %d\nkey %s\n", CACHE_VERSION, key->name);
+	fprintf(f, "total_inst %zu\npatch_inst %zu\ncapacity_bits %zu\n"
+		"text_bytes %" PRIu64 "\n", ctx->total_inst_count,
+		ctx->patch_inst_count, ctx->capacity_bits, ctx->info.elf_text_size);
+
+	for (i = 0; ctx->ic_eligible && i < XED_ICLASS_LAST; i++)
+		if (ctx->ic_eligible[i])
+			fprintf(f, "iclass %s %zu\n",
+				xed_iclass_enum_t2str((xed_iclass_enum_t)i),
+				ctx->ic_eligible[i]);
+
+	for (j = 0; j < ctx->nskips; j++)
+		fprintf(f, "skip %" PRIx64 " %" PRIx64 "\n", ctx->skips[j].off,
+			ctx->skips[j].len);
+
+	fprintf(f, "end\n");
+	if (fclose(f) != 0)
+		goto out1;
+
+	/* Readers either see the old file, or the complete new one. */
+	if (rename(tmp, path) < 0)
+		goto out1;
+
+	return (1);
+out1:
+	ERR("Unable to write cache file %s!\n", path);
+	unlink(tmp);
+out0:
+	return (0);
+}
+
+/**
+ * @brief Prints to stderr the amount of cache hits and misses
+ * so far.
+ */
+void cache_print_summary(void)
+{
+	fprintf(stderr, "Cache: %u hits, %u misses\n", cache_hits,
+		cache_misses);
+}
@@ -0,0 +1,1744 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xed/xed-interface.h>
+
+#include "decode.h"
+#include "io.h"
+#include "probes.h"
+#include "stats.h"
+#include "stream.h"
+#include "util.h"
+#include "verify.h"
+#include "main.h"
+
+/*
+ * Uncomment to enable DOUBLE_CHECK:
+ * With this macro enabled, each patched instruction is checked aginst
+ * the original to make sure it is exactly the same decoded instruction.
+ *
+ * This adds some overhead so its disabled by default.
+ * Enabled it if you're not sure if the patching is behaving
+ * correctly, or use --verify to check the whole file after
+ * writing.
+ */
+/* #define DOUBLE_CHECK. */
+
+#define OPC_BITD_MASK 0x2
+
+/**
+ * D-bit (direction bit) instructions table.
+ *
+ * Unfortunately I had to create this by hand, and
+ * this is the only instructions that have D-bit
+ * _and_ use ModRM _and_ use 2-set of registers.
+ *
+ * If someone knows of a better way to do that,
+ * I really appreciate.
+ *
+ * Based on GDB's i386-opc.tbl table file.
+ */
+static xed_iclass_enum_t bitD_list[] = {
+	XED_ICLASS_MOV,
+	XED_ICLASS_ADD,
+	XED_ICLASS_SUB,
+	XED_ICLASS_SBB,
+	XED_ICLASS_CMP,
+	XED_ICLASS_AND,
+	XED_ICLASS_OR,
+	XED_ICLASS_XOR,
+	XED_ICLASS_ADC
+};
+
+/**
+ * SSE/AVX register moves that have both a load form
+ * (xmm, xmm/m) and a store form (xmm/m, xmm): for reg/reg
+ * they are the very same move, with two encodings:
+ *
+ *   0F 10 / 0F 11       (V)MOVUPS, (V)MOVUPD (66)
+ *   0F 28 / 0F 29       (V)MOVAPS, (V)MOVAPD (66)
+ *   0F 6F / 0F 7F       (V)MOVDQA (66), (V)MOVDQU (F3), MOVQ (MMX)
+ *   F3 0F 7E / 66 0F D6 (V)MOVQ xmm, xmm
+ */
+static xed_iclass_enum_t simd_list[] = {
+	XED_ICLASS_MOVUPS,
+	XED_ICLASS_MOVUPD,
+	XED_ICLASS_MOVAPS,
+	XED_ICLASS_MOVAPD,
+	XED_ICLASS_MOVDQA,
+	XED_ICLASS_MOVDQU,
+	XED_ICLASS_MOVQ,
+	XED_ICLASS_VMOVUPS,
+	XED_ICLASS_VMOVUPD,
+	XED_ICLASS_VMOVAPS,
+	XED_ICLASS_VMOVAPD,
+	XED_ICLASS_VMOVDQA,
+	XED_ICLASS_VMOVDQU,
+	XED_ICLASS_VMOVQ
+};
+
+/**
+ * Three-operand VEX instructions with commutative sources
+ * (VEX.vvvv and ModRM.rm): integer and bitwise operations only.
+ *
+ * Floating-point arithmetic (VADDPS, VMULPD...) is not here:
+ * if both sources are NaN, the result is the NaN of the first
+ * source, so swapping them is not exactly the same operation.
+ */
+static xed_iclass_enum_t vex_comm_list[] = {
+	XED_ICLASS_VPADDB,
+	XED_ICLASS_VPADDW,
+	XED_ICLASS_VPADDD,
+	XED_ICLASS_VPADDQ,
+	XED_ICLASS_VPADDSB,
+	XED_ICLASS_VPADDSW,
+	XED_ICLASS_VPADDUSB,
+	XED_ICLASS_VPADDUSW,
+	XED_ICLASS_VPMULLW,
+	XED_ICLASS_VPMULLD,
+	XED_ICLASS_VPMULHW,
+	XED_ICLASS_VPMULHUW,
+	XED_ICLASS_VPMULUDQ,
+	XED_ICLASS_VPMULDQ,
+	XED_ICLASS_VPMADDWD,
+	XED_ICLASS_VPAVGB,
+	XED_ICLASS_VPAVGW,
+	XED_ICLASS_VPCMPEQB,
+	XED_ICLASS_VPCMPEQW,
+	XED_ICLASS_VPCMPEQD,
+	XED_ICLASS_VPCMPEQQ,
+	XED_ICLASS_VPMINSB,
+	XED_ICLASS_VPMINSW,
+	XED_ICLASS_VPMINSD,
+	XED_ICLASS_VPMINUB,
+	XED_ICLASS_VPMINUW,
+	XED_ICLASS_VPMINUD,
+	XED_ICLASS_VPMAXSB,
+	XED_ICLASS_VPMAXSW,
+	XED_ICLASS_VPMAXSD,
+	XED_ICLASS_VPMAXUB,
+	XED_ICLASS_VPMAXUW,
+	XED_ICLASS_VPMAXUD,
+	XED_ICLASS_VPAND,
+	XED_ICLASS_VPOR,
+	XED_ICLASS_VPXOR,
+	XED_ICLASS_VANDPS,
+	XED_ICLASS_VANDPD,
+	XED_ICLASS_VORPS,
+	XED_ICLASS_VORPD,
+	XED_ICLASS_VXORPS,
+	XED_ICLASS_VXORPD
+};
+
+/**
+ * Symmetric instructions whose reg/reg form (ModRM reg and rm)
+ * can be swapped without changing the opcode: TEST (84/85) and
+ * XCHG (86/87).
+ */
+static xed_iclass_enum_t swap_list[] = {
+	XED_ICLASS_TEST,
+	XED_ICLASS_XCHG
+};
+
+/* Channel names, for --channels. */
+static const struct {
+	const char *name;
+	unsigned    channel;
+} channel_names[] = {
+	{"dbit", CH_DBIT},
+	{"simd", CH_SIMD},
+	{"vex",  CH_VEX},
+	{"swap", CH_SWAP},
+	{"nop",  CH_NOP},
+	{"rexx", CH_REXX}
+};
+
+/* Enabled channels. */
+unsigned decode_channels = CH_DEFAULT;
+
+/* Resynchronize on decode errors (--resync). */
+int decode_resync = 0;
+
+/**
+ * @brief Checks if the iclass of the decoded instruction
+ * @p inst is in the list @p list.
+ *
+ * @param inst Decoded instruction.
+ * @param list Instruction class list.
+ * @param n    Amount of elements in @p list.
+ *
+ * @return Returns 1 if found, 0 if not.
+ */
+static inline int iclass_in(const xed_decoded_inst_t *inst,
+	const xed_iclass_enum_t *list, size_t n)
+{
+	xed_iclass_enum_t iclass;
+	size_t i;
+
+	iclass = xed_decoded_inst_get_iclass(inst);
+	for (i = 0; i < n; i++)
+		if (iclass == list[i])
+			return (1);
+
+	return (0);
+}
+
+/**
+ * @brief For a given decoded instruction, checks if the
+ * provided instruction have the 'direction-bit'.
+ *
+ * Since there is no pattern to identify whether a D-bit may
+ * appear or not, this function just iterates over the
+ * list above.
+ *
+ * @param inst Decoded instruction.
+ *
+ * @return Returns 1 if contains the 'D-bit' in the opcode,
+ * 0 if not.
+ */
+static inline int inst_have_bitD(const xed_decoded_inst_t *inst)
+{
+	return (iclass_in(inst, bitD_list,
+		sizeof(bitD_list)/sizeof(bitD_list[0])));
+}
+
+/**
+ * @brief Returns the offset of the REX prefix of the (legacy
+ * encoded) instruction @p inst, i.e., right before the opcode
+ * escape bytes (0F, 0F 38 or 0F 3A), if any.
+ *
+ * If the instruction has no REX, this is the offset of its
+ * last legacy prefix (if any).
+ *
+ * @param inst Decoded instruction.
+ *
+ * @return Returns the REX offset.
+ */
+static inline unsigned rex_offset(const xed_decoded_inst_t *inst)
+{
+	unsigned map = xed3_operand_get_map(inst);
+	return (xed3_operand_get_pos_nominal_opcode(inst) - 1 -
+		(map == 0 ? 0 : (map == 1 ? 1 : 2)));
+}
+
+/**
+ * @brief Check if the current instruction pointed by @p inst,
+ * is eligible to patch:
+ *
+ * In order that an instruction be eligible, it should:
+ * - Have D-bit/direction-bit in the opcode
+ * - Have ModRM byte
+ * - Be in the format: RegSrc/RegDst
+ *
+ * @param inst Decoded instruction.
+ *
+ * @return Returns 1 if eligible, 0 if not.
+ *
+ */
+int inst_is_eligible(const xed_decoded_inst_t *inst)
+{
+	uint8_t modrm;
+	const xed_inst_t *xi;
+	xed_operand_enum_t op_name1, op_name2;
+
+	/* Have D-bit?. */
+	if (!inst_have_bitD(inst))
+	{
+		INFO("Not bitD!\n");
+		return (0);
+	}
+
+	/* Have ModRM? */
+	if (!(modrm = xed_decoded_inst_get_modrm(inst)))
+	{
+		INFO("Not ModRM!\n");
+		return (0);
+	}
+
+	/* Is Reg/Reg?. */
+	xi       = xed_decoded_inst_inst(inst);
+	op_name1 = xed_operand_name(xed_inst_operand(xi, 0));
+	op_name2 = xed_operand_name(xed_inst_operand(xi, 1));
+	if (!xed_operand_is_register(op_name1) ||
+		!xed_operand_is_register(op_name2))
+	{
+		INFO("Not Reg/Reg!\n");
+		return (0);
+	}
+
+	return (1);
+}
+
+/**
+ * @brief Check if the current instruction pointed by @p inst
+ * is a SSE/AVX reg/reg move with load and store forms (see
+ * simd_list), that can be swapped in place:
+ *
+ * - Legacy or VEX encoded (not EVEX)
+ * - Register addressing mode
+ * - For VEX C5 (2-byte), both registers below xmm8, as there
+ *   is no VEX.B to hold the swapped register
+ * - For MOVQ, the F3 (load) or 66 (store) mandatory prefix,
+ *   and no other legacy prefix
+ *
+ * @param inst Decoded instruction.
+ * @param buff Buffer pointing to the beginning of the instruction.
+ *
+ * @return Returns 1 if eligible, 0 if not.
+ */
+static int inst_is_simd_move(const xed_decoded_inst_t *inst,
+	const uint8_t *buff)
+{
+	unsigned off_opcode;
+	unsigned off_pfx;
+	unsigned vex;
+	uint8_t  opcode;
+
+	if (!iclass_in(inst, simd_list, sizeof(simd_list)/sizeof(simd_list[0])))
+		return (0);
+
+	if (xed3_operand_get_mod(inst) != 0x3 || xed3_operand_get_map(inst) != 1)
+		return (0);
+
+	vex = xed3_operand_get_vexvalid(inst);
+	if (vex > 1)
+		return (0);
+
+	if (vex && !xed3_operand_get_vex_c4(inst) &&
+		xed3_operand_get_rexr(inst) != xed3_operand_get_rexb(inst))
+	{
+		INFO("VEX C5 without B!\n");
+		return (0);
+	}
+
+	off_opcode = xed3_operand_get_pos_nominal_opcode(inst);
+	opcode     = buff[off_opcode];
+
+	switch (opcode)
+	{
+	case 0x10: case 0x11:
+	case 0x28: case 0x29:
+	case 0x6F: case 0x7F:
+		return (1);
+
+	case 0x7E: case 0xD6:
+		/* VEX: pp is in the last VEX byte, F3 = 10b, 66 = 01b. */
+		if (vex)
+			return ((buff[off_opcode - 1] & 0x3) == (opcode == 0x7E ? 2 : 1));
+
+		/* Legacy: the prefix must be the first and only one. */
+		off_pfx = rex_offset(inst) - (xed3_operand_get_rex(inst) != 0);
+		if (off_pfx != 0)
+			return (0);
+		return (buff[0] == (opcode == 0x7E ? 0xF3 : 0x66));
+	}
+
+	return (0);
+}
+
+/**
+ * @brief Checks if the instruction @p inst has commutative
+ * sources, i.e., if its source registers can be swapped.
+ *
+ * @param inst Decoded instruction.
+ *
+ * @return Returns 1 if commutative, 0 if not.
+ */
+int inst_is_commutative(const xed_decoded_inst_t *inst)
+{
+	return (iclass_in(inst, vex_comm_list,
+		sizeof(vex_comm_list)/sizeof(vex_comm_list[0])) ||
+		iclass_in(inst, swap_list, sizeof(swap_list)/sizeof(swap_list[0])));
+}
+
+/**
+ * @brief Extracts the ModRM reg and rm registers of @p inst,
+ * with their REX extension, as register numbers (0-15).
+ *
+ * @param inst Decoded instruction.
+ * @param buff Buffer pointing to the beginning of the instruction.
+ * @param reg  Returned reg register.
+ * @param rm   Returned rm register.
+ */
+static inline void modrm_regs(const xed_decoded_inst_t *inst,
+	const uint8_t *buff, unsigned *reg, unsigned *rm)
+{
+	uint8_t modrm = buff[xed3_operand_get_pos_modrm(inst)];
+	*reg = ((modrm >> 3) & 0x7) | (xed3_operand_get_rexr(inst) << 3);
+	*rm  = (modrm & 0x7) | (xed3_operand_get_rexb(inst) << 3);
+}
+
+/**
+ * @brief Check if the current instruction pointed by @p inst
+ * is a TEST or XCHG (see swap_list) that can have its registers
+ * swapped:
+ *
+ * - Opcodes 84-87, register addressing mode
+ * - Different registers
+ *
+ * @param inst Decoded instruction.
+ * @param buff Buffer pointing to the beginning of the instruction.
+ *
+ * @return Returns 1 if eligible, 0 if not.
+ */
+static int inst_is_swappable(const xed_decoded_inst_t *inst,
+	const uint8_t *buff)
+{
+	unsigned reg, rm;
+	uint8_t opcode;
+
+	if (!iclass_in(inst, swap_list, sizeof(swap_list)/sizeof(swap_list[0])))
+		return (0);
+
+	if (xed3_operand_get_mod(inst) != 0x3 || xed3_operand_get_map(inst) != 0)
+		return (0);
+
+	/* TEST with imm (A8/A9/F6/F7) and XCHG with eAX (90+r) have no reg. */
+	opcode = buff[xed3_operand_get_pos_nominal_opcode(inst)];
+	if (opcode < 0x84 || opcode > 0x87)
+		return (0);
+
+	modrm_regs(inst, buff, &reg, &rm);
+	return (reg != rm);
+}
+
+/**
+ * @brief Extracts the source registers of a three-operand VEX
+ * instruction: VEX.vvvv (first source) and VEX.B + ModRM.rm
+ * (second source), as register numbers (0-15).
+ *
+ * @param inst Decoded instruction.
+ * @param buff Buffer pointing to the beginning of the instruction.
+ * @param src1 Returned first source.
+ * @param src2 Returned second source.
+ */
+static inline void vex_sources(const xed_decoded_inst_t *inst,
+	const uint8_t *buff, unsigned *src1, unsigned *src2)
+{
+	unsigned off_opcode;
+	unsigned b;
+
+	off_opcode = xed3_operand_get_pos_nominal_opcode(inst);
+
+	/* vvvv and B are stored inverted, C5 has no B (= 0). */
+	b = 0;
+	if (xed3_operand_get_vex_c4(inst))
+		b = !(buff[off_opcode - 2] & 0x20);
+
+	*src1 = (~buff[off_opcode - 1] >> 3) & 0xF;
+	*src2 = (buff[xed3_operand_get_pos_modrm(inst)] & 0x7) | (b << 3);
+}
+
+/**
+ * @brief Check if the current instruction pointed by @p inst
+ * is a three-operand VEX instruction with commutative sources
+ * (see vex_comm_list), that can have its sources swapped:
+ *
+ * - VEX encoded, register addressing mode
+ * - Different source registers
+ * - For VEX C5 (2-byte), both sources below xmm8, as there
+ *   is no VEX.B to hold the swapped register
+ *
+ * @param inst Decoded instruction.
+ * @param buff Buffer pointing to the beginning of the instruction.
+ *
+ * @return Returns 1 if eligible, 0 if not.
+ */
+static int inst_is_vex_commutative(const xed_decoded_inst_t *inst,
+	const uint8_t *buff)
+{
+	unsigned src1, src2;
+
+	if (xed3_operand_get_vexvalid(inst) != 1 ||
+		xed3_operand_get_mod(inst) != 0x3)
+	{
+		return (0);
+	}
+
+	if (!inst_is_commutative(inst))
+		return (0);
+
+	vex_sources(inst, buff, &src1, &src2);
+	if (src1 == src2)
+		return (0);
+
+	if (!xed3_operand_get_vex_c4(inst) && (src1 | src2) >= 8) {
+		INFO("VEX C5 without B!\n");
+		return (0);
+	}
+	return (1);
+}
+
+/**
+ * @brief Check if the current instruction pointed by @p inst
+ * is a multi-byte NOP (0F 1F /0) with a displacement: since
+ * the memory operand is never accessed, the displacement bytes
+ * can hold anything:
+ *
+ * - Legacy encoded, opcode 0F 1F and ModRM.reg = 0
+ * - Memory addressing mode, with disp8 or disp32
+ *
+ * @param inst Decoded instruction.
+ * @param buff Buffer pointing to the beginning of the instruction.
+ *
+ * @return Returns 1 if eligible, 0 if not.
+ */
+static int inst_is_nop_padding(const xed_decoded_inst_t *inst,
+	const uint8_t *buff)
+{
+	if (xed3_operand_get_vexvalid(inst) != 0 ||
+		xed3_operand_get_map(inst) != 1 ||
+		buff[xed3_operand_get_pos_nominal_opcode(inst)] != 0x1F)
+	{
+		return (0);
+	}
+
+	if (xed3_operand_get_mod(inst) == 0x3 || xed3_operand_get_reg(inst) != 0)
+		return (0);
+
+	return (xed3_operand_get_disp_width(inst) != 0);
+}
+
+/**
+ * @brief Check if the current instruction pointed by @p inst
+ * has a REX prefix with a free X bit: in register addressing
+ * mode there is no SIB, so REX.X is ignored by the CPU.
+ *
+ * - 64-bit mode, legacy encoded, with REX
+ * - ModRM in register addressing mode
+ *
+ * @param inst Decoded instruction.
+ * @param buff Buffer pointing to the beginning of the instruction.
+ *
+ * @return Returns 1 if eligible, 0 if not.
+ */
+static int inst_has_free_rexx(const xed_decoded_inst_t *inst,
+	const uint8_t *buff)
+{
+	unsigned off_modrm;
+
+	if (!xed3_operand_get_rex(inst) || xed3_operand_get_vexvalid(inst) != 0)
+		return (0);
+
+	/* Has ModRM, in register addressing mode?. */
+	off_modrm = xed3_operand_get_pos_modrm(inst);
+	if (off_modrm <= xed3_operand_get_pos_nominal_opcode(inst) ||
+		(buff[off_modrm] >> 6) != 0x3)
+	{
+		return (0);
+	}
+
+	/* Just some sanity check. */
+	return ((buff[rex_offset(inst)] & 0xF0) == 0x40);
+}
+
+/**
+ * @brief Checks through which of the enabled channels (if
+ * any) the instruction @p inst carries payload bits.
+ *
+ * @param inst Decoded instruction.
+ * @param buff Buffer pointing to the beginning of the instruction.
+ *
+ * @return Returns the channel (CH_*), possibly combined with
+ * CH_REXX, or 0 if not eligible.
+ */
+static unsigned inst_channel(const xed_decoded_inst_t *inst,
+	const uint8_t *buff)
+{
+	unsigned chan;
+
+	if ((decode_channels & CH_DBIT) && inst_is_eligible(inst))
+		chan = CH_DBIT;
+	else if ((decode_channels & CH_SIMD) && inst_is_simd_move(inst, buff))
+		chan = CH_SIMD;
+	else if ((decode_channels & CH_VEX) && inst_is_vex_commutative(inst, buff))
+		chan = CH_VEX;
+	else if ((decode_channels & CH_SWAP) && inst_is_swappable(inst, buff))
+		chan = CH_SWAP;
+	else if ((decode_channels & CH_NOP) && inst_is_nop_padding(inst, buff))
+		chan = CH_NOP;
+	else
+		chan = 0;
+
+	/* REX.X is an extra bit, on top of any other channel. */
+	if ((decode_channels & CH_REXX) && inst_has_free_rexx(inst, buff))
+		chan |= CH_REXX;
+
+	return (chan);
+}
+
+/**
+ * @brief Returns the amount of bits the instruction @p inst
+ * carries, for the channel @p chan.
+ *
+ * @param chan Instruction channel (CH_*).
+ * @param inst Decoded instruction.
+ *
+ * @return Returns the amount of bits: the displacement size for
+ * CH_NOP, 1 for the others, plus 1 for CH_REXX.
+ */
+static inline unsigned inst_nbits(unsigned chan,
+	const xed_decoded_inst_t *inst)
+{
+	unsigned nbits;
+
+	nbits = !!(chan & CH_REXX);
+	chan &= ~CH_REXX;
+
+	if (chan == CH_NOP)
+		return (nbits + xed3_operand_get_disp_width(inst));
+	return (nbits + (chan != 0));
+}
+
+/**
+ * @brief Returns the bits currently stored in the instruction
+ * @p inst, for the channel @p chan.
+ *
+ * - CH_DBIT: the D-bit of the opcode.
+ * - CH_SIMD: 1 if in the store form (11, 29, 7F, D6), 0 if
+ *   in the load form.
+ * - CH_VEX: 1 if the first source register (VEX.vvvv) is
+ *   greater than the second one (ModRM.rm), 0 otherwise.
+ * - CH_SWAP: 1 if the ModRM reg register is greater than the
+ *   rm one, 0 otherwise.
+ * - CH_NOP: the displacement bytes, little-endian.
+ * - CH_REXX: REX.X, after the bits of the other channel.
+ *
+ * @param chan Instruction channel (CH_*).
+ * @param inst Decoded instruction.
+ * @param buff Buffer pointing to the beginning of the instruction.
+ *
+ * @return Returns the stored bits, the first one in the least
+ * significant bit.
+ */
+static inline uint64_t inst_get_bits(unsigned chan,
+	const xed_decoded_inst_t *inst, const uint8_t *buff)
+{
+	unsigned src1, src2;
+	unsigned off, i;
+	uint64_t value;
+	uint64_t rexx;
+	uint8_t opcode;
+
+	value = 0;
+	if (chan & CH_REXX) {
+		chan &= ~CH_REXX;
+		rexx  = (buff[rex_offset(inst)] >> 1) & 1;
+		value = rexx << inst_nbits(chan, inst);
+	}
+
+	switch (chan)
+	{
+	case 0:
+		return (value);
+	case CH_VEX:
+		vex_sources(inst, buff, &src1, &src2);
+		return (value | (src1 > src2));
+	case CH_SWAP:
+		modrm_regs(inst, buff, &src1, &src2);
+		return (value | (src1 > src2));
+	case CH_NOP:
+		off = xed3_operand_get_pos_disp(inst);
+		for (i = 0; i < xed3_operand_get_disp_width(inst) / 8; i++)
+			value |= (uint64_t)buff[off + i] << (i * 8);
+		return (value);
+	}
+
+	opcode = buff[xed3_operand_get_pos_nominal_opcode(inst)];
+	if (chan == CH_SIMD)
+		return (value | (opcode == 0x11 || opcode == 0x29 ||
+			opcode == 0x7F || opcode == 0xD6));
+
+	return (value | ((opcode & OPC_BITD_MASK) >> 1));
+}
+
+/**
+ * @brief Swaps the ModRM reg and rm registers of the instruction
+ * @p inst, in the buffer @p nbuff, together with its extension
+ * bits: REX.R/REX.B, or VEX.R/VEX.B (C4 only).
+ *
+ * @param inst  Decoded instruction.
+ * @param nbuff Copy of the instruction buffer, to be changed.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int swap_modrm_regs(const xed_decoded_inst_t *inst, uint8_t *nbuff)
+{
+	unsigned off_modrm;
+	uint8_t reg1, reg2;
+	uint8_t modrm;
+
+	off_modrm = xed3_operand_get_pos_modrm(inst);
+	modrm     = nbuff[off_modrm];
+
+	/* Just some sanity check. */
+	if ((modrm >> 6) != 0x3) { /* Register addressing mode. */
+		ERR("Not register addressing mode detected!!!\n");
+		return (0);
+	}
+
+	reg1 = (modrm >> 3) & 0x7;
+	reg2 = (modrm & 0x7);
+
+	/* Clear modrm and set the register in inverted order. */
+	modrm &= 0xC0;
+	modrm |= (reg2 << 3) | reg1;
+	nbuff[off_modrm] = modrm;
+
+	/*
+	 * If the extension bits differ, we need to invert their
+	 * order too.
+	 */
+	if (xed3_operand_get_rexr(inst) == xed3_operand_get_rexb(inst))
+		return (1);
+
+	/*
+	 * VEX: R and B are stored inverted in the second byte of
+	 * the C4 form (R.XB.mmmmm), C5 has no B at all.
+	 */
+	if (xed3_operand_get_vexvalid(inst))
+	{
+		if (!xed3_operand_get_vex_c4(inst)) {
+			ERR("VEX C5 without B!\n");
+			return (0);
+		}
+		nbuff[xed3_operand_get_pos_nominal_opcode(inst) - 2] ^= 0xA0;
+		return (1);
+	}
+
+	/* xor by 101b to invert both R and B bit. */
+	nbuff[rex_offset(inst)] ^= 0x5;
+	return (1);
+}
+
+/**
+ * @brief Swaps the SSE/AVX move @p inst between its load and
+ * store forms, in the buffer @p nbuff.
+ *
+ * @param inst  Decoded instruction.
+ * @param nbuff Copy of the instruction buffer, to be changed.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int swap_simd_move(const xed_decoded_inst_t *inst, uint8_t *nbuff)
+{
+	unsigned off_opcode;
+
+	off_opcode = xed3_operand_get_pos_nominal_opcode(inst);
+
+	switch (nbuff[off_opcode])
+	{
+	case 0x10: case 0x11:
+	case 0x28: case 0x29:
+		nbuff[off_opcode] ^= 0x01;
+		break;
+
+	case 0x6F: case 0x7F:
+		nbuff[off_opcode] ^= 0x10;
+		break;
+
+	/* MOVQ: the mandatory prefix changes too (F3 <-> 66). */
+	case 0x7E: case 0xD6:
+		nbuff[off_opcode] ^= 0x7E ^ 0xD6;
+		if (xed3_operand_get_vexvalid(inst))
+			nbuff[off_opcode - 1] ^= 0x3;
+		else
+			nbuff[0] ^= 0xF3 ^ 0x66;
+		break;
+
+	default:
+		ERR("Unexpected SIMD move opcode: 0x%02X\n", nbuff[off_opcode]);
+		return (0);
+	}
+
+	return (swap_modrm_regs(inst, nbuff));
+}
+
+/**
+ * @brief Swaps the sources (VEX.vvvv and ModRM.rm) of the
+ * three-operand VEX instruction @p inst, in the buffer @p nbuff.
+ *
+ * @param inst  Decoded instruction.
+ * @param nbuff Copy of the instruction buffer, to be changed.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int swap_vex_sources(const xed_decoded_inst_t *inst, uint8_t *nbuff)
+{
+	unsigned off_opcode, off_modrm;
+	unsigned src1, src2;
+
+	off_opcode = xed3_operand_get_pos_nominal_opcode(inst);
+	off_modrm  = xed3_operand_get_pos_modrm(inst);
+	vex_sources(inst, nbuff, &src1, &src2);
+
+	/* VEX.B changes too, only available in C4. */
+	if ((src1 ^ src2) & 0x8)
+	{
+		if (!xed3_operand_get_vex_c4(inst)) {
+			ERR("VEX C5 without B!\n");
+			return (0);
+		}
+		nbuff[off_opcode - 2] ^= 0x20;
+	}
+
+	nbuff[off_opcode - 1] = (nbuff[off_opcode - 1] & 0x87) |
+		((~src2 & 0xF) << 3);
+	nbuff[off_modrm] = (nbuff[off_modrm] & 0xF8) | (src1 & 0x7);
+	return (1);
+}
+
+/**
+ * @brief Given a current decoded instruction pointed by @p inst,
+ * patches (or not, if FLG_SCAN) the instruction encoding,
+ * accordingly with the specified @p target bits.
+ *
+ * @param flags Current mode (FLG_SCAN, FLG_WRITE...).
+ * @param buff  Buffer pointing to the beginning of the instruction
+ *              (must be RW if FLG_WRITE).
+ * @param inst  Current decoded instruction.
+ * @param isize Current instruction size.
+ * @param chan  Instruction channel (CH_*).
+ * @param target Target bits to be set in the instruction (see
+ *               @ref inst_get_bits).
+ *
+ * @return Returns 2 if the instruction was changed, 1 if it
+ * already had the target bits (or if in FLG_SCAN mode), and 0 if
+ * the patch failed.
+ */
+static int patch_inst(unsigned flags,
+	uint8_t *buff, const xed_decoded_inst_t *inst, unsigned isize,
+	unsigned chan, uint64_t target)
+{
+	uint8_t nbuff[16] = {0};
+	xed_decoded_inst_t inst_new;
+	unsigned off, i, nbits;
+	uint64_t cur;
+	int ret;
+
+	((void)inst_new);
+	memcpy(nbuff, buff, isize);
+
+	/*
+	 * Check if the current bits are already equals to our target,
+	 * if so, nothing need to be done!.
+	 */
+	cur = inst_get_bits(chan, inst, nbuff);
+	if (!(flags & FLG_SCAN) && cur == target) {
+		INFO("bits are already equals to target (0x%jx, chan: %u)!\n",
+			(uintmax_t)target, chan);
+		return (1); /* since this is not an error. */
+	}
+
+	/* REX.X, after the bits of the other channel. */
+	nbits = inst_nbits(chan & ~CH_REXX, inst);
+	if (chan & CH_REXX) {
+		off = rex_offset(inst);
+		nbuff[off] = (nbuff[off] & ~0x2) | (((target >> nbits) & 1) << 1);
+		chan &= ~CH_REXX;
+	}
+
+	/* Other channel: only if its bits differ. */
+	if (!(flags & FLG_SCAN) &&
+		!((cur ^ target) & ((UINT64_C(1) << nbits) - 1)))
+	{
+		chan = 0;
+	}
+
+	switch (chan)
+	{
+	case 0:
+		ret = 1;
+		break;
+	case CH_DBIT:
+		/* Flip bitD and swap the registers. */
+		nbuff[xed3_operand_get_pos_nominal_opcode(inst)] ^= OPC_BITD_MASK;
+		ret = swap_modrm_regs(inst, nbuff);
+		break;
+	case CH_SIMD:
+		ret = swap_simd_move(inst, nbuff);
+		break;
+	case CH_VEX:
+		ret = swap_vex_sources(inst, nbuff);
+		break;
+	case CH_SWAP:
+		ret = swap_modrm_regs(inst, nbuff);
+		break;
+	case CH_NOP:
+		off = xed3_operand_get_pos_disp(inst);
+		for (i = 0; i < xed3_operand_get_disp_width(inst) / 8; i++)
+			nbuff[off + i] = target >> (i * 8);
+		ret = 1;
+		break;
+	default:
+		ret = 0;
+		break;
+	}
+
+	if (!ret)
+		return (0);
+
+	/* Check if the new inst is equal to the original. */
+#ifdef DOUBLE_CHECK
+	if (!inst_decode_as(inst, nbuff, isize, &inst_new) ||
+		!inst_equivalent(inst, &inst_new))
+	{
+		ERR("Instructions do not match!:\n");
+		ERR("Old inst:  "); print_inst_str(inst);
+		ERR("New instr: "); print_inst_str(&inst_new);
+		return (0);
+	}
+#endif
+
+#if DBG_LVL == 1
+	DEBUG("Old inst:  "); print_inst_str(inst);
+	DEBUG("New instr: "); print_inst_str(&inst_new);
+#endif
+
+	/* Do not make the changes if in only-test mode. */
+	if (flags & FLG_SCAN)
+		return (1);
+
+	memcpy(buff, nbuff, isize);
+	return (2);
+}
+
+/**
+ * @brief Reads from the payload source and returns the next bit
+ * to be patched into the ELF file.
+ *
+ * @param ctx Decoding context.
+ *
+ * @return Returns the bit read, or -1 if EOF.
+ */
+static int read_next_bit(struct decode_ctx *ctx)
+{
+	int ret;
+
+	ret = -1;
+
+	/* If no bits left, read a new byte */
+	if (!ctx->bits_left)
+	{
+		ctx->bits = ctx->get_byte(ctx->data);
+		if (ctx->bits < 0)
+			return (ret);
+		ctx->bits_left = 8;
+	}
+
+	/* Extract the leftmost bit and shift bits */
+	ret = ctx->bits & 1;
+	ctx->bits >>= 1;
+	ctx->bits_left--;
+
+	return (ret);
+}
+
+/**
+ * @brief Writes the bit @p bit to the payload destination.
+ *
+ * @param ctx Decoding context.
+ * @param bit Bit read from the file.
+ *
+ * @return Returns 1 if more bits are expected, 0 if the payload
+ * has ended.
+ */
+static inline int put_next_bit(struct decode_ctx *ctx, unsigned bit)
+{
+	ctx->curr_byte = (ctx->curr_byte >> 1) | (bit << 7);
+	ctx->bits_amnt++;
+
+	if (ctx->bits_amnt == 8) {
+		ctx->bits_amnt = 0;
+		if (!ctx->put_byte(ctx->data, ctx->curr_byte))
+			return (0);
+		ctx->curr_byte = 0;
+	}
+	return (++ctx->written_bits != ctx->amnt_should_read);
+}
+
+/**
+ * @brief Given a decoded instruction pointed by @p inst,
+ * writes its read bits to the payload destination.
+ *
+ * @param ctx  Decoding context.
+ * @param chan Instruction channel (CH_*).
+ * @param inst Current decoded instruction.
+ * @param buff Buffer pointing to the beginning of the current
+ *             instruction.
+ *
+ * @return Returns 1 if more bits are expected, 0 if the payload
+ * has ended.
+ */
+static int write_next_bits(struct decode_ctx *ctx, unsigned chan,
+	const xed_decoded_inst_t *inst, const uint8_t *buff)
+{
+	unsigned nbits, i;
+	uint64_t value;
+
+	value = inst_get_bits(chan, inst, buff);
+	nbits = inst_nbits(chan, inst);
+
+	for (i = 0; i < nbits; i++)
+		if (!put_next_bit(ctx, (value >> i) & 1))
+			return (0);
+
+	return (1);
+}
+
+/**
+ * @brief Finds the function that contains the address @p addr,
+ * with a branchless binary search.
+ *
+ * @param syms  Function symbols, sorted by address.
+ * @param nsyms Amount of symbols.
+ * @param addr  Address to be found.
+ * @param next  Returned address where the lookup result may
+ *              change (i.e.: the end of the function or the
+ *              start of the next one).
+ *
+ * @return Returns the symbol index, or @p nsyms if the address
+ * does not belong to any function.
+ */
+size_t sym_lookup(const struct elf_sym *syms, size_t nsyms,
+	uint64_t addr, uint64_t *next)
+{
+	const struct elf_sym *base;
+	size_t len, half, idx;
+	uint64_t end;
+
+	if (!nsyms || addr < syms[0].addr) {
+		*next = nsyms ? syms[0].addr : UINT64_MAX;
+		return (nsyms);
+	}
+
+	base = syms;
+	len  = nsyms;
+	while (len > 1) {
+		half  = len / 2;
+		base += (base[half].addr <= addr) * half;
+		len  -= half;
+	}
+
+	idx   = base - syms;
+	end   = base->addr + base->size;
+	*next = (idx + 1 < nsyms) ? syms[idx + 1].addr : UINT64_MAX;
+
+	/* Gap between functions. */
+	if (addr >= end)
+		return (nsyms);
+
+	if (end < *next)
+		*next = end;
+	return (idx);
+}
+
+/**
+ * @brief Compare two 64-bit offsets, for qsort().
+ *
+ * @param a First offset.
+ * @param b Second offset.
+ *
+ * @return Returns a negative, zero or positive value if @p a
+ * goes before, together or after @p b.
+ */
+static int off_cmp(const void *a, const void *b)
+{
+	uint64_t o1 = *(const uint64_t *)a;
+	uint64_t o2 = *(const uint64_t *)b;
+	return ((o1 > o2) - (o1 < o2));
+}
+
+/**
+ * @brief Builds the resynchronization points of @p ctx: every
+ * function start known from the symbol tables and from the
+ * .eh_frame_hdr search table, as sorted .text offsets.
+ *
+ * Only done on the first decode error, so files that decode
+ * cleanly pay nothing for it.
+ *
+ * @param ctx Decoding context.
+ */
+static void resync_init(struct decode_ctx *ctx)
+{
+	struct elf_sym *syms;
+	uint64_t *fdes;
+	size_t nsyms, nfdes, i, j;
+
+	ctx->resync_ready = 1;
+
+	if (!load_func_symbols(&ctx->info, &syms, &nsyms)) {
+		syms  = NULL;
+		nsyms = 0;
+	}
+	if (!load_fde_starts(&ctx->info, &fdes, &nfdes)) {
+		fdes  = NULL;
+		nfdes = 0;
+	}
+
+	if (nsyms + nfdes &&
+		!(ctx->resync = malloc((nsyms + nfdes) * sizeof(*ctx->resync))))
+	{
+		errx("Unable to allocate memory!\n");
+	}
+
+	for (i = 0; i < nsyms; i++)
+		ctx->resync[i] = syms[i].addr - ctx->info.elf_text_base_addr;
+	for (j = 0; j < nfdes; j++)
+		ctx->resync[i++] = fdes[j] - ctx->info.elf_text_base_addr;
+
+	/* Sort and remove duplicates. */
+	if (i) {
+		qsort(ctx->resync, i, sizeof(*ctx->resync), off_cmp);
+		for (nsyms = i, i = 1, j = 0; i < nsyms; i++)
+			if (ctx->resync[i] != ctx->resync[j])
+				ctx->resync[++j] = ctx->resync[i];
+		i = j + 1;
+	}
+	ctx->nresync = i;
+
+	free(syms);
+	free(fdes);
+}
+
+/**
+ * @brief Finds where decoding should resume after a decode
+ * error at @p off: the first function start after it, or the
+ * end of .text if there is none.
+ *
+ * @param ctx Decoding context.
+ * @param off Offset of the undecodable instruction.
+ *
+ * @return Returns the resynchronization offset.
+ */
+static uint64_t resync_next(struct decode_ctx *ctx, uint64_t off)
+{
+	size_t lo, hi, mid;
+
+	if (!ctx->resync_ready)
+		resync_init(ctx);
+
+	/* First point > off. */
+	for (lo = 0, hi = ctx->nresync; lo < hi; )
+	{
+		mid = lo + (hi - lo) / 2;
+		if (ctx->resync[mid] <= off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < ctx->nresync && ctx->resync[lo] < ctx->info.elf_text_size)
+		return (ctx->resync[lo]);
+	return (ctx->info.elf_text_size);
+}
+
+/**
+ * @brief Inserts the undecodable range [@p off, @p off + @p len)
+ * at the position @p idx of the skip map of @p ctx. The caller
+ * must keep the map sorted.
+ *
+ * @param ctx Decoding context.
+ * @param idx Position.
+ * @param off Range offset, relative to the .text start.
+ * @param len Range length.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int decode_add_skip(struct decode_ctx *ctx, size_t idx, uint64_t off,
+	uint64_t len)
+{
+	struct decode_skip *tmp;
+	size_t cap;
+
+	if (ctx->nskips == ctx->cap_skips) {
+		cap = ctx->cap_skips ? ctx->cap_skips * 2 : 16;
+		if (!(tmp = realloc(ctx->skips, cap * sizeof(*tmp))))
+			return (0);
+		ctx->skips     = tmp;
+		ctx->cap_skips = cap;
+	}
+
+	memmove(ctx->skips + idx + 1, ctx->skips + idx,
+		(ctx->nskips - idx) * sizeof(*ctx->skips));
+	ctx->skips[idx].off = off;
+	ctx->skips[idx].len = len;
+	ctx->nskips++;
+	return (1);
+}
+
+/**
+ * @brief Jumps over the skip map range @p idx, which starts at
+ * (or before) the current offset @p off.
+ *
+ * @param ctx       Decoding context.
+ * @param off       Current offset, relative to the .text start.
+ * @param rem_bytes Remaining .text bytes.
+ * @param idx       Range index, advanced to the next range.
+ * @param skip_at   Returned start of the next range.
+ *
+ * @return Returns the amount of bytes to be skipped.
+ */
+static uint64_t skip_range(struct decode_ctx *ctx, uint64_t off,
+	uint64_t rem_bytes, size_t *idx, uint64_t *skip_at)
+{
+	const struct decode_skip *s = &ctx->skips[(*idx)++];
+	uint64_t len;
+
+	len = (s->off + s->len > off) ? s->off + s->len - off : 0;
+	if (len > rem_bytes)
+		len = rem_bytes;
+
+	ctx->decode_errors++;
+	ctx->skipped_bytes += len;
+
+	*skip_at = (*idx < ctx->nskips) ? ctx->skips[*idx].off : UINT64_MAX;
+	return (len);
+}
+
+/**
+ * @brief Initializes the decoding context @p ctx for the
+ * mode @p flags. The payload I/O callbacks and the ELF file
+ * info must be filled by the caller.
+ *
+ * @param ctx   Decoding context.
+ * @param flags Mode: FLG_SCAN, FLG_WRITE or FLG_READ.
+ */
+void decode_init(struct decode_ctx *ctx, unsigned flags)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->flags = flags;
+}
+
+/**
+ * @brief Parses the comma-separated channel list @p list
+ * (e.g.: "dbit,simd"), or "all" for all channels.
+ *
+ * @param list Channel list.
+ *
+ * @return Returns the channel set (CH_*), or 0 if invalid.
+ */
+unsigned decode_parse_channels(const char *list)
+{
+	unsigned channels;
+	size_t   len, i;
+
+	channels = 0;
+	while (*list)
+	{
+		len = strcspn(list, ",");
+
+		if (len == 3 && !strncmp(list, "all", 3)) {
+			for (i = 0; i < sizeof(channel_names)/sizeof(channel_names[0]); i++)
+				channels |= channel_names[i].channel;
+			goto next;
+		}
+
+		for (i = 0; i < sizeof(channel_names)/sizeof(channel_names[0]); i++)
+			if (strlen(channel_names[i].name) == len &&
+				!strncmp(list, channel_names[i].name, len))
+			{
+				break;
+			}
+
+		if (i == sizeof(channel_names)/sizeof(channel_names[0]))
+			return (0);
+
+		channels |= channel_names[i].channel;
+	next:
+		list += len;
+		if (*list == ',')
+			list++;
+	}
+	return (channels);
+}
+
+/**
+ * @brief Accounts the instruction at @p off (relative to the .text
+ * start) as modified: counts the pages touched for the first time
+ * and marks them as dirty, so that only those are written back.
+ *
+ * @param ctx       Decoding context.
+ * @param off       Instruction offset.
+ * @param len       Instruction length.
+ * @param last_page Last page counted so far (instructions are
+ *                  patched in order).
+ */
+static inline void mark_dirty(struct decode_ctx *ctx, uint64_t off,
+	unsigned len, uint64_t *last_page)
+{
+	uint64_t first, last;
+
+	off  += ctx->info.elf_file_off;
+	first = off / IO_PAGE;
+	last  = (off + len - 1) / IO_PAGE;
+
+	if (*last_page == UINT64_MAX || first > *last_page)
+		ctx->dirty_pages += last - first + 1;
+	else if (last > *last_page)
+		ctx->dirty_pages += last - *last_page;
+	*last_page = last;
+
+	io_mark_dirty(&ctx->info, off, len);
+}
+
+/**
+ * @brief Main decoding loop, see @ref decode_instructions.
+ *
+ * This is always inlined with a constant @p with_stats, so the
+ * statistics collection is compiled out of the regular loop.
+ *
+ * @param ctx        Decoding context.
+ * @param with_stats Whether statistics should be collected.
+ */
+static inline __attribute__((always_inline))
+void decode_loop(struct decode_ctx *ctx, const int with_stats)
+{
+	uint8_t *buff;
+	uint8_t *text;
+	int      next_bit;
+	int      patched;
+	int      timed;
+	unsigned eligible;
+	unsigned inst_len;
+	unsigned nbits, i;
+	size_t   rem_bytes;
+	uint64_t value;
+	uint64_t addr, fn_next;
+	uint64_t last_page;
+	uint64_t skip_at, skip_len;
+	size_t   fn_cur;
+	size_t   next_skip;
+	xed_iclass_enum_t  iclass;
+	xed_error_enum_t   xed_error;
+	xed_decoded_inst_t decoded_inst;
+	struct stats_timer t_patch;
+
+	text      = ctx->info.file_buff + ctx->info.elf_file_off;
+	buff      = text;
+	rem_bytes = ctx->info.elf_text_size;
+	next_bit  = 0;
+	value     = 0;
+	fn_cur    = ctx->nsyms;
+	fn_next   = 0;
+	last_page = UINT64_MAX;
+	next_skip = 0;
+	skip_at   = ctx->nskips ? ctx->skips[0].off : UINT64_MAX;
+
+	while (rem_bytes)
+	{
+		/* Known undecodable range: jump over it. */
+		if ((uint64_t)(buff - text) >= skip_at)
+		{
+			skip_len = skip_range(ctx, buff - text, rem_bytes, &next_skip,
+				&skip_at);
+			buff      += skip_len;
+			rem_bytes -= skip_len;
+			continue;
+		}
+
+		xed_decoded_inst_zero(&decoded_inst);
+		xed_decoded_inst_set_mode(&decoded_inst,
+			ctx->info.machine_mode, ctx->info.machine_address);
+
+		/* Decode instruction. */
+		xed_error =
+			xed_decode(&decoded_inst, buff, rem_bytes);
+
+		if (xed_error != XED_ERROR_NONE) {
+			if (with_stats)
+				stats->decode_errors++;
+			if (!decode_resync)
+			{
+				if (!(ctx->flags & FLG_NOABORT))
+					errx("Error decoding instruction at offset: %jd (%s)\n",
+						(buff - text), xed_error_enum_t2str(xed_error));
+
+				ctx->error     = xed_error;
+				ctx->error_off = buff - text;
+				break;
+			}
+
+			/* Skip up to the next function, and jump there. */
+			if (!decode_add_skip(ctx, next_skip, buff - text,
+				resync_next(ctx, buff - text) - (buff - text)))
+			{
+				errx("Unable to allocate memory!\n");
+			}
+			skip_at = buff - text;
+			continue;
+		}
+
+		inst_len = xed_decoded_inst_get_length(&decoded_inst);
+		ctx->total_inst_count++;
+		PROBE_DECODE(buff - text, inst_len);
+
+		if (with_stats)
+			stats->len_hist[inst_len]++;
+
+		/* Per-function report: advance to the current function. */
+		if (ctx->syms)
+		{
+			addr = ctx->info.elf_text_base_addr + (buff - text);
+			if (addr >= fn_next)
+				fn_cur = sym_lookup(ctx->syms, ctx->nsyms, addr, &fn_next);
+			ctx->fn_inst[fn_cur]++;
+		}
+
+		/* Check if instruction is eligible to read and/or patch. */
+		eligible = inst_channel(&decoded_inst, buff);
+		PROBE_ELIGIBLE(buff - text, buff, eligible);
+		if (!eligible)
+			goto skip;
+
+		nbits = inst_nbits(eligible, &decoded_inst);
+		ctx->patch_inst_count++;
+		ctx->capacity_bits += nbits;
+		if (ctx->syms)
+		{
+			ctx->fn_eligible[fn_cur]++;
+			ctx->fn_bits[fn_cur] += nbits;
+		}
+
+		iclass = XED_ICLASS_INVALID;
+		if (with_stats || ctx->ic_eligible)
+			iclass = xed_decoded_inst_get_iclass(&decoded_inst);
+		if (with_stats)
+			stats->eligible[iclass]++;
+		if (ctx->ic_eligible)
+			ctx->ic_eligible[iclass]++;
+
+		/* Read from the payload the bits to be written into the file. */
+		if (ctx->flags & FLG_WRITE)
+		{
+			value = 0;
+			for (i = 0; i < nbits; i++) {
+				if ((next_bit = read_next_bit(ctx)) < 0)
+					break;
+				value |= (uint64_t)next_bit << i;
+			}
+			if (!i)
+				break;
+
+			/* Payload ended in the middle: keep the remaining bits. */
+			if (i < nbits)
+				value |= inst_get_bits(eligible, &decoded_inst, buff) &
+					~((UINT64_C(1) << i) - 1);
+
+			ctx->written_bits += i;
+		}
+
+		if (ctx->flags & (FLG_WRITE|FLG_SCAN))
+		{
+			timed = with_stats &&
+				!(ctx->patch_inst_count & (STATS_PATCH_SAMPLE - 1));
+			if (timed)
+				stats_begin_wall(&t_patch);
+
+			patched = patch_inst(ctx->flags, buff, &decoded_inst, inst_len,
+				eligible, value);
+			PROBE_PATCH(buff - text, value, patched);
+
+			if (patched == 2) {
+				ctx->modified_inst_count++;
+				mark_dirty(ctx, buff - text, inst_len, &last_page);
+			}
+
+			if (timed)
+				stats_end_wall(&t_patch, PH_PATCH, STATS_PATCH_SAMPLE);
+			if (with_stats)
+				stats->patched[iclass] += (patched == 2);
+		}
+
+		else if (ctx->flags & FLG_READ) {
+			if (!write_next_bits(ctx, eligible, &decoded_inst, buff))
+				break;
+		}
+
+	skip:
+		/* Update pointers. */
+		buff      += inst_len;
+		rem_bytes -= inst_len;
+	}
+
+	if (with_stats) {
+		stats->decoded_inst += ctx->total_inst_count;
+		stats->text_bytes   += buff - text;
+	}
+
+	ctx->next_bit = next_bit;
+}
+
+/**
+ * @brief For an already parsed ELF file, read its entire .text
+ * section and decodes all instruction. Its behavior depends
+ * on the current mode.
+ * If:
+ *   FLG_SCAN:  Only decodes the instructions and checks for
+ *              instructions candidates to patch.
+ *   FLG_WRITE: Reads from the payload source and write to the
+ *              output ELF file.
+ *   FLG_READ:  Reads from the input ELF file and write to the
+ *              payload destination the (already saved) bits.
+ *
+ * Decode errors (without --resync) abort, unless FLG_NOABORT
+ * is set: then the decoding stops and the error is saved in
+ * @p ctx.
+ *
+ * @param ctx Decoding context.
+ *
+ * @return Returns 1 if success, 0 if stopped by a decode error.
+ */
+int decode_instructions(struct decode_ctx *ctx)
+{
+	struct stats_timer t;
+
+	if (!stats)
+		decode_loop(ctx, 0);
+	else {
+		stats_begin(&t);
+		decode_loop(ctx, 1);
+		stats_end(&t, PH_DECODE);
+	}
+	return (ctx->error == XED_ERROR_NONE);
+}
+
+/**
+ * @brief Deallocates the resources allocated while decoding
+ * (skip map and resynchronization points).
+ *
+ * @param ctx Decoding context.
+ */
+void decode_release(struct decode_ctx *ctx)
+{
+	free(ctx->skips);
+	free(ctx->resync);
+	ctx->skips        = NULL;
+	ctx->resync       = NULL;
+	ctx->nskips       = 0;
+	ctx->cap_skips    = 0;
+	ctx->nresync      = 0;
+	ctx->resync_ready = 0;
+}
+
+/**
+ * @brief Read mode over a chunk of .text that is not mapped in
+ * memory (e.g.: fetched from another process): decodes all the
+ * complete instructions in @p buff and extracts their bits.
+ *
+ * @param ctx  Decoding context (FLG_READ).
+ * @param buff Chunk buffer.
+ * @param len  Chunk length.
+ * @param off  Offset of the chunk, relative to the .text start.
+ * @param last Whether this is the last chunk of .text.
+ * @param used Returned amount of bytes consumed. The remaining
+ *             bytes (an incomplete instruction) must be at the
+ *             start of the next chunk.
+ *
+ * Undecodable bytes are handled as in @ref decode_instructions:
+ * with --resync, they are added to the skip map and skipped up
+ * to the next function start, even if it is in a later chunk.
+ *
+ * @return Returns 1 if more bytes are expected, 0 if the reading
+ * should stop.
+ */
+int decode_read_chunk(struct decode_ctx *ctx, const uint8_t *buff,
+	size_t len, uint64_t off, int last, size_t *used)
+{
+	const struct decode_skip *s;
+	xed_error_enum_t   xed_error;
+	xed_decoded_inst_t decoded_inst;
+	unsigned inst_len;
+	unsigned chan;
+	uint64_t skip_at, skip_len;
+	size_t   pos, idx;
+
+	/* First skip map range that ends after the chunk start. */
+	for (idx = 0; idx < ctx->nskips &&
+		ctx->skips[idx].off + ctx->skips[idx].len <= off; idx++);
+	skip_at = (idx < ctx->nskips) ? ctx->skips[idx].off : UINT64_MAX;
+
+	for (pos = 0; pos < len; pos += inst_len)
+	{
+		/* Known undecodable range: jump over it. */
+		if (off + pos >= skip_at)
+		{
+			s = &ctx->skips[idx];
+			if (off + pos == s->off)
+				ctx->decode_errors++;
+
+			skip_len = s->off + s->len - (off + pos);
+			if (skip_len > len - pos) {
+				ctx->skipped_bytes += len - pos;
+				pos = len;
+				break;
+			}
+
+			ctx->skipped_bytes += skip_len;
+			pos += skip_len;
+			idx++;
+			skip_at  = (idx < ctx->nskips) ? ctx->skips[idx].off : UINT64_MAX;
+			inst_len = 0;
+			continue;
+		}
+
+		xed_decoded_inst_zero(&decoded_inst);
+		xed_decoded_inst_set_mode(&decoded_inst,
+			ctx->info.machine_mode, ctx->info.machine_address);
+
+		xed_error = xed_decode(&decoded_inst, buff + pos, len - pos);
+		if (xed_error != XED_ERROR_NONE)
+		{
+			/* Maybe incomplete, wait for the next chunk. */
+			if (!last && len - pos < XED_MAX_INSTRUCTION_BYTES)
+				break;
+
+			if (!decode_resync)
+				errx("Error decoding instruction at offset: %jd (%s)\n",
+					(intmax_t)(off + pos), xed_error_enum_t2str(xed_error));
+
+			/* Skip up to the next function, and jump there. */
+			if (!decode_add_skip(ctx, idx, off + pos,
+				resync_next(ctx, off + pos) - (off + pos)))
+			{
+				errx("Unable to allocate memory!\n");
+			}
+			skip_at  = off + pos;
+			inst_len = 0;
+			continue;
+		}
+
+		inst_len = xed_decoded_inst_get_length(&decoded_inst);
+		ctx->total_inst_count++;
+
+		if (!(chan = inst_channel(&decoded_inst, buff + pos)))
+			continue;
+
+		ctx->patch_inst_count++;
+		ctx->capacity_bits += inst_nbits(chan, &decoded_inst);
+		if (!write_next_bits(ctx, chan, &decoded_inst, buff + pos)) {
+			*used = pos + inst_len;
+			return (0);
+		}
+	}
+
+	*used = pos;
+	return (1);
+}
+
+/**
+ * @brief Decodes @p len bytes of the .text section, starting
+ * at the .text offset @p off, and counts how many bits the
+ * eligible instructions can hold. Decoding stops at the first
+ * invalid instruction.
+ *
+ * @param info  ELF file info structure.
+ * @param off   Offset (relative to the .text start).
+ * @param len   Amount of bytes to be decoded.
+ * @param ninst Returned amount of decoded instructions (optional).
+ *
+ * @return Returns the amount of bits available.
+ */
+size_t decode_count_range(const struct elf_file_info *info,
+	uint64_t off, uint64_t len, size_t *ninst)
+{
+	const uint8_t *buff;
+	size_t   eligible;
+	size_t   count;
+	unsigned inst_len;
+	unsigned chan;
+	xed_decoded_inst_t decoded_inst;
+
+	buff     = info->file_buff + info->elf_file_off + off;
+	eligible = 0;
+	count    = 0;
+
+	while (len)
+	{
+		xed_decoded_inst_zero(&decoded_inst);
+		xed_decoded_inst_set_mode(&decoded_inst,
+			info->machine_mode, info->machine_address);
+
+		if (xed_decode(&decoded_inst, buff, len) != XED_ERROR_NONE)
+			break;
+
+		inst_len = xed_decoded_inst_get_length(&decoded_inst);
+		if ((chan = inst_channel(&decoded_inst, buff)))
+			eligible += inst_nbits(chan, &decoded_inst);
+		count++;
+
+		buff += inst_len;
+		len  -= inst_len;
+	}
+
+	if (ninst)
+		*ninst = count;
+	return (eligible);
+}
+
+/**
+ * @brief Prints the scan or write summary of an already
+ * decoded context.
+ *
+ * @param ctx Decoding context.
+ */
+void decode_print_summary(const struct decode_ctx *ctx)
+{
+	if (ctx->flags & FLG_SCAN) {
+		printf(
+			"Scan summary:\n"
+			"%zu bytes available "
+			"(%zu inst patcheables, out of %zu (~%zu %%))\n",
+			ctx->capacity_bits/8, ctx->patch_inst_count,
+			ctx->total_inst_count,
+			ctx->total_inst_count ?
+				(ctx->patch_inst_count*100)/ctx->total_inst_count : 0);
+	}
+
+	if (ctx->flags & FLG_WRITE) {
+		printf(
+			"Write summary:\n"
+			"Wrote %zu bits (%zu bytes)\n"
+			"Modified %zu instructions in %zu pages\n",
+			ctx->written_bits, ctx->written_bits/8,
+			ctx->modified_inst_count, ctx->dirty_pages);
+
+		if (ctx->next_bit >= 0)
+			printf(
+				"WARNING: Entire input was not written!\n"
+				"Please check the max amnt of bytes available to write!\n");
+	}
+
+	if (!ctx->decode_errors)
+		return;
+
+	/* Read mode: stdout holds the payload. */
+	fprintf((ctx->flags & FLG_READ) ? stderr : stdout,
+		"Decode errors: %zu (%" PRIu64 " bytes skipped)\n",
+		ctx->decode_errors, ctx->skipped_bytes);
+}
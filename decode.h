@@ -0,0 +1,165 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+	#include <stdint.h>
+	#include <stddef.h>
+	#include <xed/xed-interface.h>
+
+	#include "elf.h"
+	#include "main.h"
+
+	/* Flags. */
+	#define FLG_SCAN  1
+	#define FLG_WRITE 2
+	#define FLG_READ  4
+
+	/*
+	 * Stop at the first decode error (without --resync) and
+	 * report it in the context, instead of aborting.
+	 */
+	#define FLG_NOABORT 8
+
+	/*
+	 * Channels: instruction classes that carry payload bits,
+	 * selected with --channels. Both sides (write and read) must
+	 * use the same set.
+	 */
+	#define CH_DBIT    0x01 /* ALU/MOV reg/reg direction bit.     */
+	#define CH_SIMD    0x02 /* SSE/AVX reg/reg moves, load/store. */
+	#define CH_VEX     0x04 /* VEX commutative sources order.     */
+	#define CH_SWAP    0x08 /* TEST/XCHG reg/reg registers order. */
+	#define CH_NOP     0x10 /* NOP padding displacement bytes.    */
+	#define CH_REXX    0x20 /* REX.X of reg/reg, extra bit.       */
+	#define CH_DEFAULT CH_DBIT
+
+	/* Undecodable .text range, skipped by --resync. */
+	struct decode_skip
+	{
+		uint64_t off; /* Relative to the .text start. */
+		uint64_t len;
+	};
+
+	/**
+	 * Decoding context: everything needed to scan, write or
+	 * read a single ELF file, so that several files can be
+	 * processed at the same time.
+	 */
+	struct decode_ctx
+	{
+		struct elf_file_info info;
+		unsigned flags;
+
+		/*
+		 * Payload I/O:
+		 * get_byte() returns the next byte to be written (or -1
+		 * on EOF), put_byte() handles a byte read from the file and
+		 * returns 0 if no more bytes are wanted.
+		 */
+		int  (*get_byte)(void *data);
+		int  (*put_byte)(void *data, int c);
+		void  *data;
+		uint64_t amnt_should_read; /* in bits, 0 = everything. */
+
+		/* Bit I/O state. */
+		int      bits;
+		int      bits_left;
+		unsigned curr_byte;
+		unsigned bits_amnt;
+
+		/*
+		 * Per-function report (optional):
+		 * if syms is set, fn_inst, fn_eligible (eligible
+		 * instructions) and fn_bits (eligible bits), all with
+		 * nsyms + 1 entries, the last one for everything outside
+		 * any function, are filled while decoding.
+		 */
+		const struct elf_sym *syms;
+		size_t  nsyms;
+		size_t *fn_inst;
+		size_t *fn_eligible;
+		size_t *fn_bits;
+
+		/*
+		 * Per-iclass counters (optional): if set, ic_eligible
+		 * (XED_ICLASS_LAST entries) counts the eligible
+		 * instructions of each iclass.
+		 */
+		size_t *ic_eligible;
+
+		/*
+		 * Skip map (--resync): undecodable ranges, sorted by
+		 * offset. Filled while decoding, or beforehand (e.g.:
+		 * from the scan cache), so that the ranges are jumped
+		 * over without being decoded again.
+		 */
+		struct decode_skip *skips;
+		size_t   nskips;
+		size_t   cap_skips;
+		uint64_t *resync;  /* Function starts (.text offsets). */
+		size_t   nresync;
+		int      resync_ready;
+
+		/* Results. */
+		size_t total_inst_count;
+		size_t patch_inst_count;    /* Eligible instructions. */
+		size_t modified_inst_count; /* Actually changed.      */
+		size_t dirty_pages;         /* Pages they touched.    */
+		size_t capacity_bits;       /* Bits they can hold.    */
+		size_t written_bits;
+		size_t decode_errors;       /* Skipped ranges.        */
+		uint64_t skipped_bytes;
+		int    next_bit;
+
+		/* Decode error that stopped the decoding (FLG_NOABORT). */
+		xed_error_enum_t error;
+		uint64_t error_off;
+	};
+
+	/* Enabled channels (CH_*), CH_DEFAULT if not changed. */
+	extern unsigned decode_channels;
+
+	/* Resynchronize on decode errors instead of aborting. */
+	extern int decode_resync;
+
+	extern unsigned decode_parse_channels(const char *list);
+	extern void decode_init(struct decode_ctx *ctx, unsigned flags);
+	extern int decode_instructions(struct decode_ctx *ctx);
+	extern void decode_release(struct decode_ctx *ctx);
+	extern int  decode_add_skip(struct decode_ctx *ctx, size_t idx,
+		uint64_t off, uint64_t len);
+	extern void decode_print_summary(const struct decode_ctx *ctx);
+	extern size_t decode_count_range(const struct elf_file_info *info,
+		uint64_t off, uint64_t len, size_t *ninst);
+	extern int decode_read_chunk(struct decode_ctx *ctx,
+		const uint8_t *buff, size_t len, uint64_t off, int last,
+		size_t *used);
+	extern int inst_is_eligible(const xed_decoded_inst_t *inst);
+	extern int inst_is_commutative(const xed_decoded_inst_t *inst);
+	extern size_t sym_lookup(const struct elf_sym *syms, size_t nsyms,
+		uint64_t addr, uint64_t *next);
+
+#endif /* DECODE_H */
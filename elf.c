@@ -22,105 +22,205 @@
  * SOFTWARE.
  */
 
+#include <elf.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-
-#include <libelf.h>
-#include <gelf.h>
 
 #include "elf.h"
+#include "io.h"
 
-/* Some data about the ELF file. */
-static Elf *elf;
-static int elf_fd;
-static Elf_Data *strtab_data;
+/* Section header, for both ELF32 and ELF64. */
+struct elf_shdr
+{
+	uint32_t name;
+	uint32_t type;
+	uint64_t addr;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t link;
+	uint64_t addralign;
+	uint64_t entsize;
+};
 
 /**
- * @brief Given a file, open the ELF file and initialize
- * its data structure.
+ * @brief Checks if the range [@p off, @p off + @p size) lies
+ * entirely inside the loaded file.
  *
- * @param file Path of the file to be opened, if any.
+ * @param info ELF file info structure.
+ * @param off  Start offset.
+ * @param size Range size.
  *
- * @return Returns 0 if success, -1 otherwise.
+ * @return Returns 1 if inside, 0 otherwise.
  */
-static int open_elf(const char *file)
+static inline int in_file(const struct elf_file_info *info,
+	uint64_t off, uint64_t size)
 {
-	Elf_Kind ek;
-
-	if ((elf_fd = open(file, O_RDONLY, 0)) < 0)
-		errto(out1, "Unable to open %s!\n", file);
+	return (off <= info->file_size && size <= info->file_size - off);
+}
 
-	if ((elf = elf_begin(elf_fd, ELF_C_READ, NULL)) == NULL)
-		errto(out2, "elf_begin() failed: %s\n", elf_errmsg(-1));
+/**
+ * @brief Reads the section header @p idx from the loaded file.
+ *
+ * @param info ELF file info structure (ELF header already parsed).
+ * @param idx  Section index.
+ * @param sh   Returned section header.
+ *
+ * @return Returns 1 if success, 0 if out of bounds.
+ */
+static int get_shdr(const struct elf_file_info *info, uint64_t idx,
+	struct elf_shdr *sh)
+{
+	uint64_t off;
+	Elf64_Shdr s64;
+	Elf32_Shdr s32;
 
-	ek = elf_kind(elf);
-	if (ek != ELF_K_ELF)
-		errto(out2, "File \"%s\" (fd: %d) is not an ELF file!\n", file, elf_fd);
+	if (idx >= info->elf_shnum)
+		return (0);
 
-	return (0);
-out2:
-	close(elf_fd);
-out1:
-	elf_end(elf);
-	return (-1);
+	off = info->elf_shoff + idx * info->elf_shentsize;
+	if (info->elf_class == 64) {
+		if (!in_file(info, off, sizeof(s64)))
+			return (0);
+		memcpy(&s64, info->file_buff + off, sizeof(s64));
+		sh->name      = s64.sh_name;
+		sh->type      = s64.sh_type;
+		sh->addr      = s64.sh_addr;
+		sh->offset    = s64.sh_offset;
+		sh->size      = s64.sh_size;
+		sh->link      = s64.sh_link;
+		sh->addralign = s64.sh_addralign;
+		sh->entsize   = s64.sh_entsize;
+	} else {
+		if (!in_file(info, off, sizeof(s32)))
+			return (0);
+		memcpy(&s32, info->file_buff + off, sizeof(s32));
+		sh->name      = s32.sh_name;
+		sh->type      = s32.sh_type;
+		sh->addr      = s32.sh_addr;
+		sh->offset    = s32.sh_offset;
+		sh->size      = s32.sh_size;
+		sh->link      = s32.sh_link;
+		sh->addralign = s32.sh_addralign;
+		sh->entsize   = s32.sh_entsize;
+	}
+	return (1);
 }
 
 /**
- * @brief Given an opened ELF file, closes all the
- * resources.
+ * @brief Gets the NUL-terminated string at offset @p off of the
+ * string table @p strtab.
+ *
+ * @param info   ELF file info structure.
+ * @param strtab String table section header.
+ * @param off    String offset.
+ *
+ * @return Returns the string (pointing into the loaded file),
+ * or NULL if out of bounds or not terminated.
  */
-static void close_elf(void)
+static const char *get_str(const struct elf_file_info *info,
+	const struct elf_shdr *strtab, uint64_t off)
 {
-	if (!elf)
-		return;
-	if (elf) {
-		elf_end(elf);
-		elf = NULL;
-	}
-	if (elf_fd > 0) {
-		close(elf_fd);
-		elf_fd = -1;
+	const char *str;
+
+	if (strtab->type != SHT_STRTAB || off >= strtab->size ||
+		!in_file(info, strtab->offset, strtab->size))
+	{
+		return (NULL);
 	}
+
+	str = (const char *)info->file_buff + strtab->offset + off;
+	if (!memchr(str, '\0', strtab->size - off))
+		return (NULL);
+	return (str);
 }
 
 /**
- * @brief Given a opened ELF file, find and load its strtab content.
+ * @brief Validates the ELF header of the loaded file and saves
+ * its machine type, class and section header table location.
  *
- * @param machine_type Save ELF machine type.
+ * @param info   ELF file info structure.
+ * @param strndx Returned section header string table index.
  *
  * @return Returns 1 if success, 0 otherwise.
  */
-static int load_strtab(int *machine_type)
+static int load_ehdr(struct elf_file_info *info, uint64_t *strndx)
 {
-	GElf_Ehdr ehdr;
-	GElf_Shdr shdr;
-	Elf_Scn *scn;
+	struct elf_shdr sh0;
+	Elf64_Ehdr eh64;
+	Elf32_Ehdr eh32;
+	uint16_t machine, shnum, shentsize;
+	uint8_t *ident;
+
+	ident = info->file_buff;
+	if (info->file_size < EI_NIDENT || memcmp(ident, ELFMAG, SELFMAG))
+		errto(out0, "File is not an ELF file!\n");
 
-	if ((gelf_getehdr(elf, &ehdr)) == NULL)
-		errto(out0, "Unable to load ELF header!\n");
+	if (ident[EI_DATA] != ELFDATA2LSB)
+		errto(out0, "Unsupported ELF data encoding!\n");
+
+	if (ident[EI_CLASS] == ELFCLASS64) {
+		if (!in_file(info, 0, sizeof(eh64)))
+			errto(out0, "Truncated ELF header!\n");
+		memcpy(&eh64, ident, sizeof(eh64));
+		machine         = eh64.e_machine;
+		info->elf_shoff = eh64.e_shoff;
+		shnum           = eh64.e_shnum;
+		shentsize       = eh64.e_shentsize;
+		*strndx         = eh64.e_shstrndx;
+		info->elf_class = 64;
+	}
+	else if (ident[EI_CLASS] == ELFCLASS32) {
+		if (!in_file(info, 0, sizeof(eh32)))
+			errto(out0, "Truncated ELF header!\n");
+		memcpy(&eh32, ident, sizeof(eh32));
+		machine         = eh32.e_machine;
+		info->elf_shoff = eh32.e_shoff;
+		shnum           = eh32.e_shnum;
+		shentsize       = eh32.e_shentsize;
+		*strndx         = eh32.e_shstrndx;
+		info->elf_class = 32;
+	}
+	else
+		errto(out0, "Unsupported ELF class!\n");
 
 	/* Validate machine. */
-	if (ehdr.e_machine != EM_386 && ehdr.e_machine != EM_X86_64)
+	if (machine != EM_386 && machine != EM_X86_64)
 		errto(out0, "Unsupported machine type!!!\n");
-	*machine_type = (ehdr.e_machine == EM_X86_64) ? 64 : 32;
+	info->elf_machine_type = (machine == EM_X86_64) ? 64 : 32;
 
-	scn = elf_getscn(elf, ehdr.e_shstrndx);
-	if (!scn)
-		errto(out0, "Unable to get string index!\n");
+	if (shentsize < ((info->elf_class == 64) ?
+		sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr)))
+	{
+		errto(out0, "Invalid section header size!\n");
+	}
+	info->elf_shentsize = shentsize;
 
-	gelf_getshdr(scn, &shdr);
-	if (shdr.sh_type != SHT_STRTAB)
-		errto(out0, "Unable to get string table!\n");
+	/*
+	 * With too many sections, the real count and the string table
+	 * index live in the first section header.
+	 */
+	if (!info->elf_shoff)
+		errto(out0, "No section header table!\n");
 
-	strtab_data = elf_getdata(scn, NULL);
-	if (!strtab_data)
-		errto(out0, "Unable to find strtab data!\n");
+	info->elf_shnum = shnum ? shnum : 1;
+	if (!shnum || *strndx == SHN_XINDEX) {
+		if (!get_shdr(info, 0, &sh0))
+			errto(out0, "Unable to read the section headers!\n");
+		if (!shnum)
+			info->elf_shnum = sh0.size;
+		if (*strndx == SHN_XINDEX)
+			*strndx = sh0.link;
+	}
+
+	if (info->elf_shnum > info->file_size ||
+		!in_file(info, info->elf_shoff, info->elf_shnum * shentsize))
+	{
+		errto(out0, "Invalid section header table!\n");
+	}
 
 	return (1);
 out0:
@@ -128,53 +228,261 @@ out0:
 }
 
 /**
- * @brief Find the ELF .text section and fill all the relevant
- * info needed for that section.
+ * @brief Parses the ELF file already loaded into @p info
+ * (file_buff/file_size) and fills the .text section info.
  *
- * @param addr   Returned .text start address.
- * @param f_off  Returned .text file offset.
- * @param s_size Returned .text size (in bytes).
+ * No data is copied: the section headers, string and symbol
+ * tables are read directly from the loaded file, with all the
+ * offsets checked against its size.
+ *
+ * @param info ELF file info structure.
  *
  * @return Returns 1 if success, 0 otherwise.
  */
-static int find_text_section(uint64_t *addr, uint64_t *f_off,
-	uint64_t *s_size)
+int parse_elf_text(struct elf_file_info *info)
 {
-	GElf_Shdr shdr;
-	Elf_Scn *scn;
-	char *sname;
+	struct elf_shdr shstr, sh;
+	const char *sname;
+	uint64_t strndx, i;
+
+	if (!load_ehdr(info, &strndx))
+		return (0);
 
-	scn = NULL;
-	while ((scn = elf_nextscn(elf, scn)) != NULL)
+	if (!get_shdr(info, strndx, &shstr) || shstr.type != SHT_STRTAB)
+		errto(out0, "Unable to get string table!\n");
+	info->elf_shstrndx = strndx;
+
+	for (i = 1; i < info->elf_shnum; i++)
 	{
-		/* Unable to get section header. */
-		if (gelf_getshdr(scn, &shdr) == NULL)
+		if (!get_shdr(info, i, &sh) || sh.type != SHT_PROGBITS)
 			continue;
 
-		if (shdr.sh_type != SHT_PROGBITS)
+		/* Check if we're at .text. */
+		sname = get_str(info, &shstr, sh.name);
+		if (!sname || strcmp(sname, ".text"))
 			continue;
 
-		/* Check if we're at .text. */
-		sname = (char*)strtab_data->d_buf + shdr.sh_name;
-		if (strcmp(sname, ".text"))
+		if (!in_file(info, sh.offset, sh.size))
+			errto(out0, "The .text section is out of the file!\n");
+
+		/* Symbols are checked against [addr, addr + size). */
+		if (sh.addr > UINT64_MAX - sh.size)
+			errto(out0, "Invalid .text address!\n");
+
+		info->elf_text_base_addr = sh.addr;
+		info->elf_file_off       = sh.offset;
+		info->elf_text_size      = sh.size;
+		return (1);
+	}
+
+	ERR("Unable to find the .text section!\n");
+out0:
+	return (0);
+}
+
+/**
+ * @brief Looks for the section named @p name in an already
+ * parsed ELF file.
+ *
+ * @param info ELF file info structure.
+ * @param name Section name.
+ * @param sh   Returned section header.
+ *
+ * @return Returns 1 if found (and inside the file), 0 otherwise.
+ */
+static int find_section(const struct elf_file_info *info,
+	const char *name, struct elf_shdr *sh)
+{
+	struct elf_shdr shstr;
+	const char *sname;
+	uint64_t i;
+
+	if (!get_shdr(info, info->elf_shstrndx, &shstr))
+		return (0);
+
+	for (i = 1; i < info->elf_shnum; i++)
+	{
+		if (!get_shdr(info, i, sh) || sh->type == SHT_NOBITS)
 			continue;
 
-		*addr   = shdr.sh_addr;
-		*f_off  = shdr.sh_offset;
-		*s_size = shdr.sh_size;
+		sname = get_str(info, &shstr, sh->name);
+		if (sname && !strcmp(sname, name))
+			return (in_file(info, sh->offset, sh->size));
+	}
+	return (0);
+}
+
+/**
+ * @brief Returns the size of a DWARF pointer encoded with
+ * @p enc (DW_EH_PE_*), or 0 if not supported.
+ *
+ * @param info ELF file info structure.
+ * @param enc  Pointer encoding.
+ *
+ * @return Returns the size, in bytes.
+ */
+static unsigned eh_enc_size(const struct elf_file_info *info, uint8_t enc)
+{
+	switch (enc & 0x0F)
+	{
+	case 0x00: /* absptr. */
+		return (info->elf_class / 8);
+	case 0x02: /* udata2. */
+	case 0x0A: /* sdata2. */
+		return (2);
+	case 0x03: /* udata4. */
+	case 0x0B: /* sdata4. */
+		return (4);
+	case 0x04: /* udata8. */
+	case 0x0C: /* sdata8. */
+		return (8);
+	}
+	return (0);
+}
+
+/**
+ * @brief Load the start address of every function described
+ * by the .eh_frame_hdr binary search table (i.e., the initial
+ * location of each FDE) that belongs to the .text section.
+ *
+ * Only the table encoding emitted by GNU ld, gold, lld and mold
+ * (datarel|sdata4) is supported; for anything else, no address
+ * is returned.
+ *
+ * @param info   ELF file info structure (already loaded).
+ * @param addrs  Returned address list (sorted), must be freed by
+ *               the caller.
+ * @param naddrs Returned amount of addresses.
+ *
+ * @return Returns 1 if success (even if no address is found),
+ * 0 otherwise.
+ */
+int load_fde_starts(const struct elf_file_info *info, uint64_t **addrs,
+	size_t *naddrs)
+{
+	struct elf_shdr sh;
+	const uint8_t *hdr;
+	uint64_t text_start, addr;
+	uint32_t count, i;
+	unsigned ptr_size;
+	size_t n;
+	int32_t loc;
+
+	*addrs  = NULL;
+	*naddrs = 0;
+
+	if (!find_section(info, ".eh_frame_hdr", &sh) || sh.size < 4)
+		return (1);
+
+	/* version, eh_frame_ptr_enc, fde_count_enc, table_enc. */
+	hdr = info->file_buff + sh.offset;
+	if (hdr[0] != 1 || hdr[2] != 0x03 || hdr[3] != 0x3B)
+		return (1);
+
+	ptr_size = (hdr[1] == 0xFF) ? 0 : eh_enc_size(info, hdr[1]);
+	if ((hdr[1] != 0xFF && !ptr_size) || sh.size < 8 + ptr_size)
+		return (1);
+
+	memcpy(&count, hdr + 4 + ptr_size, sizeof(count));
+	if (count > (sh.size - 8 - ptr_size) / 8)
 		return (1);
+
+	if (count && !(*addrs = malloc(count * sizeof(**addrs))))
+		return (0);
+
+	text_start = info->elf_text_base_addr;
+
+	for (i = 0, n = 0; i < count; i++)
+	{
+		memcpy(&loc, hdr + 8 + ptr_size + i * 8, sizeof(loc));
+		addr = sh.addr + (int64_t)loc;
+		if (addr >= text_start && addr - text_start < info->elf_text_size)
+			(*addrs)[n++] = addr;
+	}
+
+	*naddrs = n;
+	return (1);
+}
+
+/**
+ * @brief Checks if the first ELF_PROBE_SIZE bytes of a file,
+ * @p hdr, belong to an x86 or x86-64 ELF file, so that other
+ * files can be skipped without parsing them.
+ *
+ * @param hdr File header.
+ *
+ * @return Returns 1 if x86 ELF, 0 otherwise.
+ */
+int elf_is_x86(const uint8_t *hdr)
+{
+	return (!memcmp(hdr, ELFMAG, SELFMAG) &&
+		hdr[EI_DATA] == ELFDATA2LSB &&
+		(hdr[18] == EM_386 || hdr[18] == EM_X86_64) &&
+		hdr[19] == 0);
+}
+
+/**
+ * @brief Looks for the GNU build-id note (NT_GNU_BUILD_ID) of
+ * an already parsed ELF file.
+ *
+ * @param info ELF file info structure.
+ * @param id   Returned build-id (pointing into the loaded file).
+ * @param len  Returned build-id length, in bytes.
+ *
+ * @return Returns 1 if found, 0 otherwise.
+ */
+int elf_build_id(const struct elf_file_info *info, const uint8_t **id,
+	size_t *len)
+{
+	struct elf_shdr sh;
+	Elf32_Nhdr nh;
+	uint64_t idx, off, end, align;
+	uint64_t name_sz, desc_sz;
+
+	for (idx = 1; idx < info->elf_shnum; idx++)
+	{
+		if (!get_shdr(info, idx, &sh) || sh.type != SHT_NOTE ||
+			!in_file(info, sh.offset, sh.size))
+		{
+			continue;
+		}
+
+		align = (sh.addralign == 8) ? 8 : 4;
+		off   = sh.offset;
+		end   = sh.offset + sh.size;
+
+		while (end - off >= sizeof(nh))
+		{
+			memcpy(&nh, info->file_buff + off, sizeof(nh));
+			off    += sizeof(nh);
+			name_sz = (nh.n_namesz + align - 1) & ~(align - 1);
+			desc_sz = (nh.n_descsz + align - 1) & ~(align - 1);
+			if (name_sz > end - off || desc_sz > end - off - name_sz)
+				break;
+
+			if (nh.n_type == NT_GNU_BUILD_ID && nh.n_namesz == 4 &&
+				!memcmp(info->file_buff + off, "GNU", 4) && nh.n_descsz)
+			{
+				*id  = info->file_buff + off + name_sz;
+				*len = nh.n_descsz;
+				return (1);
+			}
+			off += name_sz + desc_sz;
+		}
 	}
 	return (0);
 }
 
 /**
- * @brief Open a given ELF file pointed by @p elf_file and fill
- * into @p info all the relevant information about that ELF file.
+ * @brief Open a given ELF file pointed by @p elf_file, loads it
+ * (read-only) and fill into @p info all the relevant information
+ * about that ELF file.
  *
  * @param elf_file ELF file path.
  * @param info     Structure elf_file_info.
  *
- * @return Returns 0 if success, -1 otherwise.
+ * @return Returns the (read-only) file descriptor of the
+ * opened file if success, -1 otherwise.
  */
 int open_and_load_elf_text(const char *elf_file,
 	struct elf_file_info *info)
@@ -182,33 +490,167 @@ int open_and_load_elf_text(const char *elf_file,
 	if (!elf_file)
 		return (-1);
 
-	if (elf_version(EV_CURRENT) == EV_NONE)
-		errx("Unable to initialize libelf\n");
+	if ((info->elf_fd = open(elf_file, O_RDONLY, 0)) < 0)
+		errto(out0, "Unable to open %s!\n", elf_file);
 
-	if (open_elf(elf_file) < 0)
-		return (-1);
+	info->rdwr = 0;
+	if (!io_load(info))
+		errto(out1, "Unable to load ELF file!\n");
+
+	if (!parse_elf_text(info))
+		goto out2;
 
-	if (!load_strtab(&info->elf_machine_type))
-		goto out0;
+	return (info->elf_fd);
+out2:
+	io_release(info);
+out1:
+	close(info->elf_fd);
+	info->elf_fd = -1;
+out0:
+	return (-1);
+}
 
-	if (!find_text_section(
-			&info->elf_text_base_addr,
-			&info->elf_file_off,
-			&info->elf_text_size))
+/**
+ * @brief Compare two symbols by address (and by size, the
+ * larger first), for qsort().
+ *
+ * @param a First symbol.
+ * @param b Second symbol.
+ *
+ * @return Returns a negative, zero or positive value if @p a
+ * goes before, together or after @p b.
+ */
+static int sym_cmp(const void *a, const void *b)
+{
+	const struct elf_sym *s1 = a;
+	const struct elf_sym *s2 = b;
+
+	if (s1->addr != s2->addr)
+		return (s1->addr < s2->addr ? -1 : 1);
+	if (s1->size != s2->size)
+		return (s1->size > s2->size ? -1 : 1);
+	return (0);
+}
+
+/**
+ * @brief Load all the function symbols (from .symtab and
+ * .dynsym) that belong to the .text section, sorted by address
+ * and without duplicates.
+ *
+ * @param info  ELF file info structure (already loaded).
+ * @param syms  Returned symbol list, must be freed by the caller.
+ * @param nsyms Returned amount of symbols.
+ *
+ * @return Returns 1 if success (even if no symbol is found),
+ * 0 otherwise.
+ */
+int load_func_symbols(struct elf_file_info *info,
+	struct elf_sym **syms, size_t *nsyms)
+{
+	struct elf_shdr sh, strtab;
+	struct elf_sym *list, *tmp;
+	size_t count, cap, j;
+	uint64_t text_start;
+	uint64_t text_end;
+	uint64_t idx, i, off;
+	uint64_t value, size;
+	uint32_t name;
+	uint8_t  type;
+	Elf64_Sym s64;
+	Elf32_Sym s32;
+
+	list  = NULL;
+	count = 0;
+	cap   = 0;
+	text_start = info->elf_text_base_addr;
+	text_end   = text_start + info->elf_text_size;
+
+	for (idx = 1; idx < info->elf_shnum; idx++)
+	{
+		if (!get_shdr(info, idx, &sh))
+			continue;
+
+		if (sh.type != SHT_SYMTAB && sh.type != SHT_DYNSYM)
+			continue;
+
+		if (sh.entsize < ((info->elf_class == 64) ?
+			sizeof(s64) : sizeof(s32)) ||
+			!in_file(info, sh.offset, sh.size) ||
+			!get_shdr(info, sh.link, &strtab))
+		{
+			continue;
+		}
+
+		for (i = 0; i < sh.size / sh.entsize; i++)
+		{
+			off = sh.offset + i * sh.entsize;
+			if (info->elf_class == 64) {
+				memcpy(&s64, info->file_buff + off, sizeof(s64));
+				name  = s64.st_name;
+				type  = ELF64_ST_TYPE(s64.st_info);
+				value = s64.st_value;
+				size  = s64.st_size;
+			} else {
+				memcpy(&s32, info->file_buff + off, sizeof(s32));
+				name  = s32.st_name;
+				type  = ELF32_ST_TYPE(s32.st_info);
+				value = s32.st_value;
+				size  = s32.st_size;
+			}
+
+			/* value + size may wrap, so compare against the rest. */
+			if (type != STT_FUNC || !size ||
+				value < text_start || value >= text_end ||
+				size > text_end - value)
+			{
+				continue;
+			}
+
+			if (count == cap) {
+				cap = cap ? cap * 2 : 1024;
+				if (!(tmp = realloc(list, cap * sizeof(*list))))
+					goto out0;
+				list = tmp;
+			}
+
+			list[count].addr = value;
+			list[count].size = size;
+			list[count].name = get_str(info, &strtab, name);
+			if (!list[count].name)
+				list[count].name = "";
+			count++;
+		}
+	}
+
+	/* Sort and remove duplicates (e.g.: same symbol in both tables). */
+	if (count)
 	{
-		goto out0;
+		qsort(list, count, sizeof(*list), sym_cmp);
+		for (i = 1, j = 0; i < count; i++)
+			if (list[i].addr != list[j].addr)
+				list[++j] = list[i];
+		count = j + 1;
 	}
 
-	return (elf_fd);
+	*syms  = list;
+	*nsyms = count;
+	return (1);
 out0:
-	close_elf();
+	free(list);
 	return (0);
 }
 
 /**
- * @brief Deallocates all the resources allocated to
- * handle the ELF file.
+ * @brief Deallocates all the resources allocated by
+ * open_and_load_elf_text().
+ *
+ * @param info ELF file info structure.
  */
-void unload_elf_text(void) {
-	close_elf();
+void unload_elf_text(struct elf_file_info *info)
+{
+	io_release(info);
+	if (info->elf_fd >= 0) {
+		close(info->elf_fd);
+		info->elf_fd = -1;
+	}
 }
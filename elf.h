@@ -27,9 +27,32 @@
 
 	#include "main.h"
 
+	/* Bytes needed by elf_is_x86(). */
+	#define ELF_PROBE_SIZE 20
+
+	/* Function symbol. */
+	struct elf_sym
+	{
+		uint64_t    addr;
+		uint64_t    size;
+		const char *name; /* Valid while the ELF file is loaded. */
+	};
+
+	extern int elf_is_x86(const uint8_t *hdr);
+	extern int parse_elf_text(struct elf_file_info *info);
+
 	extern int open_and_load_elf_text(const char *elf_file,
 		struct elf_file_info *info);
 
-	extern void unload_elf_text(void);
+	extern int load_func_symbols(struct elf_file_info *info,
+		struct elf_sym **syms, size_t *nsyms);
+
+	extern int load_fde_starts(const struct elf_file_info *info,
+		uint64_t **addrs, size_t *naddrs);
+
+	extern int elf_build_id(const struct elf_file_info *info,
+		const uint8_t **id, size_t *len);
+
+	extern void unload_elf_text(struct elf_file_info *info);
 
 #endif /* MYELF_H. */
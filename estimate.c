@@ -0,0 +1,164 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decode.h"
+#include "estimate.h"
+
+/**
+ * @brief xorshift64* pseudo-random number generator.
+ *
+ * @param state Generator state (must be non-zero).
+ *
+ * @return Returns the next random number.
+ */
+static inline uint64_t rand_next(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return (x * 0x2545F4914F6CDD1DULL);
+}
+
+/**
+ * @brief Estimates the capacity of an ELF file by decoding a
+ * random sample of its functions.
+ *
+ * Functions are sampled (without replacement) until the 95%
+ * confidence interval of the estimate is within +/- @p precision
+ * percent, or until all the functions are decoded. Each function
+ * is decoded from its start, so the decoder is always in sync.
+ *
+ * The capacity is computed with a ratio estimator (eligible
+ * bits per byte of function), scaled by the size of all
+ * functions. Gaps between functions are assumed to be padding,
+ * unless they are too large (e.g.: missing symbols), in which case
+ * the same ratio is also applied to them.
+ *
+ * @param info      ELF file info structure.
+ * @param syms      Function symbols, sorted by address.
+ * @param nsyms     Amount of symbols.
+ * @param precision Target relative precision, in percent.
+ * @param est       Returned estimate.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int estimate_capacity(const struct elf_file_info *info,
+	const struct elf_sym *syms, size_t nsyms, double precision,
+	struct estimate *est)
+{
+	double sum_e, sum_x, sum_ee, sum_xx, sum_ex;
+	double ratio, s2, x_mean, var, total;
+	uint64_t all_bytes, scale;
+	uint64_t seed;
+	size_t *idx, n, i, j, tmp;
+	double e, x;
+
+	if (!nsyms)
+		return (0);
+
+	if (!(idx = malloc(nsyms * sizeof(*idx))))
+		return (0);
+
+	all_bytes = 0;
+	for (i = 0; i < nsyms; i++) {
+		idx[i]     = i;
+		all_bytes += syms[i].size;
+	}
+
+	scale = all_bytes;
+	if (info->elf_text_size > all_bytes &&
+		(info->elf_text_size - all_bytes) * 100 >
+		info->elf_text_size * EST_MAX_GAP_PCT)
+	{
+		scale = info->elf_text_size;
+	}
+
+	seed = ((uint64_t)time(NULL) << 16) ^ getpid() ^ 0x9E3779B97F4A7C15ULL;
+
+	sum_e = sum_x = sum_ee = sum_xx = sum_ex = 0;
+	total = 0;
+	var   = 0;
+	est->sampled_bytes = 0;
+
+	for (n = 0; n < nsyms; )
+	{
+		/* Partial Fisher-Yates: pick a not yet sampled function. */
+		j      = n + rand_next(&seed) % (nsyms - n);
+		tmp    = idx[n];
+		idx[n] = idx[j];
+		idx[j] = tmp;
+
+		x = syms[idx[n]].size;
+		e = decode_count_range(info,
+			syms[idx[n]].addr - info->elf_text_base_addr,
+			syms[idx[n]].size, NULL);
+
+		sum_e  += e;
+		sum_x  += x;
+		sum_ee += e * e;
+		sum_xx += x * x;
+		sum_ex += e * x;
+		est->sampled_bytes += x;
+		n++;
+
+		if (n < EST_MIN_SAMPLES && n < nsyms)
+			continue;
+
+		/* Ratio estimator and its variance. */
+		ratio  = sum_e / sum_x;
+		total  = ratio * scale;
+		x_mean = sum_x / n;
+		s2     = 0;
+		if (n > 1)
+			s2 = (sum_ee - 2 * ratio * sum_ex + ratio * ratio * sum_xx) /
+				(n - 1);
+		if (s2 < 0)
+			s2 = 0;
+
+		var = (1.0 - (double)n / nsyms) * s2 / (n * x_mean * x_mean);
+		var = var * scale * scale;
+
+		if (EST_Z95 * sqrt(var) <= total * precision / 100.0)
+			break;
+	}
+
+	/* All functions were decoded: only the gaps are estimated. */
+	if (n == nsyms)
+		var = 0;
+
+	est->bytes      = total / 8;
+	est->half_width = EST_Z95 * sqrt(var) / 8;
+	est->sampled    = n;
+	est->nfuncs     = nsyms;
+
+	free(idx);
+	return (1);
+}
@@ -0,0 +1,56 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+	#include <stddef.h>
+	#include <stdint.h>
+
+	#include "elf.h"
+	#include "main.h"
+
+	/* Minimum amount of functions sampled before checking the CI. */
+	#define EST_MIN_SAMPLES 30
+
+	/* z-value for a 95% confidence interval. */
+	#define EST_Z95 1.96
+
+	/* Gaps between functions smaller than this (%) are padding. */
+	#define EST_MAX_GAP_PCT 10
+
+	struct estimate
+	{
+		double   bytes;         /* Estimated capacity, in bytes.  */
+		double   half_width;    /* 95% CI half-width, in bytes.   */
+		size_t   sampled;       /* Amount of sampled functions.   */
+		size_t   nfuncs;        /* Amount of functions.           */
+		uint64_t sampled_bytes; /* Amount of bytes decoded.       */
+	};
+
+	extern int estimate_capacity(const struct elf_file_info *info,
+		const struct elf_sym *syms, size_t nsyms, double precision,
+		struct estimate *est);
+
+#endif /* ESTIMATE_H */
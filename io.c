@@ -0,0 +1,587 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * File I/O backends:
+ * Loads the whole ELF file into info->file_buff, either by mapping
+ * it (mmap, populate) or by reading it into a buffer (pread,
+ * io_uring). For the read backends, the (patched) .text section is
+ * written back to the file by io_sync().
+ */
+
+#define _GNU_SOURCE /* MAP_POPULATE, MADV_HUGEPAGE. */
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#if defined(__has_include) && !defined(STELF_NO_URING)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_URING
+#endif
+#endif
+
+#include "io.h"
+#include "util.h"
+#include "main.h"
+
+#define IO_CHUNK (1 << 20) /* Read request size.     */
+#define IO_ALIGN 4096      /* Read buffer alignment. */
+#define IO_QD    8         /* io_uring reads in flight. */
+
+int io_backend = IO_MMAP;
+
+/* Backend names, for --io. */
+static const char *const io_names[] = {
+	"mmap", "populate", "pread", "uring"
+};
+
+/*
+ * Read buffer kept from the last released file, so that batch
+ * runs over many files do not allocate one buffer per file.
+ */
+static pthread_mutex_t spare_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *spare_buff;
+static size_t   spare_size;
+
+/* Throughput counters, for all files and threads. */
+static uint64_t io_files;
+static uint64_t io_bytes;
+static uint64_t io_nsecs;
+
+/**
+ * @brief Parses the backend name @p name.
+ *
+ * @param name Backend name: mmap, populate, pread or uring.
+ *
+ * @return Returns the backend (IO_*), or -1 if invalid.
+ */
+int io_parse_backend(const char *name)
+{
+	int i;
+	for (i = 0; i < (int)(sizeof(io_names)/sizeof(io_names[0])); i++)
+		if (!strcmp(name, io_names[i]))
+			return (i);
+	return (-1);
+}
+
+/**
+ * @brief Gets a read buffer of at least @p size bytes, aligned
+ * to IO_ALIGN, reusing the spare one if large enough.
+ *
+ * @param size Buffer size.
+ *
+ * @return Returns the buffer, or NULL if error.
+ */
+static uint8_t *buff_get(size_t size)
+{
+	uint8_t *buff;
+	void *ptr;
+
+	size = (size + IO_CHUNK - 1) & ~((size_t)IO_CHUNK - 1);
+
+	pthread_mutex_lock(&spare_mutex);
+	buff = spare_buff;
+	if (buff && spare_size >= size) {
+		spare_buff = NULL;
+		pthread_mutex_unlock(&spare_mutex);
+		return (buff);
+	}
+	pthread_mutex_unlock(&spare_mutex);
+
+	if (posix_memalign(&ptr, IO_ALIGN, size ? size : IO_ALIGN))
+		return (NULL);
+	return (ptr);
+}
+
+/**
+ * @brief Releases the read buffer @p buff (of a file with
+ * @p size bytes), keeping it as the spare buffer if larger
+ * than the current one.
+ *
+ * @param buff Buffer.
+ * @param size File size.
+ */
+static void buff_put(uint8_t *buff, size_t size)
+{
+	size = (size + IO_CHUNK - 1) & ~((size_t)IO_CHUNK - 1);
+
+	pthread_mutex_lock(&spare_mutex);
+	if (!spare_buff || spare_size < size) {
+		free(spare_buff);
+		spare_buff = buff;
+		spare_size = size;
+		buff = NULL;
+	}
+	pthread_mutex_unlock(&spare_mutex);
+	free(buff);
+}
+
+/**
+ * @brief Maps the file (IO_MMAP and IO_POPULATE). With
+ * IO_POPULATE, all pages are faulted in at once and the
+ * kernel is advised about the sequential access.
+ *
+ * @param info ELF file info structure.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int load_mmap(struct elf_file_info *info)
+{
+	int prot;
+	int flag;
+
+	prot = (info->rdwr) ? PROT_READ|PROT_WRITE : PROT_READ;
+	flag = (info->rdwr) ? MAP_SHARED : MAP_PRIVATE;
+
+	if (info->io == IO_POPULATE)
+		flag |= MAP_POPULATE;
+
+	info->file_buff = mmap(0, info->file_size, prot, flag, info->elf_fd, 0);
+	if (info->file_buff == MAP_FAILED) {
+		info->file_buff = NULL;
+		return (0);
+	}
+
+	/* Just hints, errors do not matter. */
+	if (info->io == IO_POPULATE) {
+		madvise(info->file_buff, info->file_size, MADV_SEQUENTIAL);
+		madvise(info->file_buff, info->file_size, MADV_HUGEPAGE);
+	}
+	return (1);
+}
+
+/**
+ * @brief Reads @p len bytes of the file @p fd, starting at
+ * @p off, into @p buff, in IO_CHUNK requests.
+ *
+ * @param fd   File descriptor.
+ * @param buff Destination buffer.
+ * @param off  File offset.
+ * @param len  Amount of bytes.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int read_pread(int fd, uint8_t *buff, size_t off, size_t len)
+{
+	ssize_t r;
+
+	while (len)
+	{
+		r = pread(fd, buff + off, len < IO_CHUNK ? len : IO_CHUNK, off);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return (0);
+		off += r;
+		len -= r;
+	}
+	return (1);
+}
+
+#ifdef HAVE_URING
+/* io_uring instance, with its mapped rings. */
+struct uring
+{
+	int       fd;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void  *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+};
+
+/**
+ * @brief Releases the io_uring instance @p r.
+ *
+ * @param r io_uring instance.
+ */
+static void uring_close(struct uring *r)
+{
+	if (r->sqes && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_size);
+	if (r->sq_ptr && r->sq_ptr != MAP_FAILED)
+		munmap(r->sq_ptr, r->sq_size);
+	close(r->fd);
+}
+
+/**
+ * @brief Creates an io_uring instance with IO_QD entries and
+ * maps its rings, without liburing.
+ *
+ * @param r io_uring instance.
+ *
+ * @return Returns 1 if success, 0 otherwise (e.g.: io_uring
+ * not supported or not allowed).
+ */
+static int uring_open(struct uring *r)
+{
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+
+	r->fd = syscall(__NR_io_uring_setup, IO_QD, &p);
+	if (r->fd < 0)
+		return (0);
+
+	r->sq_size   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size   = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_size > r->sq_size)
+			r->sq_size = r->cq_size;
+		r->cq_size = r->sq_size;
+	}
+
+	r->sq_ptr = mmap(0, r->sq_size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED)
+		goto out0;
+
+	r->cq_ptr = r->sq_ptr;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		r->cq_ptr = mmap(0, r->cq_size, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED)
+			goto out0;
+	}
+
+	r->sqes = mmap(0, r->sqes_size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto out0;
+
+	sq = r->sq_ptr;
+	cq = r->cq_ptr;
+	r->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->cq_head  = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return (1);
+out0:
+	uring_close(r);
+	return (0);
+}
+
+/**
+ * @brief Reads the first @p len bytes of the file @p fd into
+ * @p buff with io_uring, keeping up to IO_QD IO_CHUNK requests
+ * in flight. Short reads are completed with pread().
+ *
+ * @param fd   File descriptor.
+ * @param buff Destination buffer.
+ * @param len  Amount of bytes.
+ *
+ * @return Returns 1 if success, 0 otherwise (in which case
+ * the caller should fall back to pread()).
+ */
+static int read_uring(int fd, uint8_t *buff, size_t len)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned tail, head, idx;
+	unsigned inflight, submit;
+	size_t off, done, req;
+	struct uring r;
+	long n;
+	int ret;
+
+	if (!uring_open(&r))
+		return (0);
+
+	off      = 0;
+	done     = 0;
+	inflight = 0;
+	submit   = 0;
+	ret      = 0;
+
+	while (done < len)
+	{
+		/* Queue new reads. */
+		tail = *r.sq_tail;
+		while (inflight < IO_QD && off < len)
+		{
+			idx = tail & *r.sq_mask;
+			sqe = &r.sqes[idx];
+			memset(sqe, 0, sizeof(*sqe));
+			req            = (len - off < IO_CHUNK) ? len - off : IO_CHUNK;
+			sqe->opcode    = IORING_OP_READ;
+			sqe->fd        = fd;
+			sqe->addr      = (uintptr_t)(buff + off);
+			sqe->len       = req;
+			sqe->off       = off;
+			sqe->user_data = off;
+			r.sq_array[idx] = idx;
+
+			tail++;
+			off += req;
+			inflight++;
+			submit++;
+		}
+		__atomic_store_n(r.sq_tail, tail, __ATOMIC_RELEASE);
+
+		n = syscall(__NR_io_uring_enter, r.fd, submit, 1,
+			IORING_ENTER_GETEVENTS, NULL, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			goto out;
+		}
+		submit -= n;
+
+		/* Reap completions. */
+		head = *r.cq_head;
+		while (head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE))
+		{
+			cqe = &r.cqes[head & *r.cq_mask];
+			if (cqe->res < 0)
+				goto out;
+
+			req = (len - cqe->user_data < IO_CHUNK) ?
+				len - cqe->user_data : IO_CHUNK;
+
+			if ((size_t)cqe->res < req &&
+				!read_pread(fd, buff, cqe->user_data + cqe->res,
+					req - cqe->res))
+			{
+				goto out;
+			}
+
+			done += req;
+			inflight--;
+			head++;
+		}
+		__atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+	}
+	ret = 1;
+out:
+	uring_close(&r);
+	return (ret);
+}
+#endif /* HAVE_URING */
+
+/**
+ * @brief Reads the whole file into an aligned buffer (IO_PREAD
+ * and IO_URING). If io_uring is not available, pread() is used
+ * instead.
+ *
+ * @param info ELF file info structure.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int load_read(struct elf_file_info *info)
+{
+	if (!(info->file_buff = buff_get(info->file_size)))
+		return (0);
+
+	/* Only the modified pages are written back. */
+	info->dirty = NULL;
+	if (info->rdwr &&
+		!(info->dirty = calloc(info->file_size / IO_PAGE / 8 + 1, 1)))
+	{
+		goto out0;
+	}
+
+#ifdef HAVE_URING
+	if (info->io == IO_URING &&
+		read_uring(info->elf_fd, info->file_buff, info->file_size))
+	{
+		return (1);
+	}
+#endif
+
+	if (read_pread(info->elf_fd, info->file_buff, 0, info->file_size))
+		return (1);
+
+	free(info->dirty);
+	info->dirty = NULL;
+out0:
+	buff_put(info->file_buff, info->file_size);
+	info->file_buff = NULL;
+	return (0);
+}
+
+/**
+ * @brief Loads the contents of an already opened ELF file
+ * (info->elf_fd) into info->file_buff, with the current backend.
+ *
+ * @param info ELF file info structure.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int io_load(struct elf_file_info *info)
+{
+	struct stat st = {0};
+	double start;
+	int ret;
+
+	if (fstat(info->elf_fd, &st) < 0)
+		return (0);
+
+	start           = time_now();
+	info->file_size = st.st_size;
+	info->io        = io_backend;
+
+	if (info->io == IO_MMAP || info->io == IO_POPULATE)
+		ret = load_mmap(info);
+	else
+		ret = load_read(info);
+
+	if (ret) {
+		__atomic_fetch_add(&io_files, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&io_bytes, info->file_size, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&io_nsecs,
+			(uint64_t)((time_now() - start) * 1e9), __ATOMIC_RELAXED);
+	}
+	return (ret);
+}
+
+/**
+ * @brief Writes the range [@p off, @p off + @p len) of the
+ * loaded file back to the disk.
+ *
+ * @param info ELF file info structure.
+ * @param off  File offset.
+ * @param len  Range length.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int write_range(struct elf_file_info *info, uint64_t off,
+	uint64_t len)
+{
+	ssize_t w;
+
+	while (len)
+	{
+		w = pwrite(info->elf_fd, info->file_buff + off, len, off);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0) {
+			ERR("Unable to write back the .text section!\n");
+			return (0);
+		}
+		off += w;
+		len -= w;
+	}
+	return (1);
+}
+
+/**
+ * @brief Writes the changes of an ELF file opened as read/write
+ * back to the disk: msync() for the mmap backends, or writes the
+ * modified pages of the .text section back for the read backends.
+ *
+ * @param info ELF file info structure.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int io_sync(struct elf_file_info *info)
+{
+	uint64_t start, end;
+	uint64_t pg, last;
+	uint64_t lo, hi;
+
+	if (!info->rdwr || !info->file_buff)
+		return (1);
+
+	if (info->io == IO_MMAP || info->io == IO_POPULATE)
+		return (!msync(info->file_buff, info->file_size, MS_SYNC));
+
+	/* Only .text is ever changed: write each run of dirty pages. */
+	start = info->elf_file_off;
+	end   = start + info->elf_text_size;
+	for (pg = start / IO_PAGE; pg * IO_PAGE < end; pg = last)
+	{
+		last = pg + 1;
+		if (!(info->dirty[pg / 8] & (1 << (pg % 8))))
+			continue;
+
+		while (last * IO_PAGE < end &&
+			(info->dirty[last / 8] & (1 << (last % 8))))
+		{
+			last++;
+		}
+
+		lo = (pg * IO_PAGE > start) ? pg * IO_PAGE : start;
+		hi = (last * IO_PAGE < end) ? last * IO_PAGE : end;
+		if (!write_range(info, lo, hi - lo))
+			return (0);
+	}
+	return (!fdatasync(info->elf_fd));
+}
+
+/**
+ * @brief Releases the buffer (or mapping) of an ELF file loaded
+ * with @ref io_load.
+ *
+ * @param info ELF file info structure.
+ */
+void io_release(struct elf_file_info *info)
+{
+	if (!info->file_buff)
+		return;
+
+	if (info->io == IO_MMAP || info->io == IO_POPULATE)
+		munmap(info->file_buff, info->file_size);
+	else
+		buff_put(info->file_buff, info->file_size);
+
+	free(info->dirty);
+	info->dirty     = NULL;
+	info->file_buff = NULL;
+}
+
+/**
+ * @brief Prints to stderr the load throughput of all the files
+ * loaded so far, for the current backend.
+ *
+ * For the mmap backend, only the mapping is measured: the pages
+ * are faulted in later, while decoding.
+ */
+void io_print_summary(void)
+{
+	double secs = io_nsecs / 1e9;
+
+	fprintf(stderr, "I/O (%s): %" PRIu64 " files, %.2f MiB in %.3f s "
+		"(%.2f MiB/s)\n", io_names[io_backend], io_files,
+		io_bytes / (1024.0 * 1024.0), secs,
+		secs > 0 ? io_bytes / (1024.0 * 1024.0) / secs : 0);
+}
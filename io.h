@@ -0,0 +1,68 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef IO_H
+#define IO_H
+
+	#include <stdint.h>
+	#include "main.h"
+
+	/* File I/O backends. */
+	#define IO_MMAP     0 /* Plain mmap(), pages faulted on demand.  */
+	#define IO_POPULATE 1 /* mmap() + MAP_POPULATE + madvise().      */
+	#define IO_PREAD    2 /* Chunked pread() into an aligned buffer. */
+	#define IO_URING    3 /* io_uring, several reads in flight.      */
+
+	/* Page size used to track the modified (dirty) pages. */
+	#define IO_PAGE 4096
+
+	/**
+	 * @brief Marks the file range [@p off, @p off + @p len) as
+	 * modified, for the read backends. For the mmap backends, the
+	 * kernel already tracks the dirty pages.
+	 *
+	 * @param info ELF file info structure.
+	 * @param off  File offset.
+	 * @param len  Range length (non-zero).
+	 */
+	static inline void io_mark_dirty(struct elf_file_info *info,
+		uint64_t off, uint64_t len)
+	{
+		uint64_t pg;
+		if (!info->dirty)
+			return;
+		for (pg = off / IO_PAGE; pg <= (off + len - 1) / IO_PAGE; pg++)
+			info->dirty[pg / 8] |= 1 << (pg % 8);
+	}
+
+	/* Backend used for the next loaded files, IO_MMAP by default. */
+	extern int io_backend;
+
+	extern int  io_parse_backend(const char *name);
+	extern int  io_load(struct elf_file_info *info);
+	extern int  io_sync(struct elf_file_info *info);
+	extern void io_release(struct elf_file_info *info);
+	extern void io_print_summary(void);
+
+#endif /* IO_H */
@@ -0,0 +1,180 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE /* process_vm_readv(). */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/uio.h>
+#include <xed/xed-interface.h>
+
+#include "decode.h"
+#include "elf.h"
+#include "live.h"
+#include "util.h"
+#include "main.h"
+
+/**
+ * @brief Finds where the .text section of the main executable
+ * of @p pid is mapped, by looking for an executable mapping of
+ * the same file (device and inode) that covers the .text file
+ * offset.
+ *
+ * @param pid   Process ID.
+ * @param st    Executable file status.
+ * @param info  Parsed executable.
+ * @param addr  Returned .text address in the process.
+ * @param size  Returned amount of .text bytes mapped.
+ *
+ * @return Returns 1 if found, 0 otherwise.
+ */
+static int live_find_text(pid_t pid, const struct stat *st,
+	const struct elf_file_info *info, uint64_t *addr, uint64_t *size)
+{
+	char path[64];
+	char line[512];
+	char perms[8];
+	unsigned maj, min;
+	uint64_t start, end, off, ino;
+	FILE *f;
+	int found;
+
+	snprintf(path, sizeof path, "/proc/%d/maps", (int)pid);
+	if (!(f = fopen(path, "r")))
+		return (0);
+
+	found = 0;
+	while (!found && fgets(line, sizeof line, f))
+	{
+		if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %7s %" SCNx64 " %x:%x %"
+			SCNu64, &start, &end, perms, &off, &maj, &min, &ino) != 7)
+		{
+			continue;
+		}
+
+		if (perms[2] != 'x' || ino != (uint64_t)st->st_ino ||
+			maj != major(st->st_dev) || min != minor(st->st_dev))
+		{
+			continue;
+		}
+
+		/* off + (end - start) may wrap. */
+		if (end <= start || info->elf_file_off < off ||
+			info->elf_file_off - off >= end - start)
+		{
+			continue;
+		}
+
+		*addr = start + (info->elf_file_off - off);
+		*size = end - *addr;
+		if (*size > info->elf_text_size)
+			*size = info->elf_text_size;
+		found = 1;
+	}
+
+	fclose(f);
+	return (found);
+}
+
+/**
+ * @brief Live read mode: extracts the payload from the .text
+ * section of a running process, without reading its binary
+ * from the disk.
+ *
+ * Only the section headers are read, from /proc/<pid>/exe (which
+ * always refers to the running executable, even if the file
+ * was replaced or deleted); the code itself is fetched from the
+ * process memory in LIVE_CHUNK chunks with process_vm_readv(),
+ * until the payload ends.
+ *
+ * @param pid Process ID.
+ * @param ctx Decoding context (FLG_READ).
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int live_read(pid_t pid, struct decode_ctx *ctx)
+{
+	struct iovec local, remote;
+	struct stat st;
+	char     exe[64];
+	uint8_t *buff;
+	uint64_t addr, size, pos;
+	size_t   carry, used, n;
+	ssize_t  ret;
+	int      more;
+
+	snprintf(exe, sizeof exe, "/proc/%d/exe", (int)pid);
+	if (stat(exe, &st) < 0 || open_and_load_elf_text(exe, &ctx->info) < 0) {
+		ERR("Unable to load the executable of pid %d!\n", (int)pid);
+		return (0);
+	}
+	set_machine_mode(&ctx->info);
+
+	if (!live_find_text(pid, &st, &ctx->info, &addr, &size))
+		errto(out0, "Unable to find .text in the memory of pid %d!\n",
+			(int)pid);
+
+	if (size < ctx->info.elf_text_size)
+		ERR("WARNING: only %" PRIu64 " of %" PRIu64 " .text bytes are "
+			"mapped!\n", size, ctx->info.elf_text_size);
+
+	if (!(buff = malloc(LIVE_CHUNK + XED_MAX_INSTRUCTION_BYTES)))
+		errto(out0, "Unable to allocate memory!\n");
+
+	/* Fetch and decode, chunk by chunk. */
+	carry = 0;
+	more  = 1;
+	for (pos = 0; more && pos < size; pos += n)
+	{
+		n = (size - pos < LIVE_CHUNK) ? size - pos : LIVE_CHUNK;
+
+		local.iov_base  = buff + carry;
+		local.iov_len   = n;
+		remote.iov_base = (void *)(uintptr_t)(addr + pos);
+		remote.iov_len  = n;
+
+		ret = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+		if (ret != (ssize_t)n)
+			errto(out1, "Unable to read the memory of pid %d!\n", (int)pid);
+
+		more = decode_read_chunk(ctx, buff, carry + n, pos - carry,
+			pos + n == size, &used);
+
+		carry = carry + n - used;
+		memmove(buff, buff + used, carry);
+	}
+
+	free(buff);
+	unload_elf_text(&ctx->info);
+	return (1);
+
+out1:
+	free(buff);
+out0:
+	unload_elf_text(&ctx->info);
+	return (0);
+}
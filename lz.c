@@ -0,0 +1,312 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "lz.h"
+
+/* Decompressor states. */
+#define LZ_ST_LEN0   0
+#define LZ_ST_LEN1   1
+#define LZ_ST_CTRL   2
+#define LZ_ST_LIT    3
+#define LZ_ST_MATCH0 4
+#define LZ_ST_MATCH1 5
+#define LZ_ST_END    6
+
+/**
+ * @brief Hashes the next 3 bytes pointed by @p p.
+ *
+ * @param p Buffer with at least 3 bytes.
+ *
+ * @return Returns the hash value.
+ */
+static inline unsigned lz_hash(const uint8_t *p)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return ((v * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+/**
+ * @brief Adds the position @p pos of the window into the hash
+ * chains.
+ *
+ * @param enc Compressor context.
+ * @param pos Position (inside enc->win) to be added.
+ */
+static inline void lz_insert(struct lz_enc *enc, size_t pos)
+{
+	unsigned h = lz_hash(enc->win + pos);
+	enc->prev[pos] = enc->head[h];
+	enc->head[h]   = (int32_t)pos;
+}
+
+/**
+ * @brief Initializes the compressor context.
+ *
+ * @param enc Compressor context.
+ */
+void lz_enc_init(struct lz_enc *enc)
+{
+	enc->hist = 0;
+}
+
+/**
+ * @brief Compress a single block of @p len bytes pointed by @p src
+ * into @p dst.
+ *
+ * The output is a 2-byte (little-endian) block length followed by
+ * the LZSS-encoded data. Matches may reference the last
+ * LZ_WIN_SIZE bytes of the previous blocks, so the blocks must be
+ * decompressed in the same order they were compressed.
+ *
+ * @param enc Compressor context.
+ * @param src Input buffer.
+ * @param len Input length, must be between 1 and LZ_BLOCK_SIZE.
+ * @param dst Output buffer, at least LZ_MAX_BLOCK_OUT bytes long.
+ *
+ * @return Returns the amount of bytes written into @p dst.
+ */
+size_t lz_compress_block(struct lz_enc *enc,
+	const uint8_t *src, size_t len, uint8_t *dst)
+{
+	size_t pos, end, i;
+	size_t ctrl_pos;
+	size_t out;
+	unsigned ctrl_bit;
+
+	/* Append block after the history and rebuild the chains. */
+	memcpy(enc->win + enc->hist, src, len);
+	memset(enc->head, 0xFF, sizeof(enc->head));
+	for (i = 0; i + LZ_MIN_MATCH <= enc->hist; i++)
+		lz_insert(enc, i);
+
+	dst[0] = len & 0xFF;
+	dst[1] = (len >> 8) & 0xFF;
+	out    = 2;
+
+	pos      = enc->hist;
+	end      = enc->hist + len;
+	ctrl_pos = 0;
+	ctrl_bit = 8;
+
+	while (pos < end)
+	{
+		size_t best_len  = 0;
+		size_t best_dist = 0;
+
+		/* New control byte. */
+		if (ctrl_bit == 8) {
+			ctrl_pos      = out++;
+			dst[ctrl_pos] = 0;
+			ctrl_bit      = 0;
+		}
+
+		/* Look for the longest match in the hash chain. */
+		if (end - pos >= LZ_MIN_MATCH)
+		{
+			size_t max_len = end - pos;
+			int32_t cand;
+			unsigned chain;
+
+			if (max_len > LZ_MAX_MATCH)
+				max_len = LZ_MAX_MATCH;
+
+			cand = enc->head[lz_hash(enc->win + pos)];
+			for (chain = 0; cand >= 0 && chain < LZ_MAX_CHAIN; chain++)
+			{
+				size_t l;
+				if (pos - (size_t)cand > LZ_WIN_SIZE)
+					break;
+
+				for (l = 0; l < max_len && enc->win[cand + l] ==
+					enc->win[pos + l]; l++);
+
+				if (l > best_len) {
+					best_len  = l;
+					best_dist = pos - cand;
+					if (l == max_len)
+						break;
+				}
+				cand = enc->prev[cand];
+			}
+		}
+
+		if (best_len >= LZ_MIN_MATCH)
+		{
+			dst[ctrl_pos] |= 1 << ctrl_bit;
+			dst[out++] = (best_dist - 1) & 0xFF;
+			dst[out++] = (((best_dist - 1) >> 8) << 4) |
+				(best_len - LZ_MIN_MATCH);
+
+			for (i = 0; i < best_len; i++, pos++)
+				if (end - pos >= LZ_MIN_MATCH)
+					lz_insert(enc, pos);
+		}
+		else
+		{
+			dst[out++] = enc->win[pos];
+			if (end - pos >= LZ_MIN_MATCH)
+				lz_insert(enc, pos);
+			pos++;
+		}
+
+		ctrl_bit++;
+	}
+
+	/* Keep the last LZ_WIN_SIZE bytes as history for the next block. */
+	if (end > LZ_WIN_SIZE) {
+		memmove(enc->win, enc->win + end - LZ_WIN_SIZE, LZ_WIN_SIZE);
+		enc->hist = LZ_WIN_SIZE;
+	}
+	else
+		enc->hist = end;
+
+	return (out);
+}
+
+/**
+ * @brief Writes the end-of-stream marker (an empty block)
+ * into @p dst.
+ *
+ * @param dst Output buffer, at least 2 bytes long.
+ *
+ * @return Returns the amount of bytes written into @p dst.
+ */
+size_t lz_end_block(uint8_t *dst)
+{
+	dst[0] = 0;
+	dst[1] = 0;
+	return (2);
+}
+
+/**
+ * @brief Initializes the decompressor context.
+ *
+ * @param dec Decompressor context.
+ */
+void lz_dec_init(struct lz_dec *dec)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->state = LZ_ST_LEN0;
+}
+
+/**
+ * @brief Outputs a single decompressed byte and saves it
+ * into the history ring.
+ *
+ * @param dec Decompressor context.
+ * @param c   Byte to be written.
+ * @param out Output file.
+ */
+static inline void lz_emit(struct lz_dec *dec, int c, FILE *out)
+{
+	if (!dec->limit || dec->total < dec->limit)
+		putc(c, out);
+	dec->ring[dec->total & (LZ_WIN_SIZE - 1)] = c;
+	dec->total++;
+	dec->remaining--;
+}
+
+/**
+ * @brief Advances to the next item of the current control
+ * byte (or to the next block/control byte).
+ *
+ * @param dec Decompressor context.
+ */
+static inline void lz_next_item(struct lz_dec *dec)
+{
+	dec->ctrl >>= 1;
+	dec->ctrl_bits--;
+
+	if (!dec->remaining)
+		dec->state = LZ_ST_LEN0;
+	else if (!dec->ctrl_bits)
+		dec->state = LZ_ST_CTRL;
+	else
+		dec->state = (dec->ctrl & 1) ? LZ_ST_MATCH0 : LZ_ST_LIT;
+}
+
+/**
+ * @brief Feeds a single compressed byte @p c to the decompressor,
+ * writing to @p out all the bytes that became available.
+ *
+ * @param dec Decompressor context.
+ * @param c   Compressed byte.
+ * @param out Output file.
+ *
+ * @return Returns 1 if more bytes are expected, 0 if the
+ * end-of-stream marker was found and -1 if the stream is
+ * corrupted.
+ */
+int lz_dec_put(struct lz_dec *dec, int c, FILE *out)
+{
+	unsigned dist, len, i;
+
+	switch (dec->state)
+	{
+	case LZ_ST_LEN0:
+		dec->remaining = c;
+		dec->state     = LZ_ST_LEN1;
+		break;
+	case LZ_ST_LEN1:
+		dec->remaining |= c << 8;
+		if (!dec->remaining) {
+			dec->state = LZ_ST_END;
+			return (0);
+		}
+		if (dec->remaining > LZ_BLOCK_SIZE)
+			return (-1);
+		dec->state = LZ_ST_CTRL;
+		break;
+	case LZ_ST_CTRL:
+		dec->ctrl      = c;
+		dec->ctrl_bits = 8;
+		dec->state     = (c & 1) ? LZ_ST_MATCH0 : LZ_ST_LIT;
+		break;
+	case LZ_ST_LIT:
+		lz_emit(dec, c, out);
+		lz_next_item(dec);
+		break;
+	case LZ_ST_MATCH0:
+		dec->m0    = c;
+		dec->state = LZ_ST_MATCH1;
+		break;
+	case LZ_ST_MATCH1:
+		dist = (dec->m0 | ((c >> 4) << 8)) + 1;
+		len  = (c & 0xF) + LZ_MIN_MATCH;
+		if (dist > dec->total || len > dec->remaining)
+			return (-1);
+
+		for (i = 0; i < len; i++)
+			lz_emit(dec, dec->ring[(dec->total - dist) & (LZ_WIN_SIZE - 1)],
+				out);
+		lz_next_item(dec);
+		break;
+	case LZ_ST_END:
+		return (0);
+	}
+
+	return (1);
+}
@@ -0,0 +1,77 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+	#include <stdio.h>
+	#include <stdint.h>
+	#include <stddef.h>
+
+	/*
+	 * LZSS parameters:
+	 * A match is encoded in 2 bytes: 12-bit distance and 4-bit
+	 * length, so matches can reach up to 4 kB back and be
+	 * between 3 and 18 bytes long.
+	 */
+	#define LZ_WIN_SIZE   4096
+	#define LZ_MIN_MATCH  3
+	#define LZ_MAX_MATCH  (LZ_MIN_MATCH + 15)
+	#define LZ_BLOCK_SIZE 32768
+	#define LZ_HASH_BITS  13
+	#define LZ_HASH_SIZE  (1 << LZ_HASH_BITS)
+	#define LZ_MAX_CHAIN  32
+
+	/* Worst case for a compressed block: block len + 1 ctrl byte per 8. */
+	#define LZ_MAX_BLOCK_OUT (2 + LZ_BLOCK_SIZE + (LZ_BLOCK_SIZE + 7) / 8)
+
+	struct lz_enc
+	{
+		uint8_t win [LZ_WIN_SIZE + LZ_BLOCK_SIZE];
+		int32_t prev[LZ_WIN_SIZE + LZ_BLOCK_SIZE];
+		int32_t head[LZ_HASH_SIZE];
+		size_t  hist; /* Amount of history bytes in win. */
+	};
+
+	struct lz_dec
+	{
+		uint8_t  ring[LZ_WIN_SIZE];
+		uint64_t total;     /* Amount of bytes decompressed so far. */
+		unsigned remaining; /* Bytes left in the current block.     */
+		unsigned ctrl;
+		unsigned ctrl_bits;
+		unsigned m0;
+		int      state;
+		uint64_t limit;     /* Only output this many bytes (0 = all). */
+	};
+
+	extern void lz_enc_init(struct lz_enc *enc);
+	extern size_t lz_compress_block(struct lz_enc *enc,
+		const uint8_t *src, size_t len, uint8_t *dst);
+	extern size_t lz_end_block(uint8_t *dst);
+
+	extern void lz_dec_init(struct lz_dec *dec);
+	extern int lz_dec_put(struct lz_dec *dec, int c, FILE *out);
+
+#endif /* LZ_H */
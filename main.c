@@ -24,570 +24,817 @@
 
 #include <err.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <xed/xed-interface.h>
 
+#include "decode.h"
 #include "elf.h"
+#include "archive.h"
+#include "audit.h"
+#include "cache.h"
+#include "estimate.h"
+#include "io.h"
+#include "live.h"
 #include "util.h"
 #include "main.h"
-
-/*
- * Uncomment to enable DOUBLE_CHECK:
- * With this macro enabled, each patched instruction is checked aginst
- * the original to make sure it is exactly the same decoded instruction.
- *
- * This adds some overhead so its disabled by default.
- * Enabled it if you're not sure if the patching is behaving
- * correctly.
- */
-/* #define DOUBLE_CHECK. */
-
-#define OPC_BITD_MASK 0x2
+#include "perf.h"
+#include "report.h"
+#include "stats.h"
+#include "stream.h"
+#include "stripe.h"
+#include "verify.h"
+
+/* Long-only options. */
+#define OPT_STATS    256
+#define OPT_PERF     257
+#define OPT_VERIFY   258
+#define OPT_AUDIT    259
+#define OPT_CHANNELS 260
+#define OPT_IO       261
+#define OPT_CACHE    262
+#define OPT_KEY_FD   263
+#define OPT_TAR      264
+#define OPT_RESYNC   265
 
 /* Flags. */
-#define FLG_SCAN  1
-#define FLG_WRITE 2
-#define FLG_READ  4
 static unsigned flags = FLG_READ;
-static uint32_t amnt_should_read = 0; /* in bits. */
-
-/* Some data. */
-int machine_mode;
-int machine_address;
-
-static struct elf_file_info info;
+static uint64_t amnt_should_read = 0; /* in bits. */
+static unsigned stream_flags = 0;
+static int      nthreads = 0;
+static pid_t    live_pid = 0;
+static double   est_precision = 0; /* in %, 0 = disabled. */
+static int      est_compare = 0;
+static int      report_fmt  = 0;
+static int      report_sort = SORT_ELIGIBLE;
+static char    *stats_fmt;
+static int      use_perf = 0;
+static int      verify   = 0;
+static int      audit    = 0; /* 1 = fast, 2 = full. */
+static int      io_report = 0;
+static char    *cache_dir;
+static int      update = 0;
+static int      key_fd = -1;
+static uint8_t  key[33]; /* One extra byte, to detect longer keys. */
+static size_t   key_len;
+static int      tar = 0;
+
+static struct decode_ctx ctx;
+static struct stream stream;
 static char  *out_file;
 static char  *inp_file;
+static char  *manifest_file;
+static char **inp_files;
+static int    inp_count;
 
 /**
- * D-bit (direction bit) instructions table.
- *
- * Unfortunately I had to create this by hand, and
- * this is the only instructions that have D-bit
- * _and_ use ModRM _and_ use 2-set of registers.
+ * @brief Decoding context callback: returns the next byte
+ * of the payload stream pointed by @p data.
  *
- * If someone knows of a better way to do that,
- * I really appreciate.
+ * @param data Payload stream.
  *
- * Based on GDB's i386-opc.tbl table file.
+ * @return Returns the next byte, or -1 if EOF.
  */
-static xed_iclass_enum_t bitD_list[] = {
-	XED_ICLASS_MOV,
-	XED_ICLASS_ADD,
-	XED_ICLASS_SUB,
-	XED_ICLASS_SBB,
-	XED_ICLASS_CMP,
-	XED_ICLASS_AND,
-	XED_ICLASS_OR,
-	XED_ICLASS_XOR,
-	XED_ICLASS_ADC
-};
+static int stream_get_cb(void *data)
+{
+	return (stream_next_byte(data));
+}
 
 /**
- * @brief For a given decoded instruction, checks if the
- * provided instruction have the 'direction-bit'.
+ * @brief Decoding context callback: writes the byte @p c
+ * into the payload stream pointed by @p data.
  *
- * Since there is no pattern to identify whether a D-bit may
- * appear or not, this function just iterates over the
- * list above.
+ * @param data Payload stream.
+ * @param c    Byte read from the ELF file.
  *
- * @param inst Decoded instruction.
- *
- * @return Returns 1 if contains the 'D-bit' in the opcode,
- * 0 if not.
+ * @return Returns 1 if more bytes are expected, 0 otherwise.
  */
-static inline int inst_have_bitD(const xed_decoded_inst_t *inst)
+static int stream_put_cb(void *data, int c)
 {
-	xed_iclass_enum_t iclass;
-	size_t i;
-
-	iclass = xed_decoded_inst_get_iclass(inst);
-	for (i = 0; i < sizeof(bitD_list)/sizeof(bitD_list[0]); i++)
-		if (iclass == bitD_list[i])
-			return (1);
+	return (stream_put_byte(data, c));
+}
 
-	return (0);
+/**
+ * @brief Show program usage.
+ * @param prgname Program name.
+ */
+static void usage(const char *prgname)
+{
+	fprintf(stderr, "Usage: %s [options] elf_file\n", prgname);
+	fprintf(stderr,
+		"Options:\n"
+		"  -s \n"
+		"      Scan the elf_file and obtains the max amount of bytes available\n"
+		"      to add.\n"
+		"  -r <amnt>\n"
+		"      Reads amnt of bytes on the elf_file and outputs to stdout.\n"
+		"      If 0, read everything.\n"
+		"  -w \n"
+		"      Writes all the input (from stdin) into a copy of elf_file.\n"
+		"      (default to: \"out\", change with: -o)\n"
+		"  -u \n"
+		"      Writes all the input (from stdin) into elf_file itself, in\n"
+		"      place: only the instructions whose bits change are patched,\n"
+		"      and only the modified pages are written back.\n"
+		"  -o <output-file>\n"
+		"      Changes the default output file to the one specified.\n"
+		"  -z \n"
+		"      Compress the input before writing (with -w). Compressed\n"
+		"      payloads are decompressed transparently by -r.\n"
+		"  -l \n"
+		"      Store the payload length before writing (with -w), so that\n"
+		"      -r and -p stop as soon as the whole payload is read.\n"
+		"  -p <pid>\n"
+		"      Reads the payload from the memory of a running process\n"
+		"      (no elf_file needed), and outputs to stdout.\n"
+		"  -m <manifest>\n"
+		"      Stripe mode: with -w, splits the input among all the\n"
+		"      elf_files given, writes them into the directory set by -o\n"
+		"      and saves the stripes layout in <manifest>. With -r, reads\n"
+		"      back all the files listed in <manifest>.\n"
+		"  -j <threads>\n"
+		"      Amount of threads used in stripe mode (default: all CPUs).\n"
+		"  -e <pct>\n"
+		"      Estimate the amount of bytes available by decoding random\n"
+		"      functions until the 95%% confidence interval is within\n"
+		"      +/- pct %%. Much faster than -s on large files.\n"
+		"  -E \n"
+		"      Same as -e, but also do a full scan and compare the estimate\n"
+		"      against the exact amount (uses 5%% if -e is not given).\n"
+		"  -f <csv|json>\n"
+		"      Scan the elf_file and output a per-function capacity report.\n"
+		"  -k <eligible|density|size|addr|name>\n"
+		"      Sort key for the per-function report (default: eligible).\n"
+		"  --stats=json\n"
+		"      At exit, print to stderr the time spent in each phase, per\n"
+		"      iclass counters and other statistics (single-file mode).\n"
+		"  --perf\n"
+		"      Measure the decode/patch and the write-back (msync) phases\n"
+		"      with hardware performance counters (single-file mode).\n"
+		"  --verify\n"
+		"      After writing, check that every patched instruction decodes\n"
+		"      to the same instruction as the original (uses -j threads).\n"
+		"  --audit[=full]\n"
+		"      Look for ELF files (or directory trees) with mixed D-bit\n"
+		"      encodings and print one JSON line per file. The canonical\n"
+		"      direction of each iclass is the dominant one in the file\n"
+		"      (D=0 for GNU as/LLVM, D=1 for MSVC). Stops as soon as the\n"
+		"      verdict is certain, unless 'full' is given.\n"
+		"  --channels=<list>\n"
+		"      Comma-separated instruction classes that hold the payload:\n"
+		"      dbit (ALU/MOV reg/reg), simd (SSE/AVX reg/reg moves), vex\n"
+		"      (commutative VEX sources), swap (TEST/XCHG reg/reg), nop\n"
+		"      (NOP padding) and rexx (REX.X of any reg/reg instruction),\n"
+		"      or 'all'. Reading requires the same list (default: dbit).\n"
+		"  --io=<mmap|populate|pread|uring>\n"
+		"      How the ELF files are loaded: plain mmap (default), mmap with\n"
+		"      MAP_POPULATE, chunked pread or io_uring. The load throughput\n"
+		"      is printed to stderr at exit.\n"
+		"  --cache=<dir>\n"
+		"      Scan mode: reuse the results of files already scanned (same\n"
+		"      build-id, or same .text if none) from <dir>, and save the new\n"
+		"      ones there. Hits and misses are printed to stderr at exit.\n"
+		"  --key-fd=<fd>\n"
+		"      Encrypt (-w) or decrypt (-r, -p) the payload with AES-CTR,\n"
+		"      reading the raw key (16, 24 or 32 bytes, for AES-128/192/256)\n"
+		"      from the file descriptor <fd>, e.g.: --key-fd=3 3<key.bin\n"
+		"  --resync\n"
+		"      On undecodable bytes (e.g.: data inside .text), skip to the\n"
+		"      next function start (symbols or .eh_frame_hdr) instead of\n"
+		"      aborting. With --cache, the skipped ranges are saved by -s\n"
+		"      and reused by -w and -r. Both sides must use it.\n"
+		"  --tar\n"
+		"      Read a tar (or cpio 'newc') archive from stdin and scan (-s),\n"
+		"      read (-r, one file per member into the -o directory) or audit\n"
+		"      (--audit) each x86 ELF member, without unpacking it.\n"
+		"  -h \n"
+		"      This help\n\n");
+	fprintf(stderr,
+		"Examples:\n"
+		"  %s -r 123 my_elf > out_file\n"
+		"      Reads 123 bytes from my_elf into \"out_file\".\n"
+		"  %s -s my_elf\n"
+		"      Scan my_elf and returns the amount of bytes available to add.\n"
+		"  %s -w my_elf < input\n"
+		"      Write the contents of 'input' into \"out\" (default output file).\n"
+		"  %s -w my_elf -o my_new_elf < input\n"
+		"      Write the contents of 'input' into \"my_new_elf\".\n"
+		"  %s -w -z my_elf < input\n"
+		"      Compress and write the contents of 'input' into \"out\".\n"
+		"  %s -w -m manifest -o out_dir /usr/lib/*.so < input\n"
+		"      Stripe 'input' among all the libraries into \"out_dir/\".\n"
+		"  %s -r 0 -m manifest > output\n"
+		"      Read back the striped payload.\n"
+		"  %s -e 2 my_elf\n"
+		"      Estimate the amount of bytes available, within +/- 2%%.\n"
+		"  %s -f csv -k density my_elf > report.csv\n"
+		"      Per-function report, sorted by eligible insn per kB.\n"
+		"  %s --audit /usr/bin /usr/lib > audit.jsonl\n"
+		"      Audit all the ELF files in /usr/bin and /usr/lib.\n"
+		"  %s -p 1234 > output\n"
+		"      Read the payload from the running process 1234.\n"
+		"  rpm2cpio pkg.rpm | %s --tar --audit > audit.jsonl\n"
+		"      Audit all the ELF files inside pkg.rpm.\n",
+		prgname, prgname, prgname, prgname, prgname, prgname, prgname,
+		prgname, prgname, prgname, prgname, prgname);
+	exit(EXIT_FAILURE);
 }
 
 /**
- * @brief Check if the current instruction pointed by @p inst,
- * is eligible to patch:
- *
- * In order that an instruction be eligible, it should:
- * - Have D-bit/direction-bit in the opcode
- * - Have ModRM byte
- * - Be in the format: RegSrc/RegDst
- *
- * @param inst Decoded instruction.
+ * @brief Reads the payload encryption key from the file
+ * descriptor @p fd: 16, 24 or 32 raw bytes (AES-128, AES-192
+ * or AES-256).
  *
- * @return Returns 1 if eligible, 0 if not.
+ * @param fd File descriptor.
+ */
+static void read_key(int fd)
+{
+	ssize_t r;
+
+	key_len = 0;
+	while ((r = read(fd, key + key_len, sizeof(key) - key_len)) > 0)
+		key_len += r;
+	close(fd);
+
+	if (r < 0)
+		errx("Unable to read the key from fd %d!\n", fd);
+	if (key_len != 16 && key_len != 24 && key_len != 32)
+		errx("Invalid key length (%zu bytes), expected 16, 24 or 32!\n",
+			key_len);
+}
+
+/**
+ * @brief Parse command-line arguments.
  *
+ * @param argc Argument count.
+ * @param argv Argument list.
  */
-static int inst_is_eligible(const xed_decoded_inst_t *inst)
+static void parse_args(int argc, char **argv)
 {
-	uint8_t modrm;
-	const xed_inst_t *xi;
-	xed_operand_enum_t op_name1, op_name2;
+	static const struct option long_opts[] = {
+		{"stats",    required_argument, NULL, OPT_STATS},
+		{"perf",     no_argument,       NULL, OPT_PERF},
+		{"verify",   no_argument,       NULL, OPT_VERIFY},
+		{"audit",    optional_argument, NULL, OPT_AUDIT},
+		{"channels", required_argument, NULL, OPT_CHANNELS},
+		{"io",       required_argument, NULL, OPT_IO},
+		{"cache",    required_argument, NULL, OPT_CACHE},
+		{"key-fd",   required_argument, NULL, OPT_KEY_FD},
+		{"tar",      no_argument,       NULL, OPT_TAR},
+		{"resync",   no_argument,       NULL, OPT_RESYNC},
+		{NULL, 0, NULL, 0}
+	};
 
-	/* Have D-bit?. */
-	if (!inst_have_bitD(inst))
+	int c; /* Current arg. */
+	while ((c = getopt_long(argc, argv, "swuzlhEr:o:m:j:e:f:k:p:", long_opts,
+		NULL)) != -1)
 	{
-		INFO("Not bitD!\n");
-		return (0);
+		switch (c) {
+		case 'h':
+			usage(argv[0]);
+			break;
+		case 's':
+			flags = FLG_SCAN;
+			break;
+		case 'w':
+			flags    = FLG_WRITE;
+			out_file = "out";
+			break;
+		case 'r':
+			flags = FLG_READ;
+			amnt_should_read = strtoull(optarg, NULL, 10) * 8;
+			break;
+		case 'u':
+			flags  = FLG_WRITE;
+			update = 1;
+			break;
+		case 'o':
+			out_file = optarg;
+			break;
+		case 'z':
+			stream_flags |= STREAM_COMPRESSED;
+			break;
+		case 'l':
+			stream_flags |= STREAM_LENGTH;
+			break;
+		case 'p':
+			flags    = FLG_READ;
+			live_pid = atoi(optarg);
+			break;
+		case 'm':
+			manifest_file = optarg;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'e':
+			flags = FLG_SCAN;
+			est_precision = atof(optarg);
+			if (est_precision <= 0)
+				est_precision = 5;
+			break;
+		case 'E':
+			flags = FLG_SCAN;
+			est_compare = 1;
+			if (est_precision <= 0)
+				est_precision = 5;
+			break;
+		case 'f':
+			flags = FLG_SCAN;
+			if (!(report_fmt = report_parse_format(optarg))) {
+				fprintf(stderr, "Invalid report format: %s!\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case 'k':
+			if ((report_sort = report_parse_sort(optarg)) < 0) {
+				fprintf(stderr, "Invalid sort key: %s!\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case OPT_STATS:
+			stats_fmt = optarg;
+			break;
+		case OPT_PERF:
+			use_perf = 1;
+			break;
+		case OPT_VERIFY:
+			verify = 1;
+			break;
+		case OPT_AUDIT:
+			flags = FLG_SCAN;
+			audit = 1;
+			if (optarg && !strcmp(optarg, "full"))
+				audit = 2;
+			else if (optarg) {
+				fprintf(stderr, "Invalid audit mode: %s!\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case OPT_IO:
+			if ((io_backend = io_parse_backend(optarg)) < 0) {
+				fprintf(stderr, "Invalid I/O backend: %s!\n", optarg);
+				usage(argv[0]);
+			}
+			if (!io_report++)
+				atexit(io_print_summary);
+			break;
+		case OPT_CACHE:
+			cache_dir = optarg;
+			break;
+		case OPT_KEY_FD:
+			key_fd = atoi(optarg);
+			break;
+		case OPT_TAR:
+			tar = 1;
+			break;
+		case OPT_RESYNC:
+			decode_resync = 1;
+			break;
+		case OPT_CHANNELS:
+			if (!(decode_channels = decode_parse_channels(optarg))) {
+				fprintf(stderr, "Invalid channel list: %s!\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		default:
+			usage(argv[0]);
+			break;
+		}
 	}
 
-	/* Have ModRM? */
-	if (!(modrm = xed_decoded_inst_get_modrm(inst)))
+	/* Statistics are global, so single-file mode only. */
+	if (stats_fmt && !manifest_file && !audit && !tar &&
+		!stats_enable(stats_fmt))
 	{
-		INFO("Not ModRM!\n");
-		return (0);
+		fprintf(stderr, "Invalid stats format: %s!\n", stats_fmt);
+		usage(argv[0]);
 	}
 
-	/* Is Reg/Reg?. */
-	xi       = xed_decoded_inst_inst(inst);
-	op_name1 = xed_operand_name(xed_inst_operand(xi, 0));
-	op_name2 = xed_operand_name(xed_inst_operand(xi, 1));
-	if (!xed_operand_is_register(op_name1) ||
-		!xed_operand_is_register(op_name2))
-	{
-		INFO("Not Reg/Reg!\n");
-		return (0);
+	if (verify && (!(flags & FLG_WRITE) || manifest_file)) {
+		fprintf(stderr, "--verify requires -w (single-file mode)!\n");
+		usage(argv[0]);
 	}
 
-	return (1);
-}
-
-/**
- * @brief Given a current decoded instruction pointed by @p inst,
- * patches (or not, if FLG_SCAN) the instruction encoding,
- * accordingly with the specified @p target bit.
- *
- * @param buff  Buffer pointing to the beginning of the instruction
- *              (must be RW if FLG_WRITE).
- * @param inst  Current decoded instruction.
- * @param isize Current instruction size.
- * @param target_bit Target bit to be set (or cleared) in the
- *                   the instruction.
- *
- * @return Returns 1 if the patch was succeeded, 0 if not.
- */
-static int patch_inst(
-	uint8_t *buff, const xed_decoded_inst_t *inst, unsigned isize,
-	uint8_t target_bit)
-{
-	uint8_t reg1, reg2;
-	uint8_t nbuff[16] = {0};
-	xed_decoded_inst_t inst_new;
-	unsigned off_modrm, off_opcode;
-	uint8_t rex, bitD, modrm, opcode;
-
-	((void)inst_new);
-	memcpy(nbuff, buff, isize);
-
-	/* Get offsets for ModRM and opcode. */
-	off_modrm  = xed3_operand_get_pos_modrm(inst);
-	off_opcode = xed3_operand_get_pos_nominal_opcode(inst);
-
-	/*
-	 * Check if the bitD is already equals to our target_bit,
-	 * if so, nothing need to be done!.
-	 */
-	opcode = nbuff[off_opcode];
-	modrm  = nbuff[off_modrm];
-	bitD   = (opcode >> 1) & 1;
-
-	if (!(flags & FLG_SCAN) && bitD == target_bit) {
-		INFO("bitD is already equals to target (%d, opc: 0x%02X)!\n",
-			target_bit, opcode);
-		return (1); /* since this is not an error. */
+	if (key_fd >= 0) {
+		if (flags & FLG_SCAN) {
+			fprintf(stderr, "--key-fd requires -w, -r or -p!\n");
+			usage(argv[0]);
+		}
+		read_key(key_fd);
 	}
 
-	/* Flit bitD. */
-	opcode ^= 2;
-
-	/* Just some sanity check. */
-	if ((modrm >> 6) != 0x3) { /* Register addressing mode. */
-		ERR("Not register addressing mode detected!!!\n");
-		return (0);
+	/* Write and read runs only reuse the skip map (--resync). */
+	if (cache_dir) {
+		if (!(flags & FLG_SCAN) &&
+			(!decode_resync || manifest_file || live_pid > 0))
+		{
+			fprintf(stderr, "--cache requires -s, or -w/-r with --resync!\n");
+			usage(argv[0]);
+		}
+		atexit(cache_print_summary);
 	}
 
-	reg1 = (modrm >> 3) & 0x7;
-	reg2 = (modrm & 0x7);
+	if (manifest_file && (flags & FLG_SCAN)) {
+		fprintf(stderr, "Stripe mode (-m) requires -w or -r!\n");
+		usage(argv[0]);
+	}
 
-	/* Clear modrm and set the register in inverted order. */
-	modrm &= 0xC0;
-	modrm |= (reg2 << 3) | reg1;
+	/* Reading a striped payload only needs the manifest. */
+	if (manifest_file && (flags & FLG_READ))
+		return;
 
-	/*
-	 * Check if have a REX prefix:
-	 * If so, we might need to invert the order of the extension
-	 * bits too.
-	 */
-	if (xed3_operand_get_rex(inst) != 0)
-	{
-		rex = nbuff[off_opcode - 1];
-		if (xed3_operand_get_rexr(inst) !=
-			xed3_operand_get_rexb(inst))
+	/* Archive mode reads the archive from stdin. */
+	if (tar) {
+		if ((flags & FLG_WRITE) || manifest_file || live_pid > 0 ||
+			verify || use_perf || report_fmt || est_precision > 0 ||
+			cache_dir)
 		{
-			rex ^= 0x5; /* xor by 101b to invert both R and B bit. */
-			/*
-			 * Write new REX to our instruction buffer.
-			 * (assuming REX offset to be right before the opcode!)
-			 */
-			nbuff[off_opcode - 1] = rex;
+			fprintf(stderr, "--tar only supports -s, -r and --audit!\n");
+			usage(argv[0]);
 		}
+		if ((flags & FLG_READ) && !out_file) {
+			fprintf(stderr, "--tar -r requires an output directory (-o)!\n");
+			usage(argv[0]);
+		}
+		return;
 	}
 
-	/* Write to the instruction buffer. */
-	nbuff[off_opcode] = opcode;
-	nbuff[off_modrm]  = modrm;
+	/* Live read only needs the pid. */
+	if (live_pid > 0 && (flags & FLG_READ))
+		return;
 
-	/* Check if the new inst is equal to the original. */
-#ifdef DOUBLE_CHECK
-	if (!is_decoded_inst_equals_to_inst_buff(inst, nbuff, &inst_new))
-	{
-		ERR("Instructions do not match!:\n");
-		ERR("Old inst:  "); print_inst_str(inst);
-		ERR("New instr: "); print_inst_str(&inst_new);
-		return (0);
+	/* If not input file available. */
+	if (optind >= argc) {
+		fprintf(stderr, "Expected <elf_file> after options!\n");
+		usage(argv[0]);
 	}
-#endif
-
-#if DBG_LVL == 1
-	DEBUG("Old inst:  "); print_inst_str(inst);
-	DEBUG("New instr: "); print_inst_str(&inst_new);
-#endif
 
-	/* Do not make the changes if in only-test mode. */
-	if (!(flags & FLG_SCAN))
-		memcpy(buff, nbuff, isize);
+	inp_file  = argv[optind];
+	inp_files = argv + optind;
+	inp_count = argc - optind;
 
-	return (1);
+	/* Update: the input file is also the output. */
+	if (update) {
+		if (manifest_file || verify) {
+			fprintf(stderr, "-u does not support -m and --verify!\n");
+			usage(argv[0]);
+		}
+		out_file = inp_file;
+	}
 }
 
 /**
- * @brief Reads from stdin and returns the next bit to be
- * patched into the ELF file.
+ * @brief Stripe mode: writes or reads a payload striped
+ * among several ELF files.
  *
- * @return Returns the bit read, or -1 if EOF.
+ * @return Returns 1 if success, 0 otherwise.
  */
-static int read_next_bit(void)
+static int do_stripe(void)
 {
-	static int bits      = 0;
-	static int bits_left = 0;
-	int ret;
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (flags & FLG_WRITE)
+		return (stripe_write(inp_files, inp_count, out_file,
+			manifest_file, &stream, nthreads));
+	else
+		return (stripe_read(manifest_file, &stream,
+			amnt_should_read / 8, nthreads));
+}
 
-	ret = -1;
+/**
+ * @brief Estimate mode: estimates the amount of bytes
+ * available by sampling random functions and, if requested,
+ * compares it against a full scan.
+ *
+ * @return Returns 1 if the estimate was done, 0 if not possible
+ * (no function symbols), in which case a full scan should be
+ * done instead.
+ */
+static int do_estimate(void)
+{
+	struct estimate est;
+	struct elf_sym *syms;
+	size_t nsyms;
+	double t0, t1, t2;
+	double exact;
+
+	syms = NULL;
+	if (!load_func_symbols(&ctx.info, &syms, &nsyms) || !nsyms) {
+		fprintf(stderr, "No function symbols found, doing a full scan...\n");
+		free(syms);
+		return (0);
+	}
 
-	/* If no bits left, read a new byte */
-	if (!bits_left)
+	t0 = time_now();
+	if (!estimate_capacity(&ctx.info, syms, nsyms, est_precision, &est))
+		errx("Unable to estimate capacity!\n");
+	t1 = time_now();
+
+	printf(
+		"Estimate summary:\n"
+		"~%.0f bytes available (+/- %.1f%%, 95%% CI: %.0f - %.0f bytes)\n"
+		"Sampled %zu out of %zu functions (%.1f%% of .text) in %.3fs\n",
+		est.bytes, est.bytes ? (est.half_width * 100) / est.bytes : 0,
+		est.bytes - est.half_width, est.bytes + est.half_width,
+		est.sampled, est.nfuncs,
+		(est.sampled_bytes * 100.0) / ctx.info.elf_text_size, t1 - t0);
+
+	if (est_compare)
 	{
-		bits = getchar();
-		if (bits == EOF)
-			return (ret);
-		bits_left = 8;
+		decode_instructions(&ctx);
+		t2    = time_now();
+		exact = ctx.capacity_bits / 8;
+
+		printf("Exact: %.0f bytes available (estimate error: %+.2f%%)\n"
+			"Full scan in %.3fs (estimate was %.1fx faster)\n",
+			exact, exact ? ((est.bytes - exact) * 100) / exact : 0,
+			t2 - t1, (t1 - t0) > 0 ? (t2 - t1) / (t1 - t0) : 0);
 	}
 
-	/* Extract the leftmost bit and shift bits */
-	ret = bits & 1;
-	bits >>= 1;
-	bits_left--;
+	free(syms);
+	return (1);
+}
 
+/**
+ * @brief Report mode: scans the ELF file and outputs the
+ * per-function capacity report.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int do_report(void)
+{
+	struct elf_sym *syms;
+	size_t nsyms;
+	int ret;
+
+	syms = NULL;
+	if (!load_func_symbols(&ctx.info, &syms, &nsyms))
+		errx("Unable to load function symbols!\n");
+
+	ctx.syms        = syms;
+	ctx.nsyms       = nsyms;
+	ctx.fn_inst     = calloc(nsyms + 1, sizeof(size_t));
+	ctx.fn_eligible = calloc(nsyms + 1, sizeof(size_t));
+	ctx.fn_bits     = calloc(nsyms + 1, sizeof(size_t));
+	if (!ctx.fn_inst || !ctx.fn_eligible || !ctx.fn_bits)
+		errx("Unable to allocate per-function counters!\n");
+
+	decode_instructions(&ctx);
+	ret = report_functions(&ctx, report_fmt, report_sort);
+
+	free(ctx.fn_inst);
+	free(ctx.fn_eligible);
+	free(ctx.fn_bits);
+	free(syms);
+	ctx.syms = NULL;
 	return (ret);
 }
 
 /**
- * @brief Given a decoded instruction pointed by @p inst,
- * writes to stdout the read bit.
- *
- * @param inst Current decoded instruction.
- * @param buff Buffer pointing to the beginning of the current
- *             instruction.
+ * @brief Scan mode with the results cache: looks up the ELF file
+ * in the cache directory and, on a miss, scans it and saves the
+ * results (with per-iclass counters) for the next time.
  */
-static void write_next_bit(const xed_decoded_inst_t *inst,
-	const uint8_t *buff)
+static void do_cached_scan(void)
 {
-	static unsigned bits_amnt = 0;
-	static unsigned curr_byte = 0;
-	unsigned off_opcode;
-	unsigned off_modrm;
-	unsigned d_bit;
-
-	off_modrm  = xed3_operand_get_pos_modrm(inst);
-	off_opcode = xed3_operand_get_pos_nominal_opcode(inst);
-
-	/* Just some sanity check. */
-	if ((buff[off_modrm] >> 6) != 0x3) {
-		ERR("Not register addressing mode detected!!!\n");
-		return;
-	}
+	struct cache_key key;
+
+	cache_make_key(&ctx, &key);
+	if (!cache_lookup(cache_dir, &key, &ctx))
+	{
+		ctx.ic_eligible = calloc(XED_ICLASS_LAST, sizeof(size_t));
+		if (!ctx.ic_eligible)
+			errx("Unable to allocate per-iclass counters!\n");
 
-	d_bit     = (buff[off_opcode] >> 1) & 1;
-	curr_byte = (curr_byte >> 1) | (d_bit << 7);
-	bits_amnt++;
+		decode_instructions(&ctx);
+		cache_store(cache_dir, &key, &ctx);
 
-	if (bits_amnt == 8) {
-		putchar(curr_byte);
-		bits_amnt = 0;
-		curr_byte = 0;
+		free(ctx.ic_eligible);
+		ctx.ic_eligible = NULL;
 	}
+	decode_print_summary(&ctx);
 }
 
 /**
- * @brief For an already parsed ELF file, read its entire .text
- * section and decodes all instruction. Its behavior depends
- * on the current mode.
- * If:
- *   FLG_SCAN:  Only decodes the instructions and checks for
- *              instructions candidates to patch.
- *   FLG_WRITE: Reads from stdin and write to the output ELF file.
- *   FLG_READ:  Reads from the input ELF file and write to stdout
- *              the (already saved) bits.
+ * @brief Write/read with the results cache (and --resync): loads
+ * the skip map saved by a previous scan of the same build, if any,
+ * so that its undecodable ranges are not decoded again.
  */
-static void decode_instructions(void)
+static void load_cached_skips(void)
 {
-	uint8_t *buff;
-	int      next_bit;
-	unsigned inst_len;
-	size_t   rem_bytes;
-	size_t   written_bits;
-	unsigned amnt_bits_read;
-	size_t   total_inst_count;
-	size_t   patch_inst_count;
-	xed_error_enum_t   xed_error;
-	xed_decoded_inst_t decoded_inst;
-
-	buff       = info.file_buff + info.elf_file_off;
-	rem_bytes  = info.elf_text_size;
-	next_bit   = 0;
-	written_bits     = 0;
-	total_inst_count = 0;
-	patch_inst_count = 0;
-	amnt_bits_read   = 0;
-
-	while (rem_bytes)
-	{
-		xed_decoded_inst_zero(&decoded_inst);
-		xed_decoded_inst_set_mode(&decoded_inst,
-			machine_mode, machine_address);
+	struct cache_key ckey;
 
-		/* Decode instruction. */
-		xed_error =
-			xed_decode(&decoded_inst, buff, rem_bytes);
-
-		if (xed_error != XED_ERROR_NONE)
-			errx("Error decoding instruction at offset: %jd (%s)\n",
-				(buff - (info.file_buff + info.elf_file_off)),
-				xed_error_enum_t2str(xed_error));
+	cache_make_key(&ctx, &ckey);
+	cache_lookup(cache_dir, &ckey, &ctx);
+}
 
-		inst_len = xed_decoded_inst_get_length(&decoded_inst);
-		total_inst_count++;
+/**
+ * @brief Verify mode: checks the (already written) output file
+ * against the input file.
+ *
+ * @return Returns 1 if the files are equivalent, 0 otherwise.
+ */
+static int do_verify(void)
+{
+	struct elf_file_info orig = {0};
+	size_t mismatches;
 
-		/* Check if instruction is eligible to read and/or patch. */
-		if (!inst_is_eligible(&decoded_inst))
-			goto skip;
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
 
-		patch_inst_count++;
+	if (!init_elf(&orig, inp_file, NULL)) {
+		fprintf(stderr, "Verify: unable to open %s!\n", inp_file);
+		return (0);
+	}
 
-		/* Read from stdin and write that bit into the file. */
-		if (flags & FLG_WRITE) {
-			next_bit = read_next_bit();
-			if (next_bit < 0)
-				break;
-		}
+	mismatches = verify_text(&orig, &ctx.info, ctx.skips, ctx.nskips,
+		nthreads);
+	munmap_elf(&orig);
 
-		if (flags & (FLG_WRITE|FLG_SCAN))
-			patch_inst(buff, &decoded_inst, inst_len, next_bit);
+	if (mismatches) {
+		fprintf(stderr, "Verify: %zu mismatches found!\n", mismatches);
+		return (0);
+	}
 
-		else if (flags & FLG_READ) {
-			write_next_bit(&decoded_inst, buff);
-			if (++amnt_bits_read == amnt_should_read)
-				break;
-		}
+	printf("Verify: OK, output is equivalent to the input\n");
+	return (1);
+}
 
-		written_bits++;
+/**
+ * @brief Decodes (and patches) the whole file and writes it back
+ * to the disk, measuring both phases with the hardware performance
+ * counters.
+ *
+ * @return Returns 1 if success, 0 otherwise (if --verify failed).
+ */
+static int do_perf(void)
+{
+	struct perf_counters pc;
+	int ret;
 
-	skip:
-		/* Update pointers. */
-		buff      += inst_len;
-		rem_bytes -= inst_len;
+	if (!perf_open(&pc)) {
+		fprintf(stderr, "Warning: hardware counters not available, "
+			"ignoring --perf!\n");
+		decode_instructions(&ctx);
+		decode_print_summary(&ctx);
+		ret = !verify || do_verify();
+		munmap_elf(&ctx.info);
+		return (ret);
 	}
 
-	if (flags & FLG_SCAN) {
-		printf(
-			"Scan summary:\n"
-			"%zu bytes available "
-			"(%zu inst patcheables, out of %zu (~%zu %%))\n",
-			patch_inst_count/8, patch_inst_count, total_inst_count,
-			(patch_inst_count*100)/total_inst_count);
-	}
+	perf_start(&pc);
+	decode_instructions(&ctx);
+	perf_stop(&pc);
+	decode_print_summary(&ctx);
+	ret = !verify || do_verify();
 
-	if (flags & FLG_WRITE) {
-		printf(
-			"Write summary:\n"
-			"Wrote %zu bits (%zu bytes)\n",
-			written_bits, written_bits/8);
-
-		if (next_bit >= 0)
-			printf(
-				"WARNING: Entire input was not written!\n"
-				"Please check the max amnt of bytes available to write!\n");
-	}
+	perf_print(&pc, "decode", ctx.total_inst_count,
+		(flags & FLG_WRITE) ? ctx.written_bits : 0);
+
+	memset(pc.val, 0, sizeof(pc.val));
+	perf_start(&pc);
+	munmap_elf(&ctx.info);
+	perf_stop(&pc);
+	perf_print(&pc, "write-back", 0, 0);
+
+	perf_close(&pc);
+	return (ret);
 }
 
 /**
- * @brief Initializes the input ELF file pointed by @p in,
- * and fill the auxiliary data structures with the relevant
- * info.
+ * @brief Archive mode: scans, reads or audits the ELF members
+ * of the tar/cpio archive read from stdin.
  *
- * @param in Path to the ELF file to read.
- *
- * @return Returns if success, 0 otherwise.
+ * @return Returns the amount of members that failed (or were
+ * found modified, if auditing), or -1 if the archive is invalid.
  */
-static int init_elf(const char *in)
+static int do_archive(void)
+{
+	struct archive_opts opts;
+	int ret;
+
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	opts.flags    = flags;
+	opts.audit    = audit;
+	opts.amnt_should_read = amnt_should_read;
+	opts.out_dir  = out_file;
+	opts.key      = key;
+	opts.key_len  = key_len;
+	opts.nthreads = nthreads;
+
+	ret = archive_process(stdin, &opts);
+	memset(key, 0, sizeof(key));
+	return (ret);
+}
+
+/* Main. */
+int main(int argc, char **argv)
 {
-	int fd_in;
-	int fd_out = 0;
+	int ret;
+
+	ret = 0;
+	parse_args(argc, argv);
 
 	/* Initialize XED context. */
 	xed_tables_init();
 
-	/* Open bin file. */
-	fd_in = open_and_load_elf_text(in, &info);
-	if (fd_in < 0)
-		return (0);
+	if (tar) {
+		ret = do_archive();
+		return (ret != 0);
+	}
 
-	/* Create output file (if required) to be processed. */
-	if (out_file) {
-		if ((fd_out = copy_file(fd_in, out_file)) < 0)
-			errto(out_close_elf, "Unable to create a file copy, aborting...\n");
-		info.elf_fd = fd_out;
-		info.rdwr   = 1;
+	if (audit) {
+		if (nthreads <= 0)
+			nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		ret = audit_paths(inp_files, inp_count, nthreads, audit == 2);
+		return (ret > 0);
+	}
+
+	/* Initialize payload stream. */
+	if (flags & FLG_WRITE) {
+		if (!stream_init(&stream, stream_flags, stdin, NULL))
+			errx("Unable to initialize payload stream!\n");
 	}
 	else {
-		info.elf_fd = fd_in;
-		info.rdwr   = 0;
+		if (!stream_init(&stream, 0, NULL, stdout))
+			errx("Unable to initialize payload stream!\n");
+
+		/* -r <amnt>: payload bytes, not counting the stream header. */
+		stream.limit = amnt_should_read / 8;
 	}
 
-	if (!mmap_elf(&info))
-		errto(out_close_fdin, "Unable to mmap ELF file!\n");
+	if (key_len) {
+		if (!stream_set_key(&stream, key, key_len))
+			errx("Unable to initialize payload encryption!\n");
+		memset(key, 0, sizeof(key));
+	}
 
-	/* Set machine type. */
-	if (info.elf_machine_type == 64) {
-		machine_mode    = XED_MACHINE_MODE_LONG_64;
-		machine_address = XED_ADDRESS_WIDTH_64b;
-	} else {
-		machine_mode    = XED_MACHINE_MODE_LEGACY_32;
-		machine_address = XED_ADDRESS_WIDTH_32b;
+	if (manifest_file) {
+		ret = !do_stripe();
+		goto out;
 	}
 
-	return (1);
+	decode_init(&ctx, flags);
+	ctx.get_byte = stream_get_cb;
+	ctx.put_byte = stream_put_cb;
+	ctx.data     = &stream;
 
-out_close_fdin:
-	if (info.rdwr)
-		close(fd_out);
-out_close_elf:
-	unload_elf_text();
+	if (live_pid > 0) {
+		ret = !live_read(live_pid, &ctx);
+		goto out;
+	}
 
-	return (0);
-}
+	if (!init_elf(&ctx.info, inp_file, out_file))
+		errx("Unable to initialize ELF file!\n");
 
-/**
- * @brief Show program usage.
- * @param prgname Program name.
- */
-static void usage(const char *prgname)
-{
-	fprintf(stderr, "Usage: %s [options] elf_file\n", prgname);
-	fprintf(stderr,
-		"Options:\n"
-		"  -s \n"
-		"      Scan the elf_file and obtains the max amount of bytes available\n"
-		"      to add.\n"
-		"  -r <amnt>\n"
-		"      Reads amnt of bytes on the elf_file and outputs to stdout.\n"
-		"      If 0, read everything.\n"
-		"  -w \n"
-		"      Writes all the input (from stdin) into a copy of elf_file.\n"
-		"      (default to: \"out\", change with: -o)\n"
-		"  -o <output-file>\n"
-		"      Changes the default output file to the one specified.\n"
-		"  -h \n"
-		"      This help\n\n"
-		"Examples:\n"
-		"  %s -r 123 my_elf > out_file\n"
-		"      Reads 123 bytes from my_elf into \"out_file\".\n"
-		"  %s -s my_elf\n"
-		"      Scan my_elf and returns the amount of bytes available to add.\n"
-		"  %s -w my_elf < input\n"
-		"      Write the contents of 'input' into \"out\" (default output file).\n"
-		"  %s -w my_elf -o my_new_elf < input\n"
-		"      Write the contents of 'input' into \"my_new_elf\".\n",
-		prgname, prgname, prgname, prgname);
-	exit(EXIT_FAILURE);
-}
+	if (est_precision > 0 && do_estimate())
+		goto out_unmap;
 
-/**
- * @brief Parse command-line arguments.
- *
- * @param argc Argument count.
- * @param argv Argument list.
- */
-static void parse_args(int argc, char **argv)
-{
-	int c; /* Current arg. */
-	while ((c = getopt(argc, argv, "swhr:o:")) != -1)
-	{
-		switch (c) {
-		case 'h':
-			usage(argv[0]);
-			break;
-		case 's':
-			flags = FLG_SCAN;
-			break;
-		case 'w':
-			flags    = FLG_WRITE;
-			out_file = "out";
-			break;
-		case 'r':
-			flags = FLG_READ;
-			amnt_should_read = atoi(optarg) * 8;
-			if (!amnt_should_read)
-				amnt_should_read = 0xFFFFFFFF;
-			break;
-		case 'o':
-			out_file = optarg;
-			break;
-		default:
-			usage(argv[0]);
-			break;
-		}
+	if (report_fmt) {
+		ret = !do_report();
+		goto out_unmap;
 	}
 
-	/* If not input file available. */
-	if (optind >= argc) {
-		fprintf(stderr, "Expected <elf_file> after options!\n");
-		usage(argv[0]);
+	if (cache_dir && (flags & FLG_SCAN)) {
+		do_cached_scan();
+		goto out_unmap;
 	}
 
-	inp_file = argv[optind];
-}
+	if (cache_dir)
+		load_cached_skips();
 
-/* Main. */
-int main(int argc, char **argv)
-{
-	parse_args(argc, argv);
-	if (!init_elf(inp_file))
-		errx("Unable to initialize ELF file!\n");
+	if (use_perf) {
+		ret = !do_perf();
+		goto out;
+	}
 
 	/* Decode everything. */
-	decode_instructions();
+	decode_instructions(&ctx);
+	decode_print_summary(&ctx);
 
-	/* Deallocate everything. */
-	munmap_elf(&info);
+	if (verify && !do_verify())
+		ret = 1;
 
-	return (0);
+	/* Deallocate everything. */
+out_unmap:
+	munmap_elf(&ctx.info);
+out:
+	/* Shared by all the write paths (single file, --perf, stripes). */
+	if (!ret && (flags & FLG_WRITE) && (stream.flags & STREAM_COMPRESSED))
+		printf("Compressed %" PRIu64 " bytes into %" PRIu64
+			" bytes (ratio: %.2f)\n",
+			stream.raw_bytes, stream.body_bytes,
+			stream.body_bytes ?
+				(double)stream.raw_bytes / stream.body_bytes : 0.0);
+
+	decode_release(&ctx);
+	stream_finish(&stream);
+	return (ret);
 }
@@ -63,17 +63,25 @@
 		uint64_t elf_text_size;
 		uint64_t elf_file_off;
 		int      elf_machine_type;
+		int      machine_mode;    /* XED machine mode.    */
+		int      machine_address; /* XED address width.   */
+
+		/* Section header table (parsed from file_buff). */
+		int      elf_class;       /* 32 or 64 (ELFCLASS). */
+		uint64_t elf_shoff;
+		uint64_t elf_shnum;
+		uint64_t elf_shentsize;
+		uint64_t elf_shstrndx;    /* Section names.       */
 
 		/* File info. */
 		size_t   file_size;
 		uint8_t *file_buff;
 		int elf_fd;        /* Input/output. */
+		int io;            /* Backend that loaded file_buff. */
+		uint8_t *dirty;    /* Modified pages bitmap (read backends). */
 
 		/* Status. */
 		int rdwr; /* Is file opened as rd/wr or ro?. */
 	};
 
-	extern int machine_mode;
-	extern int machine_address;
-
 #endif /* MAIN_H. */
@@ -0,0 +1,193 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+
+/* Counter names, as shown in the output. */
+static const char *const perf_names[PERF_MAX] = {
+	"cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses"
+};
+
+/**
+ * @brief Opens a single (disabled) counter for the current
+ * process, user-space only.
+ *
+ * @param type   Event type (PERF_TYPE_*).
+ * @param config Event config.
+ *
+ * @return Returns the counter fd, or -1 if not available.
+ */
+static int perf_open_counter(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size     = sizeof(attr);
+	attr.type     = type;
+	attr.config   = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+	attr.read_format    =
+		PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return (syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+/**
+ * @brief Opens all the hardware counters. Counters that are not
+ * available (e.g.: inside a VM) are silently ignored.
+ *
+ * @param pc Counters.
+ *
+ * @return Returns 1 if at least one counter is available,
+ * 0 otherwise.
+ */
+int perf_open(struct perf_counters *pc)
+{
+	int i, ok;
+
+	memset(pc, 0, sizeof(*pc));
+	pc->fd[PERF_CYCLES] =
+		perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	pc->fd[PERF_INSTRUCTIONS] =
+		perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	pc->fd[PERF_BRANCH_MISSES] =
+		perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	pc->fd[PERF_L1D_MISSES] =
+		perf_open_counter(PERF_TYPE_HW_CACHE,
+			PERF_COUNT_HW_CACHE_L1D |
+			(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	pc->fd[PERF_LLC_MISSES] =
+		perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+
+	for (i = 0, ok = 0; i < PERF_MAX; i++)
+		ok |= (pc->fd[i] >= 0);
+	return (ok);
+}
+
+/**
+ * @brief Resets and starts all the counters.
+ *
+ * @param pc Counters.
+ */
+void perf_start(struct perf_counters *pc)
+{
+	int i;
+	for (i = 0; i < PERF_MAX; i++) {
+		if (pc->fd[i] < 0)
+			continue;
+		ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+/**
+ * @brief Stops all the counters and accumulates their values.
+ * Values are scaled if the counter was multiplexed.
+ *
+ * @param pc Counters.
+ */
+void perf_stop(struct perf_counters *pc)
+{
+	uint64_t data[3]; /* value, time enabled, time running. */
+	int i;
+
+	for (i = 0; i < PERF_MAX; i++)
+	{
+		if (pc->fd[i] < 0)
+			continue;
+
+		ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(pc->fd[i], data, sizeof data) != sizeof data)
+			continue;
+
+		if (data[2] && data[2] < data[1])
+			data[0] = (uint64_t)((double)data[0] * data[1] / data[2]);
+		pc->val[i] += data[0];
+	}
+}
+
+/**
+ * @brief Closes all the counters.
+ *
+ * @param pc Counters.
+ */
+void perf_close(struct perf_counters *pc)
+{
+	int i;
+	for (i = 0; i < PERF_MAX; i++) {
+		if (pc->fd[i] >= 0)
+			close(pc->fd[i]);
+		pc->fd[i] = -1;
+	}
+}
+
+/**
+ * @brief Prints the counters values to stderr.
+ *
+ * @param pc    Counters.
+ * @param name  Region name.
+ * @param ninst Amount of decoded instructions (or 0).
+ * @param nbits Amount of patched bits (or 0).
+ */
+void perf_print(const struct perf_counters *pc, const char *name,
+	uint64_t ninst, uint64_t nbits)
+{
+	uint64_t cycles;
+	int i;
+
+	fprintf(stderr, "Perf summary (%s):\n", name);
+	for (i = 0; i < PERF_MAX; i++)
+	{
+		if (pc->fd[i] < 0) {
+			fprintf(stderr, "  %-14s n/a\n", perf_names[i]);
+			continue;
+		}
+		fprintf(stderr, "  %-14s %" PRIu64 "\n", perf_names[i], pc->val[i]);
+	}
+
+	if (pc->fd[PERF_CYCLES] < 0)
+		return;
+
+	cycles = pc->val[PERF_CYCLES];
+	if (pc->fd[PERF_INSTRUCTIONS] >= 0 && cycles)
+		fprintf(stderr, "  IPC:                 %.2f\n",
+			(double)pc->val[PERF_INSTRUCTIONS] / cycles);
+	if (ninst)
+		fprintf(stderr, "  cycles/decoded inst: %.2f\n",
+			(double)cycles / ninst);
+	if (nbits)
+		fprintf(stderr, "  cycles/patched bit:  %.2f\n",
+			(double)cycles / nbits);
+}
@@ -0,0 +1,51 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+	#include <stdint.h>
+
+	/* Counters. */
+	#define PERF_CYCLES        0
+	#define PERF_INSTRUCTIONS  1
+	#define PERF_BRANCH_MISSES 2
+	#define PERF_L1D_MISSES    3
+	#define PERF_LLC_MISSES    4
+	#define PERF_MAX           5
+
+	struct perf_counters
+	{
+		int      fd[PERF_MAX];  /* -1 if not available. */
+		uint64_t val[PERF_MAX]; /* Accumulated (scaled) values. */
+	};
+
+	extern int  perf_open(struct perf_counters *pc);
+	extern void perf_start(struct perf_counters *pc);
+	extern void perf_stop(struct perf_counters *pc);
+	extern void perf_close(struct perf_counters *pc);
+	extern void perf_print(const struct perf_counters *pc, const char *name,
+		uint64_t ninst, uint64_t nbits);
+
+#endif /* PERF_H */
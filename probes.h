@@ -0,0 +1,62 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+	/*
+	 * USDT/SDT probes:
+	 * Compiled in whenever <sys/sdt.h> is available (unless
+	 * STELF_NO_USDT is defined). A disabled probe is just a
+	 * single NOP, so they can be left in production builds and
+	 * attached at runtime with, e.g.:
+	 *
+	 *   bpftrace -e 'usdt:./stelf:stelf:patch { @[arg1] = count(); }'
+	 *
+	 * Probes:
+	 *   decode   (text offset, inst length)
+	 *   eligible (text offset, inst buffer, eligible?)
+	 *   patch    (text offset, target bit, patch result)
+	 */
+	#if defined(__has_include) && !defined(STELF_NO_USDT)
+	#if __has_include(<sys/sdt.h>)
+	#include <sys/sdt.h>
+	#define STELF_HAVE_USDT
+	#endif
+	#endif
+
+	#ifdef STELF_HAVE_USDT
+	#define PROBE_DECODE(off, len) \
+		DTRACE_PROBE2(stelf, decode, off, len)
+	#define PROBE_ELIGIBLE(off, buff, res) \
+		DTRACE_PROBE3(stelf, eligible, off, buff, res)
+	#define PROBE_PATCH(off, bit, res) \
+		DTRACE_PROBE3(stelf, patch, off, bit, res)
+	#else
+	#define PROBE_DECODE(off, len)         do {} while (0)
+	#define PROBE_ELIGIBLE(off, buff, res) do {} while (0)
+	#define PROBE_PATCH(off, bit, res)     do {} while (0)
+	#endif
+
+#endif /* PROBES_H */
@@ -0,0 +1,243 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "report.h"
+
+/* Report row. */
+struct report_row
+{
+	const char *name;
+	uint64_t addr;
+	uint64_t size;
+	size_t   inst;
+	size_t   eligible;
+	size_t   bits;
+	double   density; /* Eligible instructions per kB. */
+};
+
+/* Current sort key, for qsort(). */
+static int sort_key;
+
+/**
+ * @brief Parses the report format name @p fmt.
+ *
+ * @param fmt Format name: "csv" or "json".
+ *
+ * @return Returns the format (REPORT_*), or 0 if invalid.
+ */
+int report_parse_format(const char *fmt)
+{
+	if (!strcmp(fmt, "csv"))
+		return (REPORT_CSV);
+	if (!strcmp(fmt, "json"))
+		return (REPORT_JSON);
+	return (0);
+}
+
+/**
+ * @brief Parses the sort key name @p key.
+ *
+ * @param key Sort key name: eligible, density, size, addr or name.
+ *
+ * @return Returns the sort key (SORT_*), or -1 if invalid.
+ */
+int report_parse_sort(const char *key)
+{
+	static const char *keys[] = {
+		"eligible", "density", "size", "addr", "name"
+	};
+	int i;
+
+	for (i = 0; i < (int)(sizeof(keys)/sizeof(keys[0])); i++)
+		if (!strcmp(key, keys[i]))
+			return (i);
+	return (-1);
+}
+
+/**
+ * @brief Compare two report rows accordingly with the current
+ * sort key, for qsort(). Numeric keys are sorted in descending
+ * order, except for the address.
+ *
+ * @param a First row.
+ * @param b Second row.
+ *
+ * @return Returns a negative, zero or positive value if @p a
+ * goes before, together or after @p b.
+ */
+static int row_cmp(const void *a, const void *b)
+{
+	const struct report_row *r1 = a;
+	const struct report_row *r2 = b;
+
+	switch (sort_key)
+	{
+	case SORT_ELIGIBLE:
+		if (r1->eligible != r2->eligible)
+			return (r1->eligible > r2->eligible ? -1 : 1);
+		break;
+	case SORT_DENSITY:
+		if (r1->density != r2->density)
+			return (r1->density > r2->density ? -1 : 1);
+		break;
+	case SORT_SIZE:
+		if (r1->size != r2->size)
+			return (r1->size > r2->size ? -1 : 1);
+		break;
+	case SORT_NAME:
+		return (strcmp(r1->name, r2->name));
+	}
+
+	if (r1->addr != r2->addr)
+		return (r1->addr < r2->addr ? -1 : 1);
+	return (0);
+}
+
+/**
+ * @brief Prints the string @p str as a JSON string.
+ *
+ * @param f   Output file.
+ * @param str String to be printed.
+ */
+void report_json_str(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str; str++)
+	{
+		if (*str == '"' || *str == '\\')
+			fprintf(f, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(f, "\\u%04x", (unsigned char)*str);
+		else
+			fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+/**
+ * @brief Prints the string @p str as a CSV field.
+ *
+ * @param str String to be printed.
+ */
+static void print_csv_str(const char *str)
+{
+	if (!strpbrk(str, ",\"\n")) {
+		fputs(str, stdout);
+		return;
+	}
+
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"')
+			putchar('"');
+		putchar(*str);
+	}
+	putchar('"');
+}
+
+/**
+ * @brief Prints the per-function capacity report of an already
+ * decoded context (with per-function counters enabled).
+ *
+ * @param ctx  Decoding context.
+ * @param fmt  Output format (REPORT_CSV or REPORT_JSON).
+ * @param sort Sort key (SORT_*).
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int report_functions(const struct decode_ctx *ctx, int fmt, int sort)
+{
+	struct report_row *rows;
+	size_t nrows, i;
+
+	if (!(rows = calloc(ctx->nsyms + 1, sizeof(*rows))))
+		return (0);
+
+	for (i = 0, nrows = 0; i <= ctx->nsyms; i++)
+	{
+		/* Skip the 'outside any function' row if empty. */
+		if (i == ctx->nsyms && !ctx->fn_inst[i])
+			continue;
+
+		if (i < ctx->nsyms) {
+			rows[nrows].name = ctx->syms[i].name;
+			rows[nrows].addr = ctx->syms[i].addr;
+			rows[nrows].size = ctx->syms[i].size;
+		}
+		else {
+			rows[nrows].name = "<no function>";
+			rows[nrows].addr = 0;
+			rows[nrows].size = 0;
+		}
+
+		rows[nrows].inst     = ctx->fn_inst[i];
+		rows[nrows].eligible = ctx->fn_eligible[i];
+		rows[nrows].bits     = ctx->fn_bits[i];
+		rows[nrows].density  = rows[nrows].size ?
+			(rows[nrows].eligible * 1024.0) / rows[nrows].size : 0;
+		nrows++;
+	}
+
+	sort_key = sort;
+	qsort(rows, nrows, sizeof(*rows), row_cmp);
+
+	if (fmt == REPORT_CSV)
+		printf("function,address,size,instructions,eligible,"
+			"eligible_bits,capacity_bytes,eligible_per_kb\n");
+	else
+		printf("[\n");
+
+	for (i = 0; i < nrows; i++)
+	{
+		if (fmt == REPORT_CSV) {
+			print_csv_str(rows[i].name);
+			printf(",0x%" PRIx64 ",%" PRIu64 ",%zu,%zu,%zu,%.3f,%.2f\n",
+				rows[i].addr, rows[i].size, rows[i].inst,
+				rows[i].eligible, rows[i].bits, rows[i].bits / 8.0,
+				rows[i].density);
+			continue;
+		}
+
+		printf("  {\"function\": ");
+		report_json_str(stdout, rows[i].name);
+		printf(", \"address\": %" PRIu64 ", \"size\": %" PRIu64
+			", \"instructions\": %zu, \"eligible\": %zu"
+			", \"eligible_bits\": %zu, \"capacity_bytes\": %.3f"
+			", \"eligible_per_kb\": %.2f}%s\n",
+			rows[i].addr, rows[i].size, rows[i].inst, rows[i].eligible,
+			rows[i].bits, rows[i].bits / 8.0, rows[i].density,
+			(i + 1 < nrows) ? "," : "");
+	}
+
+	if (fmt == REPORT_JSON)
+		printf("]\n");
+
+	free(rows);
+	return (1);
+}
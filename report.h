@@ -0,0 +1,48 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef REPORT_H
+#define REPORT_H
+
+	#include <stdio.h>
+	#include "decode.h"
+
+	/* Output formats. */
+	#define REPORT_CSV  1
+	#define REPORT_JSON 2
+
+	/* Sort keys. */
+	#define SORT_ELIGIBLE 0
+	#define SORT_DENSITY  1
+	#define SORT_SIZE     2
+	#define SORT_ADDR     3
+	#define SORT_NAME     4
+
+	extern int report_parse_format(const char *fmt);
+	extern int report_parse_sort(const char *key);
+	extern int report_functions(const struct decode_ctx *ctx, int fmt,
+		int sort);
+	extern void report_json_str(FILE *f, const char *str);
+
+#endif /* REPORT_H */
@@ -0,0 +1,111 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "stats.h"
+
+struct stats *stats;
+
+/* Phase names, as shown in the output. */
+static const char *const phase_names[PH_MAX] = {
+	"elf_parse", "copy_file", "load", "decode", "patch", "msync"
+};
+
+/**
+ * @brief Enables the statistics collection, to be printed
+ * at exit.
+ *
+ * @param fmt Output format, only "json" is supported.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int stats_enable(const char *fmt)
+{
+	if (strcmp(fmt, "json"))
+		return (0);
+
+	if (!(stats = calloc(1, sizeof(*stats))))
+		return (0);
+
+	atexit(stats_print);
+	return (1);
+}
+
+/**
+ * @brief Prints all the collected statistics as JSON to
+ * stderr. Since this is called at exit, it also runs when
+ * stelf aborts (e.g.: on a decoding error).
+ */
+void stats_print(void)
+{
+	const char *sep;
+	int i;
+
+	if (!stats)
+		return;
+
+	fprintf(stderr, "{\n  \"phases\": {");
+	for (i = 0, sep = ""; i < PH_MAX; i++, sep = ",")
+	{
+		fprintf(stderr, "%s\n    \"%s\": {\"wall_s\": %.6f, \"cpu_s\": ",
+			sep, phase_names[i], stats->wall[i]);
+
+		/* Patch time is only measured by the wall clock. */
+		if (i == PH_PATCH)
+			fprintf(stderr, "null}");
+		else
+			fprintf(stderr, "%.6f}", stats->cpu[i]);
+	}
+
+	fprintf(stderr, "\n  },\n  \"iclass\": {");
+	for (i = 0, sep = ""; i < XED_ICLASS_LAST; i++)
+	{
+		if (!stats->eligible[i])
+			continue;
+		fprintf(stderr, "%s\n    \"%s\": {\"eligible\": %" PRIu64
+			", \"patched\": %" PRIu64 "}", sep,
+			xed_iclass_enum_t2str((xed_iclass_enum_t)i),
+			stats->eligible[i], stats->patched[i]);
+		sep = ",";
+	}
+
+	fprintf(stderr, "\n  },\n  \"inst_len_hist\": [");
+	for (i = 1, sep = ""; i <= STATS_MAX_INST_LEN; i++, sep = ", ")
+		fprintf(stderr, "%s%" PRIu64, sep, stats->len_hist[i]);
+
+	fprintf(stderr,
+		"],\n"
+		"  \"decoded_inst\": %" PRIu64 ",\n"
+		"  \"decode_errors\": %" PRIu64 ",\n"
+		"  \"text_bytes\": %" PRIu64 ",\n"
+		"  \"decode_mb_s\": %.2f\n"
+		"}\n",
+		stats->decoded_inst, stats->decode_errors, stats->text_bytes,
+		stats->wall[PH_DECODE] > 0 ?
+			stats->text_bytes / (1024.0 * 1024.0) / stats->wall[PH_DECODE] : 0);
+}
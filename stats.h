@@ -0,0 +1,149 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+	#include <stdint.h>
+	#include <time.h>
+	#include <xed/xed-interface.h>
+
+	/* Phases. */
+	#define PH_ELF_PARSE 0
+	#define PH_COPY      1
+	#define PH_MMAP      2
+	#define PH_DECODE    3
+	#define PH_PATCH     4
+	#define PH_MSYNC     5
+	#define PH_MAX       6
+
+	#define STATS_MAX_INST_LEN 15
+
+	/*
+	 * Patch phase sampling: a clock read costs about as much as
+	 * decoding an instruction, so only one in STATS_PATCH_SAMPLE
+	 * patches is timed, and its time is scaled up.
+	 */
+	#define STATS_PATCH_SAMPLE 64
+
+	struct stats
+	{
+		/* Time spent in each phase, in seconds. */
+		double wall[PH_MAX];
+		double cpu[PH_MAX];
+
+		/* Per-iclass counters. */
+		uint64_t eligible[XED_ICLASS_LAST];
+		uint64_t patched[XED_ICLASS_LAST];
+
+		/* Instruction length histogram. */
+		uint64_t len_hist[STATS_MAX_INST_LEN + 1];
+
+		uint64_t decoded_inst;
+		uint64_t decode_errors;
+		uint64_t text_bytes;
+	};
+
+	struct stats_timer
+	{
+		struct timespec wall;
+		struct timespec cpu;
+	};
+
+	/*
+	 * Global statistics, NULL if disabled (--stats not
+	 * given). Only used in single-file mode.
+	 */
+	extern struct stats *stats;
+
+	extern int  stats_enable(const char *fmt);
+	extern void stats_print(void);
+
+	/**
+	 * @brief Starts the timer @p t, if statistics are enabled.
+	 *
+	 * @param t Timer.
+	 */
+	static inline void stats_begin(struct stats_timer *t)
+	{
+		if (!stats)
+			return;
+		clock_gettime(CLOCK_MONOTONIC, &t->wall);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t->cpu);
+	}
+
+	/**
+	 * @brief Stops the timer @p t and accounts the elapsed time
+	 * into the phase @p phase, if statistics are enabled.
+	 *
+	 * @param t     Timer.
+	 * @param phase Phase (PH_*).
+	 */
+	static inline void stats_end(const struct stats_timer *t, int phase)
+	{
+		struct timespec wall, cpu;
+		if (!stats)
+			return;
+		clock_gettime(CLOCK_MONOTONIC, &wall);
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+		stats->wall[phase] += (wall.tv_sec - t->wall.tv_sec) +
+			(wall.tv_nsec - t->wall.tv_nsec) / 1e9;
+		stats->cpu[phase]  += (cpu.tv_sec - t->cpu.tv_sec) +
+			(cpu.tv_nsec - t->cpu.tv_nsec) / 1e9;
+	}
+
+	/**
+	 * @brief Same as @ref stats_begin, but only starts the
+	 * wall-clock timer.
+	 *
+	 * @param t Timer.
+	 */
+	static inline void stats_begin_wall(struct stats_timer *t)
+	{
+		if (!stats)
+			return;
+		clock_gettime(CLOCK_MONOTONIC, &t->wall);
+	}
+
+	/**
+	 * @brief Same as @ref stats_end, but only accounts the
+	 * wall-clock time, multiplied by @p scale, for sampled
+	 * fine-grained measurements.
+	 *
+	 * @param t     Timer.
+	 * @param phase Phase (PH_*).
+	 * @param scale Amount of events this measurement stands for.
+	 */
+	static inline void stats_end_wall(const struct stats_timer *t,
+		int phase, unsigned scale)
+	{
+		struct timespec wall;
+		if (!stats)
+			return;
+		clock_gettime(CLOCK_MONOTONIC, &wall);
+		stats->wall[phase] += ((wall.tv_sec - t->wall.tv_sec) +
+			(wall.tv_nsec - t->wall.tv_nsec) / 1e9) * scale;
+	}
+
+#endif /* STATS_H */
@@ -0,0 +1,474 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "stream.h"
+
+/* Read states. */
+#define ST_HDR  0
+#define ST_RAW  1
+#define ST_BODY 2
+#define ST_DONE 3
+#define ST_LEN  4
+#define ST_IV   5
+
+/**
+ * @brief Finds out the payload length (for STREAM_LENGTH).
+ *
+ * If the input is not a regular file (e.g.: a pipe), it is
+ * copied to a temporary file first.
+ *
+ * @param s Stream.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int stream_get_length(struct stream *s)
+{
+	uint8_t buff[4096];
+	struct stat st;
+	off_t  pos;
+	size_t n;
+
+	if (!fstat(fileno(s->in), &st) && S_ISREG(st.st_mode) &&
+		(pos = ftello(s->in)) >= 0)
+	{
+		s->length = st.st_size - pos;
+		return (1);
+	}
+
+	if (!(s->tmp = tmpfile()))
+		return (0);
+
+	s->length = 0;
+	while ((n = fread(buff, 1, sizeof buff, s->in)) > 0) {
+		if (fwrite(buff, 1, n, s->tmp) != n)
+			return (0);
+		s->length += n;
+	}
+
+	rewind(s->tmp);
+	s->in = s->tmp;
+	return (1);
+}
+
+/**
+ * @brief Initializes the payload stream @p s.
+ *
+ * When writing, @p flags selects which features should be
+ * applied to the payload, and if non-zero, a header is
+ * emitted before the payload. When reading, @p flags must be
+ * 0: the header (if any) is detected automatically.
+ *
+ * @param s     Stream to be initialized.
+ * @param flags STREAM_* flags.
+ * @param in    Input file (payload source while writing).
+ * @param out   Output file (payload destination while reading).
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int stream_init(struct stream *s, unsigned flags, FILE *in, FILE *out)
+{
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	s->flags = flags;
+	s->in    = in;
+	s->out   = out;
+	s->state = ST_HDR;
+
+	if (!flags)
+		return (1);
+
+	memcpy(s->hdr, STREAM_MAGIC, 4);
+	s->hdr[4]  = STREAM_VERSION;
+	s->hdr[5]  = flags;
+	s->hdr_len = STREAM_HDR_SIZE;
+
+	if (flags & STREAM_LENGTH)
+	{
+		if (!stream_get_length(s))
+			return (0);
+		for (i = 0; i < 8; i++)
+			s->hdr[STREAM_HDR_SIZE + i] = s->length >> (8 * i);
+		s->hdr_len = STREAM_HDR_SIZE + 8;
+	}
+
+	if (flags & STREAM_COMPRESSED)
+	{
+		s->enc  = malloc(sizeof(*s->enc));
+		s->ibuf = malloc(LZ_BLOCK_SIZE);
+		s->obuf = malloc(LZ_MAX_BLOCK_OUT);
+		if (!s->enc || !s->ibuf || !s->obuf)
+			return (0);
+		lz_enc_init(s->enc);
+	}
+
+	return (1);
+}
+
+/**
+ * @brief Enables the payload encryption (AES-CTR) of the stream
+ * @p s, must be called right after stream_init().
+ *
+ * When writing, a random IV is generated and added to the
+ * header. When reading, the key is only used if the payload
+ * header says it is encrypted.
+ *
+ * @param s       Stream.
+ * @param key     Key.
+ * @param key_len Key length: 16, 24 or 32 bytes.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int stream_set_key(struct stream *s, const uint8_t *key, size_t key_len)
+{
+	if (key_len != 16 && key_len != 24 && key_len != 32)
+		return (0);
+
+	/* Reading: wait for the IV. */
+	if (!s->in) {
+		memcpy(s->key, key, key_len);
+		s->key_len = key_len;
+		return (1);
+	}
+
+	if (!s->hdr_len) {
+		memcpy(s->hdr, STREAM_MAGIC, 4);
+		s->hdr[4]  = STREAM_VERSION;
+		s->hdr_len = STREAM_HDR_SIZE;
+	}
+	s->flags |= STREAM_ENCRYPTED;
+	s->hdr[5] = s->flags;
+
+	if (getrandom(s->hdr + s->hdr_len, AES_BLOCK, 0) != AES_BLOCK)
+		return (0);
+	if (!(s->aes = malloc(sizeof(*s->aes))))
+		return (0);
+
+	aes_ctr_init(s->aes, key, key_len, s->hdr + s->hdr_len);
+	s->hdr_len += AES_BLOCK;
+	return (1);
+}
+
+/**
+ * @brief Encrypts/decrypts the payload byte @p c, if encryption
+ * is enabled.
+ *
+ * @param s Stream.
+ * @param c Payload byte.
+ *
+ * @return Returns the resulting byte.
+ */
+static inline int stream_crypt(struct stream *s, int c)
+{
+	if (!s->aes)
+		return (c);
+	return (c ^ aes_ctr_next(s->aes));
+}
+
+/**
+ * @brief Fills the stream output buffer with the next
+ * compressed block.
+ *
+ * @param s Stream.
+ *
+ * @return Returns 1 if there is data available, 0 if EOF.
+ */
+static int stream_fill(struct stream *s)
+{
+	size_t n;
+
+	if (s->eof)
+		return (0);
+
+	n = fread(s->ibuf, 1, LZ_BLOCK_SIZE, s->in);
+	if (!n) {
+		s->olen = lz_end_block(s->obuf);
+		s->eof  = 1;
+	}
+	else
+		s->olen = lz_compress_block(s->enc, s->ibuf, n, s->obuf);
+
+	s->opos        = 0;
+	s->raw_bytes  += n;
+	s->body_bytes += s->olen;
+	return (1);
+}
+
+/**
+ * @brief Returns the next byte to be embedded into the
+ * ELF file.
+ *
+ * @param s Stream.
+ *
+ * @return Returns the next byte, or -1 if EOF.
+ */
+int stream_next_byte(struct stream *s)
+{
+	int c;
+
+	if (s->hdr_pos < s->hdr_len)
+		return (s->hdr[s->hdr_pos++]);
+
+	if (!(s->flags & STREAM_COMPRESSED))
+	{
+		if ((c = getc(s->in)) == EOF)
+			return (-1);
+		s->raw_bytes++;
+		s->body_bytes++;
+		return (stream_crypt(s, c));
+	}
+
+	if (s->opos == s->olen && !stream_fill(s))
+		return (-1);
+
+	return (stream_crypt(s, s->obuf[s->opos++]));
+}
+
+/**
+ * @brief Writes the already read (and not matching) header
+ * bytes as regular payload.
+ *
+ * @param s Stream.
+ */
+static void stream_flush_hdr(struct stream *s)
+{
+	size_t n = s->hdr_len;
+
+	if (s->limit && n > s->limit - s->raw_bytes)
+		n = s->limit - s->raw_bytes;
+
+	fwrite(s->hdr, 1, n, s->out);
+	s->raw_bytes += n;
+	s->hdr_len    = 0;
+}
+
+/**
+ * @brief Checks if the read limit (if any) was reached.
+ *
+ * @param s Stream.
+ *
+ * @return Returns 1 if no more payload bytes should be output.
+ */
+static inline int stream_full(const struct stream *s)
+{
+	return (s->limit && s->raw_bytes >= s->limit);
+}
+
+/**
+ * @brief Parses the payload header read so far.
+ *
+ * @param s Stream.
+ *
+ * @return Returns 1 if success, 0 if the header is invalid
+ * or unsupported.
+ */
+static int stream_parse_hdr(struct stream *s)
+{
+	if (s->hdr[4] != STREAM_VERSION) {
+		ERR("Unsupported payload version (%d)!\n", s->hdr[4]);
+		return (0);
+	}
+
+	s->flags = s->hdr[5];
+	if (s->flags & STREAM_ENCRYPTED)
+	{
+		if (!s->key_len) {
+			ERR("Payload is encrypted, a key is required (--key-fd)!\n");
+			return (0);
+		}
+		if (!(s->aes = malloc(sizeof(*s->aes))))
+			return (0);
+	}
+
+	if (s->flags & STREAM_COMPRESSED)
+	{
+		if (!(s->dec = malloc(sizeof(*s->dec))))
+			return (0);
+		lz_dec_init(s->dec);
+		s->dec->limit = s->limit;
+	}
+	return (1);
+}
+
+/**
+ * @brief Returns the read state after the length field (if any)
+ * was read.
+ *
+ * @param s Stream.
+ *
+ * @return Returns ST_IV, ST_BODY or ST_DONE (empty payload).
+ */
+static int stream_body_state(const struct stream *s)
+{
+	if ((s->flags & STREAM_ENCRYPTED) && s->key_len)
+		return (ST_IV);
+	if ((s->flags & STREAM_LENGTH) && !s->length)
+		return (ST_DONE);
+	return (ST_BODY);
+}
+
+/**
+ * @brief Handles a byte extracted from the ELF file.
+ *
+ * @param s Stream.
+ * @param c Extracted byte.
+ *
+ * @return Returns 1 if more bytes are expected, or 0 if the
+ * payload has ended (or is invalid) and the reading should
+ * stop.
+ */
+int stream_put_byte(struct stream *s, int c)
+{
+	int ret;
+
+	switch (s->state)
+	{
+	case ST_HDR:
+		s->hdr[s->hdr_len++] = c;
+
+		/* Not our header: output everything as raw. */
+		if (s->hdr_len <= 4 && c != STREAM_MAGIC[s->hdr_len - 1]) {
+			stream_flush_hdr(s);
+			s->state = ST_RAW;
+			return (!stream_full(s));
+		}
+		else if (s->hdr_len == STREAM_HDR_SIZE) {
+			if (!stream_parse_hdr(s)) {
+				s->state = ST_DONE;
+				return (0);
+			}
+			s->state = (s->flags & STREAM_LENGTH) ?
+				ST_LEN : stream_body_state(s);
+		}
+		return (1);
+
+	case ST_LEN:
+		s->length |= (uint64_t)c << (8 * (s->hdr_len - STREAM_HDR_SIZE));
+		if (++s->hdr_len < STREAM_HDR_SIZE + 8)
+			return (1);
+
+		s->state = stream_body_state(s);
+		return (s->state != ST_DONE);
+
+	case ST_IV:
+		s->hdr[s->hdr_len++] = c;
+		if (s->hdr_len < STREAM_HDR_SIZE + AES_BLOCK +
+			((s->flags & STREAM_LENGTH) ? 8u : 0u))
+		{
+			return (1);
+		}
+
+		aes_ctr_init(s->aes, s->key, s->key_len,
+			s->hdr + s->hdr_len - AES_BLOCK);
+		memset(s->key, 0, sizeof(s->key));
+		s->key_len = 0;
+
+		s->state = stream_body_state(s);
+		return (s->state == ST_BODY);
+
+	case ST_RAW:
+		putc(c, s->out);
+		s->raw_bytes++;
+		return (!stream_full(s));
+
+	case ST_BODY:
+		c = stream_crypt(s, c);
+		s->body_bytes++;
+		if (!(s->flags & STREAM_COMPRESSED)) {
+			putc(c, s->out);
+			s->raw_bytes++;
+			ret = 1;
+		}
+		else {
+			ret = lz_dec_put(s->dec, c, s->out);
+			s->raw_bytes = s->dec->total;
+			if (ret < 0)
+				ERR("Corrupted compressed payload!\n");
+			if (s->limit && s->raw_bytes > s->limit)
+				s->raw_bytes = s->limit;
+		}
+
+		/* Length frame: stop as soon as everything was read. */
+		if ((s->flags & STREAM_LENGTH) && s->raw_bytes >= s->length)
+			ret = 0;
+
+		/* Read limit (-r <amnt>). */
+		if (ret > 0 && stream_full(s))
+			ret = 0;
+
+		if (ret > 0)
+			return (1);
+		s->state = ST_DONE;
+		return (0);
+	}
+
+	return (0);
+}
+
+/**
+ * @brief Finishes the stream: flushes the pending bytes and
+ * release all the resources.
+ *
+ * @param s Stream.
+ */
+void stream_finish(struct stream *s)
+{
+	/* Too few bytes read to tell if there is a header. */
+	if (s->out && s->state == ST_HDR && s->hdr_len)
+		stream_flush_hdr(s);
+
+	if (s->state == ST_LEN || s->state == ST_IV || (s->state == ST_BODY &&
+		(s->flags & (STREAM_COMPRESSED|STREAM_LENGTH))))
+	{
+		ERR("WARNING: payload is truncated!\n");
+	}
+
+	if (s->out)
+		fflush(s->out);
+
+	if (s->tmp)
+		fclose(s->tmp);
+
+	if (s->aes)
+		aes_ctr_wipe(s->aes);
+	memset(s->key, 0, sizeof(s->key));
+
+	free(s->aes);
+	free(s->enc);
+	free(s->dec);
+	free(s->ibuf);
+	free(s->obuf);
+	s->aes  = NULL;
+	s->enc  = NULL;
+	s->dec  = NULL;
+	s->ibuf = NULL;
+	s->obuf = NULL;
+	s->tmp  = NULL;
+}
@@ -0,0 +1,102 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+	#include <stdio.h>
+	#include <stdint.h>
+
+	#include "aes.h"
+	#include "lz.h"
+
+	/*
+	 * Payload header:
+	 * Only emitted if some feature that requires it was
+	 * enabled, otherwise the payload is written as-is.
+	 *
+	 *   magic[4]  "STLF"
+	 *   version   STREAM_VERSION
+	 *   flags     STREAM_* flags below
+	 *   length    (only if STREAM_LENGTH) 64-bit little-endian
+	 *             payload size, before compression.
+	 *   iv[16]    (only if STREAM_ENCRYPTED) random initial
+	 *             AES-CTR counter block.
+	 *
+	 * Everything after the header is encrypted (after being
+	 * compressed) if STREAM_ENCRYPTED is set.
+	 */
+	#define STREAM_MAGIC    "STLF"
+	#define STREAM_VERSION  1
+	#define STREAM_HDR_SIZE 6
+	#define STREAM_HDR_MAX  30
+
+	/* Header flags. */
+	#define STREAM_COMPRESSED 1
+	#define STREAM_LENGTH     2
+	#define STREAM_ENCRYPTED  4
+
+	struct stream
+	{
+		unsigned flags;
+		FILE *in;
+		FILE *out;
+
+		/* Header. */
+		uint8_t  hdr[STREAM_HDR_MAX];
+		uint64_t length; /* If STREAM_LENGTH. */
+		uint64_t limit;  /* Read: max payload bytes, 0 = all. */
+		FILE    *tmp;    /* Input copy, if not a regular file. */
+		unsigned hdr_len;
+		unsigned hdr_pos;
+		int      state;
+
+		/* Compression. */
+		struct lz_enc *enc;
+		struct lz_dec *dec;
+		uint8_t *ibuf;
+		uint8_t *obuf;
+		size_t   olen;
+		size_t   opos;
+		int      eof;
+
+		/* Encryption. */
+		struct aes_ctr *aes;
+		uint8_t  key[32]; /* Until the IV is read. */
+		size_t   key_len;
+
+		/* Statistics. */
+		uint64_t raw_bytes;  /* Bytes read from/written to the user. */
+		uint64_t body_bytes; /* Bytes after compression, sans header. */
+	};
+
+	extern int  stream_init(struct stream *s, unsigned flags,
+		FILE *in, FILE *out);
+	extern int  stream_set_key(struct stream *s, const uint8_t *key,
+		size_t key_len);
+	extern int  stream_next_byte(struct stream *s);
+	extern int  stream_put_byte(struct stream *s, int c);
+	extern void stream_finish(struct stream *s);
+
+#endif /* STREAM_H */
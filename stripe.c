@@ -0,0 +1,578 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "decode.h"
+#include "stripe.h"
+#include "util.h"
+#include "main.h"
+
+/* Work shared between all the worker threads. */
+struct stripe_job
+{
+	struct stripe *stripes;
+	int      nstripes;
+	int      next;  /* Next stripe to be processed. */
+	unsigned flags; /* FLG_SCAN, FLG_WRITE or FLG_READ. */
+};
+
+/**
+ * @brief Returns the next payload byte of the stripe
+ * pointed by @p data.
+ *
+ * @param data Stripe.
+ *
+ * @return Returns the next byte, or -1 if the stripe is over.
+ */
+static int stripe_get_byte(void *data)
+{
+	struct stripe *st = data;
+	if (st->pos == st->len)
+		return (-1);
+	return (st->payload[st->off + st->pos++]);
+}
+
+/**
+ * @brief Saves the byte @p c read from the ELF file into the
+ * stripe pointed by @p data.
+ *
+ * @param data Stripe.
+ * @param c    Read byte.
+ *
+ * @return Returns 1 if more bytes are expected, 0 otherwise.
+ */
+static int stripe_put_byte(void *data, int c)
+{
+	struct stripe *st = data;
+	st->payload[st->off + st->pos++] = c;
+	return (st->pos < st->len);
+}
+
+/**
+ * @brief Process (scan, write or read) a single stripe.
+ *
+ * @param st    Stripe to be processed.
+ * @param flags Mode: FLG_SCAN, FLG_WRITE or FLG_READ.
+ */
+static void stripe_process(struct stripe *st, unsigned flags)
+{
+	struct decode_ctx ctx;
+
+	decode_init(&ctx, flags);
+	ctx.get_byte = stripe_get_byte;
+	ctx.put_byte = stripe_put_byte;
+	ctx.data     = st;
+	ctx.amnt_should_read = st->len * 8;
+
+	if ((flags & FLG_READ) && !st->len) {
+		st->ok = 1;
+		return;
+	}
+
+	if (!init_elf(&ctx.info, st->path,
+		(flags & FLG_WRITE) ? st->out_path : NULL))
+	{
+		ERR("Unable to initialize ELF file (%s)!\n", st->path);
+		return;
+	}
+
+	/*
+	 * Empty stripes are still listed in the manifest, so their
+	 * output file is created too, as an unchanged copy.
+	 */
+	if (st->len || (flags & FLG_SCAN))
+		decode_instructions(&ctx);
+	decode_release(&ctx);
+	munmap_elf(&ctx.info);
+
+	if (flags & FLG_SCAN)
+		st->capacity = ctx.capacity_bits / 8;
+
+	/* Check if the whole slice was written/read. */
+	st->ok = (flags & FLG_SCAN) || st->pos == st->len;
+}
+
+/**
+ * @brief Worker thread: process stripes until there is no
+ * stripe left.
+ *
+ * @param arg Job.
+ *
+ * @return Always NULL.
+ */
+static void *stripe_worker(void *arg)
+{
+	struct stripe_job *job = arg;
+	int idx;
+
+	while ((idx = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED))
+		< job->nstripes)
+	{
+		stripe_process(&job->stripes[idx], job->flags);
+	}
+	return (NULL);
+}
+
+/**
+ * @brief Process all the stripes in @p stripes using up to
+ * @p nthreads threads.
+ *
+ * @param stripes  Stripe list.
+ * @param nstripes Amount of stripes.
+ * @param flags    Mode: FLG_SCAN, FLG_WRITE or FLG_READ.
+ * @param nthreads Amount of threads.
+ *
+ * @return Returns 1 if all stripes were processed successfully,
+ * 0 otherwise.
+ */
+static int stripe_run(struct stripe *stripes, int nstripes,
+	unsigned flags, int nthreads)
+{
+	struct stripe_job job;
+	pthread_t *tids;
+	int i, started;
+
+	job.stripes  = stripes;
+	job.nstripes = nstripes;
+	job.next     = 0;
+	job.flags    = flags;
+
+	if (nthreads > nstripes)
+		nthreads = nstripes;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if (!(tids = calloc(nthreads, sizeof(*tids))))
+		return (0);
+
+	for (started = 0; started < nthreads; started++)
+		if (pthread_create(&tids[started], NULL, stripe_worker, &job))
+			break;
+
+	/* If no thread could be started, do the work ourselves. */
+	if (!started)
+		stripe_worker(&job);
+
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+
+	for (i = 0; i < nstripes; i++)
+		if (!stripes[i].ok)
+			return (0);
+	return (1);
+}
+
+/**
+ * @brief Distributes @p len bytes of payload among all the
+ * stripes, proportionally to the capacity of each file.
+ *
+ * @param stripes  Stripe list.
+ * @param nstripes Amount of stripes.
+ * @param len      Payload length, must not exceed the total
+ *                 capacity.
+ */
+static void stripe_assign(struct stripe *stripes, int nstripes,
+	uint64_t len)
+{
+	uint64_t total_cap;
+	uint64_t assigned;
+	uint64_t off;
+	int i;
+
+	total_cap = 0;
+	for (i = 0; i < nstripes; i++)
+		total_cap += stripes[i].capacity;
+
+	assigned = 0;
+	for (i = 0; i < nstripes && total_cap; i++) {
+		stripes[i].len = (uint64_t)
+			((long double)len * stripes[i].capacity / total_cap);
+		if (stripes[i].len > stripes[i].capacity)
+			stripes[i].len = stripes[i].capacity;
+		assigned += stripes[i].len;
+	}
+
+	/* Rounding leftovers go to whoever still has room. */
+	while (assigned < len) {
+		for (i = 0; i < nstripes && assigned < len; i++) {
+			if (stripes[i].len < stripes[i].capacity) {
+				stripes[i].len++;
+				assigned++;
+			}
+		}
+	}
+
+	for (off = 0, i = 0; i < nstripes; i++) {
+		stripes[i].off = off;
+		off += stripes[i].len;
+	}
+}
+
+/**
+ * @brief Builds the output path for each stripe, as
+ * out_dir/basename, and creates the output directory.
+ *
+ * @param stripes  Stripe list.
+ * @param nstripes Amount of stripes.
+ * @param out_dir  Output directory.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int stripe_out_paths(struct stripe *stripes, int nstripes,
+	const char *out_dir)
+{
+	const char *base;
+	size_t size;
+	int i, j;
+
+	if (mkdir(out_dir, 0755) < 0 && errno != EEXIST) {
+		ERR("Unable to create output directory (%s)!\n", out_dir);
+		return (0);
+	}
+
+	for (i = 0; i < nstripes; i++)
+	{
+		base = strrchr(stripes[i].path, '/');
+		base = base ? base + 1 : stripes[i].path;
+		size = strlen(out_dir) + strlen(base) + 2;
+
+		if (!(stripes[i].out_path = malloc(size)))
+			return (0);
+		snprintf(stripes[i].out_path, size, "%s/%s", out_dir, base);
+
+		for (j = 0; j < i; j++) {
+			if (!strcmp(stripes[i].out_path, stripes[j].out_path)) {
+				ERR("Duplicate output file: %s!\n", stripes[i].out_path);
+				return (0);
+			}
+		}
+	}
+	return (1);
+}
+
+/**
+ * @brief Writes the manifest file that describes how the
+ * payload was striped.
+ *
+ * @param manifest Manifest file path.
+ * @param stripes  Stripe list.
+ * @param nstripes Amount of stripes.
+ * @param len      Total payload length.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+static int stripe_write_manifest(const char *manifest,
+	const struct stripe *stripes, int nstripes, uint64_t len)
+{
+	FILE *f;
+	int i;
+
+	if (!(f = fopen(manifest, "w")))
+		return (0);
+
+	fprintf(f, "%s\n%d %" PRIu64 "\n", MANIFEST_MAGIC, nstripes, len);
+	for (i = 0; i < nstripes; i++)
+		fprintf(f, "%" PRIu64 " %" PRIu64 " %s\n",
+			stripes[i].off, stripes[i].len, stripes[i].out_path);
+
+	return (fclose(f) == 0);
+}
+
+/**
+ * @brief Releases a stripe list.
+ *
+ * @param stripes  Stripe list.
+ * @param nstripes Amount of stripes.
+ * @param payload  Payload buffer.
+ */
+static void stripe_free(struct stripe *stripes, int nstripes,
+	uint8_t *payload)
+{
+	int i;
+	for (i = 0; i < nstripes; i++)
+		free(stripes[i].out_path);
+	free(stripes);
+	free(payload);
+}
+
+/**
+ * @brief Reads the whole payload from the stream @p s, up to
+ * @p max bytes.
+ *
+ * @param s   Payload stream.
+ * @param max Max amount of bytes to be read.
+ * @param len Returned payload length.
+ * @param eof Returned EOF status: 1 if the whole input was read.
+ *
+ * @return Returns the payload buffer, or NULL if error.
+ */
+static uint8_t *stripe_read_payload(struct stream *s, uint64_t max,
+	uint64_t *len, int *eof)
+{
+	uint8_t *payload, *tmp;
+	uint64_t size;
+	int c;
+
+	size    = 4096;
+	*len    = 0;
+	*eof    = 0;
+	payload = malloc(size);
+
+	while (payload && *len < max)
+	{
+		if ((c = stream_next_byte(s)) < 0) {
+			*eof = 1;
+			break;
+		}
+		if (*len == size) {
+			size *= 2;
+			if (!(tmp = realloc(payload, size)))
+				free(payload);
+			payload = tmp;
+			if (!payload)
+				break;
+		}
+		payload[(*len)++] = c;
+	}
+
+	/* Check if there is something left. */
+	if (payload && !*eof)
+		*eof = stream_next_byte(s) < 0;
+
+	return (payload);
+}
+
+/**
+ * @brief Stripes the payload read from @p s among all the
+ * ELF files in @p files.
+ *
+ * All files are scanned in parallel and each one receives a
+ * slice of the payload proportional to its capacity. The output
+ * files are then written in parallel to @p out_dir, and a
+ * manifest describing the slices is saved in @p manifest.
+ *
+ * @param files    ELF files list.
+ * @param nfiles   Amount of files.
+ * @param out_dir  Output directory.
+ * @param manifest Manifest file path.
+ * @param s        Payload stream.
+ * @param nthreads Amount of threads.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int stripe_write(char **files, int nfiles, const char *out_dir,
+	const char *manifest, struct stream *s, int nthreads)
+{
+	struct stripe *stripes;
+	uint64_t total_cap;
+	uint8_t *payload;
+	uint64_t len;
+	int eof;
+	int ret;
+	int i;
+
+	ret     = 0;
+	payload = NULL;
+
+	if (!(stripes = calloc(nfiles, sizeof(*stripes))))
+		return (0);
+
+	for (i = 0; i < nfiles; i++)
+		stripes[i].path = files[i];
+
+	if (!stripe_out_paths(stripes, nfiles, out_dir))
+		goto out;
+
+	/* Scan everything. */
+	if (!stripe_run(stripes, nfiles, FLG_SCAN, nthreads))
+		errto(out, "Unable to scan all ELF files!\n");
+
+	total_cap = 0;
+	for (i = 0; i < nfiles; i++)
+		total_cap += stripes[i].capacity;
+
+	/* Read the payload and split it. */
+	if (!(payload = stripe_read_payload(s, total_cap, &len, &eof)))
+		errto(out, "Unable to read the payload!\n");
+
+	stripe_assign(stripes, nfiles, len);
+	for (i = 0; i < nfiles; i++)
+		stripes[i].payload = payload;
+
+	/* Write everything. */
+	if (!stripe_run(stripes, nfiles, FLG_WRITE, nthreads))
+		errto(out, "Unable to write all ELF files!\n");
+
+	if (!stripe_write_manifest(manifest, stripes, nfiles, len))
+		errto(out, "Unable to write manifest (%s)!\n", manifest);
+
+	printf("Write summary:\n");
+	for (i = 0; i < nfiles; i++)
+		printf("  %s: %" PRIu64 " bytes (out of %" PRIu64 ")\n",
+			stripes[i].out_path, stripes[i].len, stripes[i].capacity);
+	printf("Wrote %" PRIu64 " bytes into %d files\n", len, nfiles);
+
+	if (!eof)
+		printf(
+			"WARNING: Entire input was not written!\n"
+			"Please check the max amnt of bytes available to write!\n");
+
+	ret = 1;
+out:
+	stripe_free(stripes, nfiles, payload);
+	return (ret);
+}
+
+/**
+ * @brief Loads the manifest file @p manifest.
+ *
+ * @param manifest Manifest file path.
+ * @param nstripes Returned amount of stripes.
+ * @param len      Returned total payload length.
+ *
+ * @return Returns the stripe list, or NULL if error.
+ */
+static struct stripe *stripe_load_manifest(const char *manifest,
+	int *nstripes, uint64_t *len)
+{
+	struct stripe *stripes;
+	char line[4096];
+	uint64_t end;
+	size_t plen;
+	FILE *f;
+	int n, i;
+
+	stripes = NULL;
+	if (!(f = fopen(manifest, "r")))
+		errto(out0, "Unable to open manifest (%s)!\n", manifest);
+
+	if (!fgets(line, sizeof line, f) ||
+		strncmp(line, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC) - 1))
+	{
+		errto(out1, "Invalid manifest file!\n");
+	}
+
+	if (!fgets(line, sizeof line, f) ||
+		sscanf(line, "%d %" SCNu64, nstripes, len) != 2 ||
+		*nstripes <= 0)
+	{
+		errto(out1, "Invalid manifest file!\n");
+	}
+
+	if (!(stripes = calloc(*nstripes, sizeof(*stripes))))
+		goto out1;
+
+	for (end = 0, i = 0; i < *nstripes; i++)
+	{
+		if (!fgets(line, sizeof line, f) ||
+			sscanf(line, "%" SCNu64 " %" SCNu64 " %n",
+				&stripes[i].off, &stripes[i].len, &n) != 2)
+		{
+			errto(out2, "Invalid manifest entry (%d)!\n", i);
+		}
+
+		if (stripes[i].off != end)
+			errto(out2, "Non-contiguous manifest entry (%d)!\n", i);
+		end += stripes[i].len;
+
+		plen = strcspn(line + n, "\n");
+		if (!(stripes[i].path = strndup(line + n, plen)))
+			goto out2;
+	}
+
+	if (end != *len)
+		errto(out2, "Manifest length mismatch!\n");
+
+	fclose(f);
+	return (stripes);
+out2:
+	for (i = 0; i < *nstripes; i++)
+		free(stripes[i].path);
+	free(stripes);
+	stripes = NULL;
+out1:
+	fclose(f);
+out0:
+	return (stripes);
+}
+
+/**
+ * @brief Reads back (in parallel) a payload previously striped
+ * with @ref stripe_write, and outputs it to the stream @p s.
+ *
+ * @param manifest   Manifest file path.
+ * @param s          Payload stream.
+ * @param amnt_bytes Max amount of bytes to be read (0 = everything).
+ * @param nthreads   Amount of threads.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int stripe_read(const char *manifest, struct stream *s,
+	uint64_t amnt_bytes, int nthreads)
+{
+	struct stripe *stripes;
+	uint8_t *payload;
+	uint64_t len, i;
+	int nstripes;
+	int ret;
+	int j;
+
+	ret = 0;
+	if (!(stripes = stripe_load_manifest(manifest, &nstripes, &len)))
+		return (0);
+
+	/*
+	 * The limit counts payload bytes, which may be compressed and
+	 * follow the stream header, so it is applied by the stream.
+	 */
+	s->limit = amnt_bytes;
+
+	if (!(payload = malloc(len ? len : 1)))
+		goto out;
+
+	for (j = 0; j < nstripes; j++)
+		stripes[j].payload = payload;
+
+	if (!stripe_run(stripes, nstripes, FLG_READ, nthreads))
+		errto(out, "Unable to read all ELF files!\n");
+
+	for (i = 0; i < len; i++)
+		if (!stream_put_byte(s, payload[i]))
+			break;
+
+	ret = 1;
+out:
+	for (j = 0; j < nstripes; j++)
+		free(stripes[j].path);
+	stripe_free(stripes, nstripes, payload);
+	return (ret);
+}
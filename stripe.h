@@ -0,0 +1,55 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef STRIPE_H
+#define STRIPE_H
+
+	#include <stdint.h>
+	#include "stream.h"
+
+	#define MANIFEST_MAGIC "STELF-MANIFEST 1"
+
+	/**
+	 * A single stripe: a contiguous slice of the payload that
+	 * is stored into (or read from) a single ELF file.
+	 */
+	struct stripe
+	{
+		char    *path;     /* ELF file path.                  */
+		char    *out_path; /* Output file (when writing).     */
+		uint64_t capacity; /* Capacity in bytes.              */
+		uint64_t off;      /* Slice offset in the payload.    */
+		uint64_t len;      /* Slice length.                   */
+		uint64_t pos;      /* Current position in the slice.  */
+		uint8_t *payload;
+		int      ok;
+	};
+
+	extern int stripe_write(char **files, int nfiles, const char *out_dir,
+		const char *manifest, struct stream *s, int nthreads);
+
+	extern int stripe_read(const char *manifest, struct stream *s,
+		uint64_t amnt_bytes, int nthreads);
+
+#endif /* STRIPE_H */
@@ -23,12 +23,14 @@
  */
 
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
-#include <sys/mman.h>
 #include <sys/sendfile.h>
 
 #include "elf.h"
+#include "io.h"
+#include "stats.h"
 #include "util.h"
 
 /**
@@ -58,18 +60,20 @@ char *get_inst_str(const xed_decoded_inst_t *inst)
  *
  * @param buff  Buffer pointed to be beginning of the instruction.
  * @param len   Instruction length.
+ * @param mode  Already decoded instruction whose machine mode
+ *              should be used.
  * @param inst2 Pointer that will save the decoded instruction.
  *
  * @return Instruction string if success, NULL otherwise.
  */
-char *get_inst_str_from_buff(
-	const uint8_t *buff, size_t len, xed_decoded_inst_t *inst2)
+char *get_inst_str_from_buff(const uint8_t *buff, size_t len,
+	const xed_decoded_inst_t *mode, xed_decoded_inst_t *inst2)
 {
 	static xed_decoded_inst_t inst;
 	xed_error_enum_t xed_error;
 
-	xed_decoded_inst_zero(&inst);
-	xed_decoded_inst_set_mode(&inst, machine_mode, machine_address);
+	inst = *mode;
+	xed_decoded_inst_zero_keep_mode(&inst);
 
 	/* Decode instruction. */
 	xed_error = xed_decode(&inst, buff, len);
@@ -128,41 +132,15 @@ void print_inst_detailed(const xed_decoded_inst_t *inst)
 }
 
 /**
- * @brief Compares the string representations of two instructions.
- *
- * @param inst1 Pointer to the first decoded instruction.
- * @param inst2 Pointer to the buffer containing the second
- *              instruction.
- * @param ret_decoded_inst2 Pointer to the structure that will store
- *                          the decoded representation of the second
- *                          instruction.
- *
- * @return Returns 1 if the string representations of the two
- * instructions match, 0 otherwise.
-*/
-int is_decoded_inst_equals_to_inst_buff(
-	const xed_decoded_inst_t *inst1,
-	const uint8_t *inst2,
-	xed_decoded_inst_t *ret_decoded_inst2)
+ * @brief Returns the current monotonic time, in seconds.
+ *
+ * @return Current time, in seconds.
+ */
+double time_now(void)
 {
-	char inst1_str[16] = {0};
-	char inst2_str[16] = {0};
-	char *tmp;
-
-	/* Instruction 1 string. */
-	tmp = get_inst_str(inst1);
-	strncpy(inst1_str, tmp, 15);
-
-	/* Instruction 2 string. */
-	tmp = get_inst_str_from_buff(inst2, 15, ret_decoded_inst2);
-	if (!tmp)
-	{
-		ERR("Invalid new instruction!!!\n");
-		return (0);
-	}
-	strncpy(inst2_str, tmp, 15);
-
-	return strcmp(inst1_str, inst2_str) == 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
 }
 
 /**
@@ -198,45 +176,137 @@ out0:
 }
 
 /**
- * @brief Map the contents of an ELF file into memory.
+ * @brief Sets the XED machine mode accordingly with the ELF
+ * machine type of an already parsed ELF file.
+ *
+ * @param info ELF file info structure.
+ */
+void set_machine_mode(struct elf_file_info *info)
+{
+	if (info->elf_machine_type == 64) {
+		info->machine_mode    = XED_MACHINE_MODE_LONG_64;
+		info->machine_address = XED_ADDRESS_WIDTH_64b;
+	} else {
+		info->machine_mode    = XED_MACHINE_MODE_LEGACY_32;
+		info->machine_address = XED_ADDRESS_WIDTH_32b;
+	}
+}
+
+/**
+ * @brief Initializes the input ELF file pointed by @p in,
+ * and fill @p info with the relevant info.
+ *
+ * If @p out is not NULL, a copy of the input file is created
+ * and loaded as read/write, otherwise the input file is
+ * loaded as read-only. If @p out is the input file itself, it
+ * is loaded as read/write, without any copy (update in place).
+ * The file is opened and loaded only once: the ELF headers are
+ * parsed from the loaded contents.
  *
  * @param info ELF file info structure.
+ * @param in   Path to the ELF file to read.
+ * @param out  Path to the output file, or NULL.
  *
  * @return Returns 1 if success, 0 otherwise.
  */
-int mmap_elf(struct elf_file_info *info)
+int init_elf(struct elf_file_info *info, const char *in, const char *out)
 {
-	struct stat st = {0};
-	int prot;
-	int flag;
+	struct stats_timer t;
+	struct stat st_in, st_out;
+	int inplace;
+	int fd_in;
+	int fd_out = 0;
+	int ret;
 
-	prot = (info->rdwr) ? PROT_READ|PROT_WRITE : PROT_READ;
-	flag = (info->rdwr) ? MAP_SHARED : MAP_PRIVATE;
+	if (!in)
+		return (0);
 
-	fstat(info->elf_fd, &st);
-	info->file_buff = mmap(0, st.st_size, prot, flag, info->elf_fd, 0);
-	info->file_size = st.st_size;
+	/* Writing into the input file itself: no copy. */
+	inplace = out && !stat(in, &st_in) && !stat(out, &st_out) &&
+		st_in.st_dev == st_out.st_dev && st_in.st_ino == st_out.st_ino;
 
-	if (info->file_buff == MAP_FAILED)
+	if ((fd_in = open(in, inplace ? O_RDWR : O_RDONLY)) < 0) {
+		ERR("Unable to open %s!\n", in);
 		return (0);
+	}
+
+	/* Create output file (if required) to be processed. */
+	if (inplace) {
+		info->elf_fd = fd_in;
+		info->rdwr   = 1;
+	}
+	else if (out) {
+		stats_begin(&t);
+		fd_out = copy_file(fd_in, out);
+		stats_end(&t, PH_COPY);
+		if (fd_out < 0)
+			errto(out_close_fdin, "Unable to create a file copy, aborting...\n");
+		close(fd_in);
+		info->elf_fd = fd_out;
+		info->rdwr   = 1;
+	}
+	else {
+		info->elf_fd = fd_in;
+		info->rdwr   = 0;
+	}
 
+	stats_begin(&t);
+	ret = mmap_elf(info);
+	stats_end(&t, PH_MMAP);
+	if (!ret)
+		errto(out_close_fd, "Unable to load ELF file!\n");
+
+	/* Parse the headers directly from the loaded file. */
+	stats_begin(&t);
+	ret = parse_elf_text(info);
+	stats_end(&t, PH_ELF_PARSE);
+	if (!ret)
+		goto out_unload;
+
+	set_machine_mode(info);
 	return (1);
+
+out_unload:
+	io_release(info);
+out_close_fd:
+	close(info->elf_fd);
+	if (info->rdwr && !inplace)
+		unlink(out);
+	return (0);
+out_close_fdin:
+	close(fd_in);
+	return (0);
 }
 
 /**
- * @Brief Deallocates the resources of the MMAPed ELF file.
+ * @brief Loads the contents of an ELF file into memory, with
+ * the current I/O backend (mmap by default, see io.c).
+ *
+ * @param info ELF file info structure.
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int mmap_elf(struct elf_file_info *info)
+{
+	return (io_load(info));
+}
+
+/**
+ * @Brief Deallocates the resources of the loaded ELF file,
+ * writing back the changes if opened as read/write.
  *
  * @param info ELF file info structure.
  */
 void munmap_elf(struct elf_file_info *info)
 {
+	struct stats_timer t;
+
 	if (info->rdwr) {
-		msync (info->file_buff, info->file_size, MS_SYNC);
-		munmap(info->file_buff, info->file_size);
-		close (info->elf_fd);
+		stats_begin(&t);
+		io_sync(info);
+		stats_end(&t, PH_MSYNC);
 	}
-	else
-		munmap(info->file_buff, info->file_size);
 
-	unload_elf_text();
+	io_release(info);
+	close(info->elf_fd);
 }
@@ -34,19 +34,18 @@
 
 	extern char *get_inst_str(const xed_decoded_inst_t *inst);
 
-	extern char *get_inst_str_from_buff(
-		const uint8_t *buff, size_t len, xed_decoded_inst_t *inst2);
+	extern char *get_inst_str_from_buff(const uint8_t *buff, size_t len,
+		const xed_decoded_inst_t *mode, xed_decoded_inst_t *inst2);
 
 	extern void print_inst_str(const xed_decoded_inst_t *inst);
 	extern void print_inst_detailed(const xed_decoded_inst_t *inst);
 
-	extern int is_decoded_inst_equals_to_inst_buff(
-		const xed_decoded_inst_t *inst1,
-		const uint8_t *inst2,
-		xed_decoded_inst_t *ret_decoded_inst2);
-
+	extern double time_now(void);
 	extern int copy_file(int fd_in, const char *out_file);
 
+	extern void set_machine_mode(struct elf_file_info *info);
+	extern int init_elf(struct elf_file_info *info, const char *in,
+		const char *out);
 	extern int mmap_elf(struct elf_file_info *info);
 	extern void munmap_elf(struct elf_file_info *info);
 
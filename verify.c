@@ -0,0 +1,558 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xed/xed-interface.h>
+
+#include "decode.h"
+#include "elf.h"
+#include "verify.h"
+#include "main.h"
+
+/* Kinds of reported mismatches. */
+#define VMSG_INST   0 /* Changed instruction is not equivalent.  */
+#define VMSG_SKIP   1 /* Skipped (undecodable) range was changed. */
+#define VMSG_DECODE 2 /* Original .text is not decodable.         */
+
+/* Mismatch kept to be reported, see verify_print(). */
+struct verify_msg
+{
+	int kind;
+	uint64_t off;
+	const char *from; /* Original iclass (VMSG_INST).            */
+	const char *to;   /* Patched iclass, or "invalid".           */
+};
+
+/* Verification job: a range of the .text section. */
+struct verify_job
+{
+	const struct elf_file_info *orig;
+	const struct elf_file_info *patched;
+	uint64_t start;      /* .text offset.                   */
+	uint64_t end;        /* .text offset.                   */
+	uint64_t stop;       /* Where the decoding actually stopped. */
+	size_t   mismatches;
+
+	/* Skip map (--resync): ranges that must be left untouched. */
+	const struct decode_skip *skips;
+	size_t nskips;
+
+	/*
+	 * First mismatches found, only printed once the pass is known
+	 * to be final (it may be redone by a single thread).
+	 */
+	struct verify_msg msgs[VERIFY_MAX_REPORT];
+	size_t nmsgs;
+};
+
+/**
+ * @brief Decodes the instruction in @p buff with the same
+ * machine mode of the already decoded instruction @p mode.
+ *
+ * @param mode Already decoded instruction.
+ * @param buff Instruction buffer.
+ * @param len  Max instruction length.
+ * @param inst Decoded instruction (output).
+ *
+ * @return Returns 1 if success, 0 otherwise.
+ */
+int inst_decode_as(const xed_decoded_inst_t *mode,
+	const uint8_t *buff, unsigned len, xed_decoded_inst_t *inst)
+{
+	*inst = *mode;
+	xed_decoded_inst_zero_keep_mode(inst);
+	return (xed_decode(inst, buff, len) == XED_ERROR_NONE);
+}
+
+/**
+ * @brief Checks if the register operand @p i of @p a was
+ * swapped with another register operand (with the same access)
+ * in @p b.
+ *
+ * @param a  First instruction.
+ * @param b  Second instruction.
+ * @param xi Instruction template (same for both).
+ * @param i  Operand index.
+ *
+ * @return Returns 1 if swapped, 0 otherwise.
+ */
+static int reg_swapped(const xed_decoded_inst_t *a,
+	const xed_decoded_inst_t *b, const xed_inst_t *xi, unsigned i)
+{
+	xed_operand_enum_t name_i, name_j;
+	unsigned j, n;
+
+	name_i = xed_operand_name(xed_inst_operand(xi, i));
+	n      = xed_inst_noperands(xi);
+
+	for (j = 0; j < n; j++)
+	{
+		name_j = xed_operand_name(xed_inst_operand(xi, j));
+		if (j == i || !xed_operand_is_register(name_j) ||
+			xed_operand_rw(xed_inst_operand(xi, j)) !=
+			xed_operand_rw(xed_inst_operand(xi, i)))
+		{
+			continue;
+		}
+
+		if (xed_decoded_inst_get_reg(a, name_i) ==
+				xed_decoded_inst_get_reg(b, name_j) &&
+			xed_decoded_inst_get_reg(a, name_j) ==
+				xed_decoded_inst_get_reg(b, name_i))
+		{
+			return (1);
+		}
+	}
+	return (0);
+}
+
+/**
+ * @brief Checks if two decoded instructions are equivalent,
+ * i.e., have the same iclass, length, operand width, flags
+ * and operands (in the same order, or with swapped sources if
+ * commutative), regardless of how they are encoded. NOPs only
+ * need the same iclass and length.
+ *
+ * @param a First instruction.
+ * @param b Second instruction.
+ *
+ * @return Returns 1 if equivalent, 0 otherwise.
+ */
+int inst_equivalent(const xed_decoded_inst_t *a,
+	const xed_decoded_inst_t *b)
+{
+	const xed_simple_flag_t *fa, *fb;
+	const xed_operand_t *oa, *ob;
+	const xed_inst_t *ia, *ib;
+	xed_operand_enum_t name;
+	unsigned i, n, m;
+	int comm;
+
+	if (xed_decoded_inst_get_iclass(a) != xed_decoded_inst_get_iclass(b) ||
+		xed_decoded_inst_get_length(a) != xed_decoded_inst_get_length(b) ||
+		xed_decoded_inst_get_operand_width(a) !=
+		xed_decoded_inst_get_operand_width(b))
+	{
+		return (0);
+	}
+
+	/* Multi-byte NOP: the memory operand is never accessed. */
+	if (xed_decoded_inst_get_category(a) == XED_CATEGORY_NOP ||
+		xed_decoded_inst_get_category(a) == XED_CATEGORY_WIDENOP)
+	{
+		return (1);
+	}
+
+	/* Flags read/written. */
+	fa = xed_decoded_inst_get_rflags_info(a);
+	fb = xed_decoded_inst_get_rflags_info(b);
+	if (!fa != !fb)
+		return (0);
+	if (fa && (
+		xed_simple_flag_get_read_flag_set(fa)->flat !=
+		xed_simple_flag_get_read_flag_set(fb)->flat ||
+		xed_simple_flag_get_written_flag_set(fa)->flat !=
+		xed_simple_flag_get_written_flag_set(fb)->flat))
+	{
+		return (0);
+	}
+
+	/* Operands. */
+	ia = xed_decoded_inst_inst(a);
+	ib = xed_decoded_inst_inst(b);
+	n  = xed_inst_noperands(ia);
+	if (n != xed_inst_noperands(ib))
+		return (0);
+
+	comm = inst_is_commutative(a);
+
+	for (i = 0; i < n; i++)
+	{
+		oa   = xed_inst_operand(ia, i);
+		ob   = xed_inst_operand(ib, i);
+		name = xed_operand_name(oa);
+
+		if (name != xed_operand_name(ob) ||
+			xed_operand_rw(oa) != xed_operand_rw(ob))
+		{
+			return (0);
+		}
+
+		if (xed_operand_is_register(name)) {
+			if (xed_decoded_inst_get_reg(a, name) !=
+				xed_decoded_inst_get_reg(b, name) &&
+				!(comm && ia == ib && reg_swapped(a, b, ia, i)))
+			{
+				return (0);
+			}
+			continue;
+		}
+
+		switch (name) {
+		case XED_OPERAND_MEM0:
+		case XED_OPERAND_MEM1:
+		case XED_OPERAND_AGEN:
+			m = (name == XED_OPERAND_MEM1);
+			if (xed_decoded_inst_get_base_reg(a, m) !=
+					xed_decoded_inst_get_base_reg(b, m) ||
+				xed_decoded_inst_get_index_reg(a, m) !=
+					xed_decoded_inst_get_index_reg(b, m) ||
+				xed_decoded_inst_get_seg_reg(a, m) !=
+					xed_decoded_inst_get_seg_reg(b, m) ||
+				xed_decoded_inst_get_scale(a, m) !=
+					xed_decoded_inst_get_scale(b, m) ||
+				xed_decoded_inst_get_memory_displacement(a, m) !=
+					xed_decoded_inst_get_memory_displacement(b, m))
+			{
+				return (0);
+			}
+			break;
+		case XED_OPERAND_IMM0:
+			if (xed_decoded_inst_get_unsigned_immediate(a) !=
+				xed_decoded_inst_get_unsigned_immediate(b))
+				return (0);
+			break;
+		case XED_OPERAND_RELBR:
+			if (xed_decoded_inst_get_branch_displacement(a) !=
+				xed_decoded_inst_get_branch_displacement(b))
+				return (0);
+			break;
+		default:
+			break;
+		}
+	}
+	return (1);
+}
+
+/**
+ * @brief Records a mismatch of the kind @p kind (VMSG_*) at the
+ * .text offset @p off, to be printed by verify_print().
+ *
+ * @param job  Verification job.
+ * @param kind Mismatch kind.
+ * @param off  Offset, relative to the .text start.
+ * @param a    Original instruction (VMSG_INST), or NULL.
+ * @param b    Patched instruction, or NULL if not decodable.
+ */
+static void verify_report(struct verify_job *job, int kind, uint64_t off,
+	const xed_decoded_inst_t *a, const xed_decoded_inst_t *b)
+{
+	struct verify_msg *m;
+
+	job->mismatches++;
+	if (job->nmsgs == VERIFY_MAX_REPORT)
+		return;
+
+	m       = &job->msgs[job->nmsgs++];
+	m->kind = kind;
+	m->off  = off;
+	m->from = a ? xed_iclass_enum_t2str(xed_decoded_inst_get_iclass(a)) : "";
+	m->to   = b ? xed_iclass_enum_t2str(xed_decoded_inst_get_iclass(b)) :
+		"invalid";
+}
+
+/**
+ * @brief Prints the first VERIFY_MAX_REPORT mismatches of the
+ * jobs, in .text order.
+ *
+ * @param jobs  Job list.
+ * @param njobs Amount of jobs.
+ */
+static void verify_print(const struct verify_job *jobs, int njobs)
+{
+	const struct verify_msg *m;
+	size_t shown, total, j;
+	int i;
+
+	for (i = 0, shown = 0, total = 0; i < njobs; i++)
+	{
+		total += jobs[i].mismatches;
+		for (j = 0; j < jobs[i].nmsgs && shown < VERIFY_MAX_REPORT; j++)
+		{
+			m = &jobs[i].msgs[j];
+			shown++;
+
+			switch (m->kind) {
+			case VMSG_INST:
+				ERR("Verify: mismatch at .text offset 0x%jx (%s -> %s)\n",
+					(uintmax_t)m->off, m->from, m->to);
+				break;
+			case VMSG_SKIP:
+				ERR("Verify: skipped range at 0x%jx was changed!\n",
+					(uintmax_t)m->off);
+				break;
+			default:
+				ERR("Verify: unable to decode original .text at 0x%jx\n",
+					(uintmax_t)m->off);
+				break;
+			}
+		}
+	}
+
+	if (total > shown)
+		ERR("Verify: (%zu more mismatches not shown)\n", total - shown);
+}
+
+/**
+ * @brief Verifies a range of the .text section: decodes the
+ * original instructions and, for each one whose bytes have
+ * changed, decodes the patched one and compares both.
+ *
+ * @param arg Verification job.
+ */
+static void *verify_worker(void *arg)
+{
+	struct verify_job *job = arg;
+	const struct decode_skip *skip, *skip_end;
+	const uint8_t *orig, *patched;
+	xed_decoded_inst_t inst, inst_new;
+	uint64_t off, size, end;
+	unsigned len;
+
+	orig    = job->orig->file_buff    + job->orig->elf_file_off;
+	patched = job->patched->file_buff + job->patched->elf_file_off;
+	size    = job->orig->elf_text_size;
+
+	/* First skipped range that ends after our start. */
+	skip     = job->skips;
+	skip_end = job->skips + job->nskips;
+	while (skip < skip_end && skip->off + skip->len <= job->start)
+		skip++;
+
+	for (off = job->start; off < job->end; off += len)
+	{
+		/* Undecodable range: must be unchanged. */
+		if (skip < skip_end && off >= skip->off)
+		{
+			end = skip->off + skip->len;
+			if (end > size)
+				end = size;
+			if (off < end && memcmp(orig + off, patched + off, end - off))
+				verify_report(job, VMSG_SKIP, skip->off, NULL, NULL);
+			len = (off < end) ? end - off : 0;
+			skip++;
+			continue;
+		}
+
+		xed_decoded_inst_zero(&inst);
+		xed_decoded_inst_set_mode(&inst,
+			job->orig->machine_mode, job->orig->machine_address);
+
+		if (xed_decode(&inst, orig + off, size - off) != XED_ERROR_NONE) {
+			verify_report(job, VMSG_DECODE, off, NULL, NULL);
+			break;
+		}
+
+		len = xed_decoded_inst_get_length(&inst);
+		if (!memcmp(orig + off, patched + off, len))
+			continue;
+
+		if (!inst_decode_as(&inst, patched + off, len, &inst_new)) {
+			verify_report(job, VMSG_INST, off, &inst, NULL);
+			continue;
+		}
+
+		if (!inst_equivalent(&inst, &inst_new))
+			verify_report(job, VMSG_INST, off, &inst, &inst_new);
+	}
+
+	job->stop = off;
+	return (NULL);
+}
+
+/**
+ * @brief Splits the .text section into (up to) @p njobs ranges,
+ * starting at function boundaries.
+ *
+ * @param info  ELF file info.
+ * @param jobs  Job list, with @p njobs entries.
+ * @param njobs Max amount of jobs.
+ *
+ * @return Returns the amount of jobs.
+ */
+static int verify_split(struct elf_file_info *info,
+	struct verify_job *jobs, int njobs)
+{
+	struct elf_sym *syms;
+	uint64_t target, start, base;
+	size_t nsyms, lo, hi, mid;
+	int i, n;
+
+	jobs[0].start = 0;
+	n = 1;
+
+	if (njobs > 1 && load_func_symbols(info, &syms, &nsyms) && nsyms)
+	{
+		base = info->elf_text_base_addr;
+		for (i = 1; i < njobs; i++)
+		{
+			target = base + info->elf_text_size * i / njobs;
+
+			/* First function starting at or after target. */
+			for (lo = 0, hi = nsyms; lo < hi; ) {
+				mid = (lo + hi) / 2;
+				if (syms[mid].addr < target)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			if (lo == nsyms)
+				break;
+
+			start = syms[lo].addr - base;
+			if (start > jobs[n - 1].start)
+				jobs[n++].start = start;
+		}
+		free(syms);
+	}
+
+	for (i = 0; i < n; i++)
+		jobs[i].end = (i + 1 < n) ? jobs[i + 1].start : info->elf_text_size;
+
+	return (n);
+}
+
+/**
+ * @brief Runs the jobs on @p njobs threads.
+ */
+static void verify_run(struct verify_job *jobs, int njobs)
+{
+	pthread_t *tids;
+	int i, started;
+
+	tids    = calloc(njobs, sizeof(*tids));
+	started = 0;
+
+	if (tids && njobs > 1)
+		for (; started < njobs; started++)
+			if (pthread_create(&tids[started], NULL, verify_worker,
+				&jobs[started]))
+				break;
+
+	/* Jobs not started are done here. */
+	for (i = started; i < njobs; i++)
+		verify_worker(&jobs[i]);
+
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+}
+
+/**
+ * @brief Checks that the patched file @p patched is equivalent
+ * to the original file @p orig: everything outside .text must
+ * be identical and every changed instruction must decode to the
+ * same instruction (see @ref inst_equivalent).
+ *
+ * The .text section is verified on @p nthreads threads, split
+ * at function boundaries. If the instruction boundaries seen by
+ * two adjacent ranges do not match (e.g.: data inside .text),
+ * the whole section is verified again by a single thread. Only
+ * the mismatches of the final pass are printed.
+ *
+ * @param orig     Original file.
+ * @param patched  Patched file.
+ * @param skips    Skip map of the write (--resync), or NULL:
+ *                 these ranges are not decoded, only compared.
+ * @param nskips   Amount of skipped ranges.
+ * @param nthreads Amount of threads.
+ *
+ * @return Returns the amount of mismatches found (0 if the files
+ * are equivalent).
+ */
+size_t verify_text(const struct elf_file_info *orig,
+	const struct elf_file_info *patched, const struct decode_skip *skips,
+	size_t nskips, int nthreads)
+{
+	struct elf_file_info info;
+	struct verify_job *jobs;
+	uint64_t text_end;
+	size_t mismatches;
+	int i, njobs;
+
+	if (orig->file_size != patched->file_size ||
+		orig->elf_file_off != patched->elf_file_off ||
+		orig->elf_text_size != patched->elf_text_size)
+	{
+		ERR("Verify: files have different layouts!\n");
+		return (1);
+	}
+
+	/* Everything outside .text. */
+	mismatches = 0;
+	text_end   = orig->elf_file_off + orig->elf_text_size;
+	if (memcmp(orig->file_buff, patched->file_buff, orig->elf_file_off) ||
+		memcmp(orig->file_buff + text_end, patched->file_buff + text_end,
+			orig->file_size - text_end))
+	{
+		ERR("Verify: data outside .text was changed!\n");
+		mismatches++;
+	}
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if (!(jobs = calloc(nthreads, sizeof(*jobs))))
+		errx("Unable to allocate memory!\n");
+
+	/* load_func_symbols() needs a non-const info. */
+	info  = *orig;
+	njobs = verify_split(&info, jobs, nthreads);
+
+	for (i = 0; i < njobs; i++) {
+		jobs[i].orig    = orig;
+		jobs[i].patched = patched;
+		jobs[i].skips   = skips;
+		jobs[i].nskips  = nskips;
+	}
+
+	verify_run(jobs, njobs);
+
+	for (i = 0; i + 1 < njobs; i++)
+		if (jobs[i].stop != jobs[i].end)
+			break;
+
+	/* Boundaries mismatch, start over with a single range. */
+	if (i + 1 < njobs)
+	{
+		memset(jobs, 0, sizeof(*jobs));
+		jobs[0].orig    = orig;
+		jobs[0].patched = patched;
+		jobs[0].skips   = skips;
+		jobs[0].nskips  = nskips;
+		jobs[0].end     = orig->elf_text_size;
+		njobs = 1;
+		verify_run(jobs, njobs);
+	}
+
+	/* Only the final pass is reported. */
+	verify_print(jobs, njobs);
+	for (i = 0; i < njobs; i++)
+		mismatches += jobs[i].mismatches;
+
+	free(jobs);
+	return (mismatches);
+}
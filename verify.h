@@ -0,0 +1,48 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+	#include <stddef.h>
+	#include <stdint.h>
+	#include <xed/xed-interface.h>
+
+	#include "decode.h"
+	#include "main.h"
+
+	/* Max amount of mismatches printed. */
+	#define VERIFY_MAX_REPORT 32
+
+	extern int inst_decode_as(const xed_decoded_inst_t *mode,
+		const uint8_t *buff, unsigned len, xed_decoded_inst_t *inst);
+
+	extern int inst_equivalent(const xed_decoded_inst_t *a,
+		const xed_decoded_inst_t *b);
+
+	extern size_t verify_text(const struct elf_file_info *orig,
+		const struct elf_file_info *patched, const struct decode_skip *skips,
+		size_t nskips, int nthreads);
+
+#endif /* VERIFY_H */